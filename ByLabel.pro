@@ -10,6 +10,7 @@ greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
 TARGET = ByLabel
 TEMPLATE = app
+CONFIG += c++11
 
 # The following define makes your compiler emit warnings if you use
 # any feature of Qt which has been marked as deprecated (the exact warnings
@@ -32,7 +33,30 @@ SOURCES += \
     ED.cpp \
     edgeitem.cpp \
     endpoint.cpp \
-    action.cpp
+    action.cpp \
+    connectionlayer.cpp \
+    imagebuffer.cpp \
+    annotationmodel.cpp \
+    sessionjournal.cpp \
+    sessionstate.cpp \
+    imageprefetcher.cpp \
+    videosource.cpp \
+    edgedetectjob.cpp \
+    cocowriter.cpp \
+    annotationexporter.cpp \
+    thumbnailcache.cpp \
+    imagelistmodel.cpp \
+    livewire.cpp \
+    regionbuilder.cpp \
+    regionlayer.cpp \
+    flowpropagator.cpp \
+    chainindex.cpp \
+    profiler.cpp \
+    edstatscollector.cpp \
+    memoryreport.cpp \
+    memorypanel.cpp \
+    inputrecorder.cpp \
+    replayharness.cpp
 
 HEADERS += \
     labelwidget.h \
@@ -42,7 +66,30 @@ HEADERS += \
     ED.h \
     edgeitem.h \
     endpoint.h \
-    action.h
+    action.h \
+    connectionlayer.h \
+    imagebuffer.h \
+    annotationmodel.h \
+    sessionjournal.h \
+    sessionstate.h \
+    imageprefetcher.h \
+    videosource.h \
+    edgedetectjob.h \
+    cocowriter.h \
+    annotationexporter.h \
+    thumbnailcache.h \
+    imagelistmodel.h \
+    livewire.h \
+    regionbuilder.h \
+    regionlayer.h \
+    flowpropagator.h \
+    chainindex.h \
+    profiler.h \
+    edstatscollector.h \
+    memoryreport.h \
+    memorypanel.h \
+    inputrecorder.h \
+    replayharness.h
 
 FORMS += \
     mainwindow.ui
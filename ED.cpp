@@ -5,24 +5,50 @@
  */
 
 #include "ED.h"
+#include <algorithm>
 
 #define GAUSS_SIZE	(5)
 #define GAUSS_SIGMA	(1.0)
 #define SOBEL_ORDER	(1)
 #define SOBEL_SIZE	(3)
 
+namespace
+{
+
+double elapsedMs(int64 since)
+{
+    return (cv::getTickCount() - since) * 1000.0 / cv::getTickFrequency();
+}
+
+// bytes of a std::list node holding one cv::Point
+const size_t LIST_NODE_BYTES = sizeof(cv::Point) + 2 * sizeof(void*);
+
+} //end of namespace
+
+EDStats::EDStats()
+    : error(0), smooth_ms(0), gradient_ms(0), anchor_ms(0), trace_ms(0), total_ms(0),
+      anchors(0), visited_anchors(0), traced_pixels(0), edges(0), peak_scratch_bytes(0)
+{
+    std::fill(length_histogram, length_histogram + LENGTH_BINS, 0);
+}
+
 int ED::detectEdges(const cv::Mat &image, 
 					std::vector<std::list<cv::Point>> &edges, 
 					const int proposal_thresh, 
 					const int anchor_interval, 
-					const int anchor_thresh)
+					const int anchor_thresh, 
+					EDStats *stats)
 {
+    if(stats)
+        *stats = EDStats();
+
 	// 0.preparation
     cv::Mat gray;
     if(image.empty())
     {
-        std::cout<<"Empty image input!"<<std::endl;
-        return -1;
+        if(stats)
+            stats->error = ERROR_EMPTY_IMAGE;
+        return ERROR_EMPTY_IMAGE;
     }
     if(image.type() == CV_8UC1)
         gray = image.clone();
@@ -30,30 +56,133 @@ int ED::detectEdges(const cv::Mat &image,
         cv::cvtColor(image, gray, CV_BGR2GRAY);
     else
     {
-        std::cout<<"Unknow image type!"<<std::endl;
-        return -2;
+        if(stats)
+            stats->error = ERROR_IMAGE_TYPE;
+        return ERROR_IMAGE_TYPE;
     }
 
     // 1.Gauss blur
-    cv::GaussianBlur(gray, gray, cv::Size(GAUSS_SIZE, GAUSS_SIZE), GAUSS_SIGMA, GAUSS_SIGMA);
+    int64 start = cv::getTickCount();
+    smooth(gray, gray);
+    if(stats)
+        stats->smooth_ms = elapsedMs(start);
 
-    // 2.get gradient magnitude and orientation
     cv::Mat M, O;
+    int count = detect(gray, edges, M, O, proposal_thresh, anchor_interval, anchor_thresh, stats);
+    // the gray copy is held through all stages
+    if(stats)
+        stats->peak_scratch_bytes += gray.total();
+    return count;
+}
+
+int ED::detectEdgesSmoothed(const cv::Mat &gray, 
+							std::vector<std::list<cv::Point>> &edges, 
+							const int proposal_thresh, 
+							const int anchor_interval, 
+							const int anchor_thresh, 
+							EDStats *stats)
+{
+    cv::Mat M, O;
+    return detectEdgesSmoothed(gray, edges, M, O, proposal_thresh, anchor_interval, anchor_thresh, stats);
+}
+
+int ED::detectEdgesSmoothed(const cv::Mat &gray, 
+							std::vector<std::list<cv::Point>> &edges, 
+							cv::Mat &M, 
+							cv::Mat &O, 
+							const int proposal_thresh, 
+							const int anchor_interval, 
+							const int anchor_thresh, 
+							EDStats *stats)
+{
+    if(stats)
+        *stats = EDStats();
+    return detect(gray, edges, M, O, proposal_thresh, anchor_interval, anchor_thresh, stats);
+}
+
+int ED::detect(const cv::Mat &gray, 
+			   std::vector<std::list<cv::Point>> &edges, 
+			   cv::Mat &M, 
+			   cv::Mat &O, 
+			   const int proposal_thresh, 
+			   const int anchor_interval, 
+			   const int anchor_thresh, 
+			   EDStats *stats)
+{
+    if(gray.empty() || gray.type() != CV_8UC1)
+    {
+        if(stats)
+            stats->error = ERROR_IMAGE_TYPE;
+        return ERROR_IMAGE_TYPE;
+    }
+
+    // 2.get gradient magnitude and orientation
+    int64 start = cv::getTickCount();
+    int64 stage = start;
     getGradient(gray, M, O);
+    if(stats)
+        stats->gradient_ms = elapsedMs(stage);
 
     // 3.get anchors
+    stage = cv::getTickCount();
     std::vector<cv::Point> anchors;
     getAnchors(M, O, proposal_thresh, anchor_interval, anchor_thresh, anchors);
+    if(stats)
+        stats->anchor_ms = elapsedMs(stage);
 
     // 4.trace edges from anchors
+    stage = cv::getTickCount();
     cv::Mat status(gray.rows, gray.cols, CV_8UC1, cv::Scalar(STATUS_UNKNOWN)); //Init all status to STATUS_UNKNOWN
     edges.clear();
+    int visited = 0;
     for(const auto &anchor : anchors)
+    {
+        if(status.at<uchar>(anchor.y, anchor.x) != STATUS_UNKNOWN)
+            ++visited;
         traceFromAnchor(M, O, proposal_thresh, anchor, status, edges);
+    }
+
+    if(stats)
+    {
+        stats->trace_ms = elapsedMs(stage);
+        stats->total_ms = stats->smooth_ms + elapsedMs(start);
+        stats->anchors = int(anchors.size());
+        stats->visited_anchors = visited;
+        stats->edges = int(edges.size());
+        for(const auto &edge : edges)
+        {
+            int length = int(edge.size());
+            stats->traced_pixels += length;
+            int bin = 0;
+            while(bin < EDStats::LENGTH_BINS - 1 && (length >> (bin + 1)) > 0)
+                ++bin;
+            ++stats->length_histogram[bin];
+        }
+
+        // gradient stage: Gx, Gy, M and O; trace stage: M, O, status, anchors and the traced lists
+        size_t pixels = gray.total();
+        size_t gradient = pixels * (2 * sizeof(short) + sizeof(short) + sizeof(uchar));
+        size_t trace = pixels * (sizeof(short) + 2 * sizeof(uchar))
+                     + anchors.capacity() * sizeof(cv::Point)
+                     + size_t(stats->traced_pixels) * LIST_NODE_BYTES
+                     + edges.capacity() * sizeof(std::list<cv::Point>);
+        stats->peak_scratch_bytes = std::max(gradient, trace);
+    }
     
     return int(edges.size());
 }
 
+void ED::smooth(const cv::Mat &gray, 
+				cv::Mat &smoothed)
+{
+    cv::GaussianBlur(gray, smoothed, cv::Size(GAUSS_SIZE, GAUSS_SIZE), GAUSS_SIGMA, GAUSS_SIGMA);
+}
+
+int ED::smoothRadius()
+{
+    return GAUSS_SIZE / 2;
+}
+
 void ED::getGradient(const cv::Mat &gray, 
 					 cv::Mat &M, 
 					 cv::Mat &O)
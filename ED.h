@@ -42,6 +42,32 @@ enum TRACE_DIR
 	TRACE_DOWN
 };
 
+/**
+ * @brief: statistics of one detection, filled when a pointer is passed to detectEdges*()
+ * @brief: timings are in milliseconds, see EDStatsCollector for the aggregate over many calls
+ */
+struct EDStats
+{
+	static const int LENGTH_BINS = 16;
+
+	int error;					// 0, or the negative value returned by detectEdges*()
+	double smooth_ms;			// 0 when the input was smoothed by the caller
+	double gradient_ms;
+	double anchor_ms;
+	double trace_ms;
+	double total_ms;
+	int anchors;
+	int visited_anchors;		// anchors skipped because an earlier trace already passed them
+	long long traced_pixels;
+	int edges;
+	// bin i counts the edges with 2^i <= length < 2^(i+1), the last bin also the longer ones
+	int length_histogram[LENGTH_BINS];
+	// largest working set of the Mats and containers used at once
+	size_t peak_scratch_bytes;
+
+	EDStats();
+};
+
 /**
  * @brief: wrapper of edge drawing functions
  * @brief: design all functions to static feature so it is not necessary to create an object of ED
@@ -49,6 +75,22 @@ enum TRACE_DIR
 class ED
 {
 public:
+	/**
+	 * @brief: default thresholds, see detectEdges()
+	 */
+	static const int DEFAULT_PROPOSAL_THRESH = 36;
+	static const int DEFAULT_ANCHOR_INTERVAL = 4;
+	static const int DEFAULT_ANCHOR_THRESH = 8;
+
+	/**
+	 * @brief: values returned by detectEdges*() on failure
+	 */
+	enum DETECT_ERROR
+	{
+		ERROR_EMPTY_IMAGE = -1,
+		ERROR_IMAGE_TYPE = -2
+	};
+
 	/**
 	 * @brief: detect edges from an image
 	 * @param: image [in] image to be processed
@@ -56,15 +98,47 @@ public:
 	 * @param: proposal_thresh [in] gradient blow this thresh should not be proposal of edge pixel
 	 * @param: anchor_interval [in] the interval of rows and cols in searching anchors
 	 * @param: anchor_thresh [in] the threshold to decision whether a pixel is an anchor
-	 * @return: the number of detected edges
+	 * @param: stats [out] optional statistics of this call
+	 * @return: the number of detected edges, or a negative DETECT_ERROR
 	 */
 	static int detectEdges(const cv::Mat &image, 
 						   std::vector<std::list<cv::Point>> &edges, 
-						   const int proposal_thresh = 36, 
-						   const int anchor_interval = 4, 
-						   const int anchor_thresh = 8);
+						   const int proposal_thresh = DEFAULT_PROPOSAL_THRESH, 
+						   const int anchor_interval = DEFAULT_ANCHOR_INTERVAL, 
+						   const int anchor_thresh = DEFAULT_ANCHOR_THRESH, 
+						   EDStats *stats = NULL);
+
+	/**
+	 * @brief: detect edges from a grayscale image that has already been smoothed by smooth()
+	 * @param: smoothed [in] smoothed 8-bit grayscale image
+	 * @param: edges [out] see above
+	 * @param: proposal_thresh [in] see above
+	 * @param: anchor_interval [in] see above
+	 * @param: anchor_thresh [in] see above
+	 * @param: stats [out] see above
+	 * @return: the number of detected edges
+	 */
+	static int detectEdgesSmoothed(const cv::Mat &smoothed, 
+								   std::vector<std::list<cv::Point>> &edges, 
+								   const int proposal_thresh = DEFAULT_PROPOSAL_THRESH, 
+								   const int anchor_interval = DEFAULT_ANCHOR_INTERVAL, 
+								   const int anchor_thresh = DEFAULT_ANCHOR_THRESH, 
+								   EDStats *stats = NULL);
+
+	/**
+	 * @brief: same as above, also returns the gradient planes the edges were traced on
+	 * @param: M [out] gradient magnitude, see getGradient()
+	 * @param: O [out] gradient orientation, see getGradient()
+	 */
+	static int detectEdgesSmoothed(const cv::Mat &smoothed, 
+								   std::vector<std::list<cv::Point>> &edges, 
+								   cv::Mat &M, 
+								   cv::Mat &O, 
+								   const int proposal_thresh = DEFAULT_PROPOSAL_THRESH, 
+								   const int anchor_interval = DEFAULT_ANCHOR_INTERVAL, 
+								   const int anchor_thresh = DEFAULT_ANCHOR_THRESH, 
+								   EDStats *stats = NULL);
 
-private:
 	/**
 	 * @brief: calculate gradient magnitude and orientation
 	 * @param: gray [in] input grayscale image
@@ -75,6 +149,32 @@ private:
 							cv::Mat &M, 
 							cv::Mat &O);
 
+	/**
+	 * @brief: Gauss blur applied to the grayscale image before computing gradient
+	 * @param: gray [in] 8-bit grayscale image, may be a ROI, pixels outside of it are used as border
+	 * @param: smoothed [out] smoothed image, can be the same as gray
+	 */
+	static void smooth(const cv::Mat &gray, 
+					   cv::Mat &smoothed);
+
+	/**
+	 * @brief: number of rows/cols around a pixel read by smooth()
+	 */
+	static int smoothRadius();
+
+private:
+	/**
+	 * @brief: stages 2 to 4 of the detection, stats is reset by the caller
+	 */
+	static int detect(const cv::Mat &gray, 
+					  std::vector<std::list<cv::Point>> &edges, 
+					  cv::Mat &M, 
+					  cv::Mat &O, 
+					  const int proposal_thresh, 
+					  const int anchor_interval, 
+					  const int anchor_thresh, 
+					  EDStats *stats);
+
 	/**
 	 * @brief: get anchors
 	 * @param: M [in] gradient magnitude
@@ -1,95 +1,358 @@
 #include "action.h"
-#include "edgeitem.h"
 #include "labelimage.h"
-#include "endpoint.h"
+#include "profiler.h"
 #include <QDebug>
 
-EndPointMove::EndPointMove(EndPoint *pPoint, unsigned int oldInd, unsigned int newInd)
+namespace
 {
-    endPoint = pPoint;
+
+// actions run on the GUI thread only; the children of a macro run inside its perform()
+int performDepth = 0;
+
+/**
+ *@brief ProfileScope on ACTION_PERFORM that records the outermost perform() only.
+ */
+class PerformScope
+{
+public:
+    PerformScope() : start(performDepth++ == 0 && Profiler::enabled() ? Profiler::now() : -1) {}
+    ~PerformScope()
+    {
+        performDepth--;
+        if (start >= 0) Profiler::record(Profiler::ACTION_PERFORM, start, Profiler::now());
+    }
+
+private:
+    qint64 start;
+};
+
+} //end of namespace
+
+Action* Action::read(LabelImage* image, QDataStream& in)
+{
+    quint8 type;
+    in >> type;
+
+    Action* act = NULL;
+    switch (type) {
+    case ENDPOINT_MOVE: {
+        qint32 edge, end;
+        quint32 oldIndex, newIndex;
+        in >> edge >> end >> oldIndex >> newIndex;
+        act = new EndPointMove(image, edge, (AnnotationModel::EdgeEnd)end, oldIndex, newIndex);
+        break;
+    }
+    case SPLIT_EDGE: {
+        qint32 oldEdge, splitIndex, newEdge1, newEdge2;
+        in >> oldEdge >> splitIndex >> newEdge1 >> newEdge2;
+        SplitEdge* split = new SplitEdge(image, oldEdge, splitIndex);
+        split->newEdge1 = newEdge1;
+        split->newEdge2 = newEdge2;
+        act = split;
+        break;
+    }
+    case MERGE_EDGES: {
+        qint32 edge1, end1, edge2, end2, merged, bridge;
+        in >> edge1 >> end1 >> edge2 >> end2 >> merged >> bridge;
+        MergeEdges* merge = new MergeEdges(image, edge1, (AnnotationModel::EdgeEnd)end1,
+                                           edge2, (AnnotationModel::EdgeEnd)end2);
+        merge->mergedEdge = merged;
+        merge->bridgeEdge = bridge;
+        act = merge;
+        break;
+    }
+    case SELECT_EDGE: {
+        qint32 edge;
+        bool selected;
+        in >> edge >> selected;
+        act = new SelectEdge(image, edge, selected);
+        break;
+    }
+    case CONNECT_POINT:
+    case CONNECT_PATH: {
+        AnnotationModel::PointRef point1, point2;
+        QPointF pos;
+        bool createPoint;
+        in >> point1.edge >> point1.id >> point2.edge >> point2.id >> pos >> createPoint;
+        std::vector<cv::Point> path;
+        if (type == CONNECT_PATH) {
+            quint32 count;
+            in >> count;
+            for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+                qint32 x, y;
+                in >> x >> y;
+                path.push_back(cv::Point(x, y));
+            }
+        }
+        ConnectPoint* connect = new ConnectPoint(image, point1, point2, pos, path);
+        connect->createPoint = createPoint;
+        act = connect;
+        break;
+    }
+    case MACRO: {
+        quint32 count;
+        in >> count;
+        MacroAction* macro = new MacroAction(image);
+        for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+            Action* sub = read(image, in);
+            if (!sub) break;
+            macro->add(sub);
+        }
+        act = macro;
+        break;
+    }
+    default:
+        break;
+    }
+
+    if (act && in.status() != QDataStream::Ok) {
+        delete act;
+        act = NULL;
+    }
+    return act;
+}
+
+EndPointMove::EndPointMove(LabelImage* pImage, int edgeId, AnnotationModel::EdgeEnd edgeEnd,
+                           unsigned int oldInd, unsigned int newInd)
+{
+    image = pImage;
+    edge = edgeId;
+    end = edgeEnd;
     oldIndex = oldInd;
     newIndex = newInd;
 }
 
 void EndPointMove::perform()
 {
-    endPoint->moveTo(newIndex);
-    endPoint->blink();
+    PerformScope scope;
+    image->moveEndPoint(edge, end, newIndex);
 }
 
 void EndPointMove::reverse()
 {
-    endPoint->moveTo(oldIndex);
-    endPoint->blink();
+    image->moveEndPoint(edge, end, oldIndex);
+}
+
+size_t EndPointMove::byteSize() const
+{
+    return sizeof(*this);
 }
 
-SplitEdge::SplitEdge(LabelImage* pImage, EdgeItem *pEdge)
+void EndPointMove::write(QDataStream& out) const
+{
+    out << (quint8)ENDPOINT_MOVE << (qint32)edge << (qint32)end << (quint32)oldIndex << (quint32)newIndex;
+}
+
+SplitEdge::SplitEdge(LabelImage* pImage, int edgeId, int index)
 {
     image = pImage;
-    oldEdge = pEdge;
-    newEdge1 = NULL;
-    newEdge2 = NULL;
+    oldEdge = edgeId;
+    splitIndex = index;
+    newEdge1 = -1;
+    newEdge2 = -1;
 }
 
 void SplitEdge::perform()
-{    
-    if (!newEdge1 || !newEdge2) {
-        std::vector<EdgeItem*> newEdges = oldEdge->split();
-        if (newEdges.size() != 2) return;
-        newEdge1 = newEdges[0];
-        newEdge2 = newEdges[1];
-    }
-    image->performSplitEdge(oldEdge, newEdge1, newEdge2);
-    newEdge1->blink();
-    newEdge2->blink();
+{
+    PerformScope scope;
+    if (splitIndex < 0) return;
+    if (!image->performSplitEdge(oldEdge, splitIndex, newEdge1, newEdge2)) return;
+    image->blinkEdge(newEdge1);
+    image->blinkEdge(newEdge2);
 }
 
 void SplitEdge::reverse()
 {
-    if (!newEdge1 || !newEdge2) return;
+    if (newEdge1 < 0 || newEdge2 < 0) return;
     image->reverseSplitEdge(oldEdge, newEdge1, newEdge2);
-    oldEdge->blink();
+    image->blinkEdge(oldEdge);
 }
 
-SelectEdge::SelectEdge(EdgeItem* pEdge)
+size_t SplitEdge::byteSize() const
 {
-    edge = pEdge;
+    return sizeof(*this);
+}
+
+void SplitEdge::write(QDataStream& out) const
+{
+    out << (quint8)SPLIT_EDGE << (qint32)oldEdge << (qint32)splitIndex << (qint32)newEdge1 << (qint32)newEdge2;
+}
+
+MergeEdges::MergeEdges(LabelImage* pImage, int edgeId1, AnnotationModel::EdgeEnd edgeEnd1,
+                       int edgeId2, AnnotationModel::EdgeEnd edgeEnd2)
+{
+    image = pImage;
+    edge1 = edgeId1;
+    end1 = edgeEnd1;
+    edge2 = edgeId2;
+    end2 = edgeEnd2;
+    mergedEdge = -1;
+    bridgeEdge = -1;
+}
+
+void MergeEdges::perform()
+{
+    PerformScope scope;
+    if (!image->performMergeEdges(edge1, end1, edge2, end2, mergedEdge, bridgeEdge)) return;
+    image->blinkEdge(mergedEdge);
+}
+
+void MergeEdges::reverse()
+{
+    if (mergedEdge < 0) return;
+    image->reverseMergeEdges(edge1, end1, edge2, end2, mergedEdge);
+    image->blinkEdge(edge1);
+    image->blinkEdge(edge2);
+}
+
+size_t MergeEdges::byteSize() const
+{
+    return sizeof(*this);
+}
+
+void MergeEdges::write(QDataStream& out) const
+{
+    out << (quint8)MERGE_EDGES << (qint32)edge1 << (qint32)end1 << (qint32)edge2 << (qint32)end2
+        << (qint32)mergedEdge << (qint32)bridgeEdge;
+}
+
+SelectEdge::SelectEdge(LabelImage* pImage, int edgeId, bool select)
+{
+    image = pImage;
+    edge = edgeId;
+    selected = select;
 }
 
 void SelectEdge::perform()
 {
-    edge->select();
+    PerformScope scope;
+    image->selectEdge(edge, selected);
 }
 
 void SelectEdge::reverse()
 {
-    edge->unselect();
-    edge->blink();
+    image->selectEdge(edge, !selected);
+    image->blinkEdge(edge);
 }
 
-ConnectPoint::ConnectPoint(LabelImage* image, EndPoint* point1, EndPoint* point2, QPointF pos)
+size_t SelectEdge::byteSize() const
+{
+    return sizeof(*this);
+}
+
+void SelectEdge::write(QDataStream& out) const
+{
+    out << (quint8)SELECT_EDGE << (qint32)edge << selected;
+}
+
+ConnectPoint::ConnectPoint(LabelImage* image, AnnotationModel::PointRef point1,
+                           AnnotationModel::PointRef point2, QPointF pos,
+                           const std::vector<cv::Point>& path)
 {
     pImage = image;
     pPoint1 = point1;
     pPoint2 = point2;
     pos2 = pos;
-    createPoint = point2 == NULL;
+    pPath = path;
+    createPoint = !point2.valid();
 }
 
 void ConnectPoint::perform()
 {
-    if (createPoint) {
-        pPoint2 = new EndPoint(pImage, pos2);
-        pImage->addStrayPoint(pPoint2);
-    }
-    pImage->addConnection(pPoint1, pPoint2);
+    PerformScope scope;
+    // the stray point gets its id once and is revived with the same id on redo
+    if (createPoint)
+        pPoint2 = pImage->createStrayPoint(pos2, pPoint2.id);
+    pImage->addConnection(pPoint1, pPoint2, pPath);
 }
 
 void ConnectPoint::reverse()
 {
-    if (createPoint) {
-        pImage->removeStrayPoint(pPoint2);
-        if (pPoint2) delete pPoint2;
-    }
+    // the stray point is still referenced by the connection until it is removed
     pImage->removeConnection(pPoint1, pPoint2);
+    if (createPoint)
+        pImage->removeStrayPoint(pPoint2.id);
+}
+
+size_t ConnectPoint::byteSize() const
+{
+    return sizeof(*this) + pPath.capacity()*sizeof(cv::Point);
+}
+
+void ConnectPoint::write(QDataStream& out) const
+{
+    out << (quint8)(pPath.empty() ? CONNECT_POINT : CONNECT_PATH) << (qint32)pPoint1.edge << (qint32)pPoint1.id
+        << (qint32)pPoint2.edge << (qint32)pPoint2.id << pos2 << createPoint;
+    if (pPath.empty()) return;
+    out << (quint32)pPath.size();
+    for (const auto& p : pPath)
+        out << (qint32)p.x << (qint32)p.y;
+}
+
+AnnotationModel::PointRef ConnectPoint::target() const
+{
+    return pPoint2;
+}
+
+MacroAction::MacroAction(LabelImage* pImage)
+{
+    image = pImage;
+}
+
+MacroAction::~MacroAction()
+{
+    for (auto act : actions)
+        delete act;
+}
+
+void MacroAction::add(Action* act)
+{
+    actions.push_back(act);
+}
+
+bool MacroAction::empty() const
+{
+    return actions.empty();
+}
+
+void MacroAction::perform()
+{
+    PerformScope scope;
+    bool items = changesItems();
+    image->beginBatch(items);
+    for (auto act : actions)
+        act->perform();
+    image->endBatch(items);
+}
+
+void MacroAction::reverse()
+{
+    bool items = changesItems();
+    image->beginBatch(items);
+    for (auto it = actions.rbegin(); it != actions.rend(); it++)
+        (*it)->reverse();
+    image->endBatch(items);
+}
+
+bool MacroAction::changesItems() const
+{
+    for (auto act : actions) {
+        if (act->changesItems()) return true;
+    }
+    return false;
+}
+
+size_t MacroAction::byteSize() const
+{
+    size_t bytes = sizeof(*this) + actions.capacity() * sizeof(Action*);
+    for (auto act : actions)
+        bytes += act->byteSize();
+    return bytes;
+}
+
+void MacroAction::write(QDataStream& out) const
+{
+    out << (quint8)MACRO << (quint32)actions.size();
+    for (auto act : actions)
+        act->write(out);
 }
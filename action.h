@@ -2,29 +2,61 @@
 #define ACTION_H
 
 #include <QPoint>
+#include <QDataStream>
+#include <cstddef>
+#include <vector>
+#include "annotationmodel.h"
 
-class EdgeItem;
-class EndPoint;
 class LabelImage;
 
+/**
+ *@brief undoable edit, recorded as a small diff against the AnnotationModel
+ * (edge ids, indices, point references) rather than graphics items, so the
+ * history never keeps views alive.
+ */
 class Action
 {
 public:
+    enum Type {
+        ENDPOINT_MOVE = 1,
+        SPLIT_EDGE,
+        SELECT_EDGE,
+        CONNECT_POINT,
+        MACRO,
+        CONNECT_PATH,   // CONNECT_POINT followed by the path pixels
+        MERGE_EDGES
+    };
+
     virtual ~Action() = default;
     virtual void perform() = 0;
     virtual void reverse() = 0;
+    // memory held by the action, used to budget the history
+    virtual size_t byteSize() const = 0;
+    // adds or removes scene items, a batch of such actions suspends the scene index
+    virtual bool changesItems() const { return false; }
+
+    // binary form for the session journal, including ids assigned by perform()
+    virtual void write(QDataStream& out) const = 0;
+    // returns NULL on malformed input
+    static Action* read(LabelImage* image, QDataStream& in);
 };
 
 class EndPointMove : public Action
 {
 public:
-    EndPointMove(EndPoint* pPoint, unsigned int oldInd, unsigned int newInd);
+    EndPointMove(LabelImage* pImage, int edgeId, AnnotationModel::EdgeEnd edgeEnd,
+                 unsigned int oldInd, unsigned int newInd);
 
     void perform() override;
     void reverse() override;
+    size_t byteSize() const override;
+    void write(QDataStream& out) const override;
 
 private:
-    EndPoint* endPoint;
+    friend class Action;
+    LabelImage* image;
+    int edge;
+    AnnotationModel::EdgeEnd end;
     unsigned int oldIndex;
     unsigned int newIndex;
 };
@@ -32,45 +64,114 @@ private:
 class SplitEdge : public Action
 {
 public:
-    SplitEdge(LabelImage* pImage, EdgeItem* pEdge);
+    SplitEdge(LabelImage* pImage, int edgeId, int index);
+
+    void perform() override;
+    void reverse() override;
+    size_t byteSize() const override;
+    bool changesItems() const override { return true; }
+    void write(QDataStream& out) const override;
+
+private:
+    friend class Action;
+    LabelImage* image;
+    int oldEdge;
+    int splitIndex;
+    int newEdge1;
+    int newEdge2;
+};
+
+class MergeEdges : public Action
+{
+public:
+    MergeEdges(LabelImage* pImage, int edgeId1, AnnotationModel::EdgeEnd edgeEnd1,
+               int edgeId2, AnnotationModel::EdgeEnd edgeEnd2);
 
     void perform() override;
     void reverse() override;
+    size_t byteSize() const override;
+    bool changesItems() const override { return true; }
+    void write(QDataStream& out) const override;
 
 private:
+    friend class Action;
     LabelImage* image;
-    EdgeItem* oldEdge;
-    EdgeItem* newEdge1;
-    EdgeItem* newEdge2;
+    int edge1;
+    AnnotationModel::EdgeEnd end1;
+    int edge2;
+    AnnotationModel::EdgeEnd end2;
+    // assigned on the first perform, reused on redo and replay
+    int mergedEdge;
+    int bridgeEdge;
 };
 
 class SelectEdge: public Action
 {
 public:
-    SelectEdge(EdgeItem* pEdge);
+    SelectEdge(LabelImage* pImage, int edgeId, bool select = true);
 
     void perform() override;
     void reverse() override;
+    size_t byteSize() const override;
+    void write(QDataStream& out) const override;
 
 private:
-    EdgeItem* edge;
+    friend class Action;
+    LabelImage* image;
+    int edge;
+    bool selected;
 };
 
 class ConnectPoint: public Action
 {
 public:
-    ConnectPoint(LabelImage* image, EndPoint* point1, EndPoint* point2, QPointF pos);
+    // point2 with a negative id creates a stray point at pos; path runs from point1 to point2
+    ConnectPoint(LabelImage* image, AnnotationModel::PointRef point1,
+                 AnnotationModel::PointRef point2, QPointF pos,
+                 const std::vector<cv::Point>& path = std::vector<cv::Point>());
 
     void perform() override;
     void reverse() override;
+    size_t byteSize() const override;
+    bool changesItems() const override { return true; }
+    void write(QDataStream& out) const override;
+
+    // the point connected to, valid once performed
+    AnnotationModel::PointRef target() const;
 
 private:
+    friend class Action;
     LabelImage* pImage;
-    EndPoint* pPoint1;
-    EndPoint* pPoint2;
+    AnnotationModel::PointRef pPoint1;
+    AnnotationModel::PointRef pPoint2;
     QPointF pos2;
     bool createPoint;
+    std::vector<cv::Point> pPath;
 };
 
+/**
+ *@brief group of actions applied as one batch and undone as one step
+ */
+class MacroAction: public Action
+{
+public:
+    MacroAction(LabelImage* pImage);
+    ~MacroAction();
+
+    // takes ownership of the action, which must not have been performed yet
+    void add(Action* act);
+    bool empty() const;
+
+    void perform() override;
+    void reverse() override;
+    size_t byteSize() const override;
+    bool changesItems() const override;
+    void write(QDataStream& out) const override;
+
+private:
+    friend class Action;
+    LabelImage* image;
+    std::vector<Action*> actions;
+};
 
 #endif // ACTION_H
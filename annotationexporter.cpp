@@ -0,0 +1,152 @@
+#include "annotationexporter.h"
+#include "sessionjournal.h"
+#include "sessionstate.h"
+#include "regionbuilder.h"
+#include <QRunnable>
+#include <QDir>
+#include <QFileInfo>
+#include <QImageReader>
+#include <QThread>
+#include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <functional>
+
+namespace
+{
+
+const char* COCO_FILE = "annotations.json";
+const char* MASK_DIR = "masks";
+
+class Worker : public QRunnable
+{
+public:
+    Worker(const std::function<void()>& job) : job(job) {}
+    void run() override { job(); }
+
+private:
+    std::function<void()> job;
+};
+
+} //end of namespace
+
+AnnotationExporter::AnnotationExporter(QObject *parent)
+    : QObject(parent), nextImage(0), doneImages(0), activeWorkers(0), failed(false), stopping(false)
+{
+    pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount()));
+}
+
+AnnotationExporter::~AnnotationExporter()
+{
+    cancel();
+    pool.waitForDone();
+}
+
+bool AnnotationExporter::start(const QStringList& images, const QString& outputDir,
+                               const std::map<QString, AnnotationModel>& unsaved)
+{
+    if (running() || images.isEmpty()) return false;
+    if (!QDir().mkpath(QDir(outputDir).filePath(MASK_DIR))) return false;
+    if (!writer.open(QDir(outputDir).filePath(COCO_FILE))) return false;
+
+    imageList = images;
+    outDir = outputDir;
+    unsavedModels = unsaved;
+    {
+        std::lock_guard<std::mutex> lock(skippedMutex);
+        skipped.clear();
+    }
+    nextImage = 0;
+    doneImages = 0;
+    failed = false;
+    stopping = false;
+
+    // a fixed set of workers pulling images, not one queued task per image
+    int workers = std::min(pool.maxThreadCount(), images.size());
+    activeWorkers = workers;
+    for (int i = 0; i < workers; i++)
+        pool.start(new Worker([this]() { work(); }));
+    return true;
+}
+
+void AnnotationExporter::cancel()
+{
+    stopping = true;
+}
+
+bool AnnotationExporter::running() const
+{
+    return activeWorkers > 0;
+}
+
+QStringList AnnotationExporter::unrecovered() const
+{
+    std::lock_guard<std::mutex> lock(skippedMutex);
+    return skipped;
+}
+
+void AnnotationExporter::work()
+{
+    while (!stopping) {
+        int index = nextImage++;
+        if (index >= imageList.size()) break;
+        if (!exportImage(index)) failed = true;
+        emit progress(++doneImages, imageList.size());
+    }
+
+    // the last worker out finishes the file
+    if (--activeWorkers == 0) {
+        bool ok = writer.close() && !failed && !stopping;
+        emit finished(ok);
+    }
+}
+
+bool AnnotationExporter::exportImage(int index)
+{
+    const QString& path = imageList[index];
+    int imageId = index + 1;
+
+    // only the header is read, the pixels are not needed
+    QSize size = QImageReader(path).size();
+    if (!size.isValid()) return false;
+
+    AnnotationModel model;
+    auto unsaved = unsavedModels.find(path);
+    if (unsaved != unsavedModels.end()) {
+        model = unsaved->second;
+    } else {
+        QByteArray state;
+        std::vector<QByteArray> records;
+        SessionJournal::readSession(SessionJournal::sessionDirFor(path), state, records);
+        // exporting the snapshot alone would silently drop the newer edits
+        if (!records.empty()) {
+            std::lock_guard<std::mutex> lock(skippedMutex);
+            skipped.append(path);
+            return false;
+        }
+        // snapshots leave the detected edges out, they are detected again here
+        if (!state.isEmpty() && !SessionState::modelFromState(state, path, model))
+            return false;
+    }
+
+    writer.addImage(imageId, QFileInfo(path).fileName(), size.width(), size.height());
+
+    RegionBuilder regions;
+    regions.build(model);
+    std::vector<const RegionBuilder::Polygon*> polys;
+    for (int i = 0; i < regions.regionCount(); i++) {
+        // only closed regions are objects, the canvas does not fill open chains either
+        const RegionBuilder::Region& region = regions.region(i);
+        if (region.closed && region.polygon.size() >= 3) polys.push_back(&region.polygon);
+    }
+    if (polys.empty()) return true;
+
+    // instance ids as pixel values, 16 bits once they do not fit in 8
+    cv::Mat mask = cv::Mat::zeros(size.height(), size.width(), polys.size() < 256 ? CV_8UC1 : CV_16UC1);
+    for (size_t i = 0; i < polys.size(); i++) {
+        writer.addAnnotation(imageId, *polys[i]);
+        RegionBuilder::fillPolygon(*polys[i], mask, (int)std::min<size_t>(i + 1, 65535));
+    }
+
+    QString maskName = QString("%1_%2.png").arg(imageId, 6, 10, QChar('0')).arg(QFileInfo(path).completeBaseName());
+    return cv::imwrite(QDir(outDir).filePath(QString(MASK_DIR) + "/" + maskName).toStdString(), mask);
+}
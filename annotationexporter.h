@@ -0,0 +1,67 @@
+#ifndef ANNOTATIONEXPORTER_H
+#define ANNOTATIONEXPORTER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+#include <opencv2/core/core.hpp>
+#include <atomic>
+#include <map>
+#include <mutex>
+#include "annotationmodel.h"
+#include "cocowriter.h"
+
+/**
+ *@brief exports the annotations of an image list as COCO polygons plus one
+ * PNG label mask per image, on a pool of worker threads.
+ *
+ * Closed regions, cycles of selected edges and connections, form the
+ * polygons like on the canvas, see RegionBuilder. Each worker pulls the
+ * next image, detects its edges again and restores its session snapshot
+ * onto them (snapshots leave the detected edges out), builds and rasterizes
+ * its polygons and hands them to the streaming writers, so memory grows
+ * with the number of workers and not with the number of images.
+ *
+ * Edits journaled after the last snapshot can only be replayed by a
+ * LabelImage, images whose session still holds such records (the app
+ * closed without compacting them) are skipped until they are opened once.
+ */
+class AnnotationExporter : public QObject
+{
+    Q_OBJECT
+public:
+    explicit AnnotationExporter(QObject *parent = 0);
+    ~AnnotationExporter();
+
+    // unsaved holds models newer than their snapshot on disk, e.g. the shown image
+    bool start(const QStringList& images, const QString& outputDir,
+               const std::map<QString, AnnotationModel>& unsaved = std::map<QString, AnnotationModel>());
+    void cancel();
+    bool running() const;
+    // images skipped for edits that are only in their journal, valid once finished
+    QStringList unrecovered() const;
+
+signals:
+    void progress(int done, int total);
+    void finished(bool ok);
+
+private:
+    void work();
+    bool exportImage(int index);
+
+    QStringList imageList;
+    QString outDir;
+    std::map<QString, AnnotationModel> unsavedModels;
+    mutable std::mutex skippedMutex;
+    QStringList skipped;
+
+    QThreadPool pool;
+    CocoWriter writer;
+    std::atomic<int> nextImage;
+    std::atomic<int> doneImages;
+    std::atomic<int> activeWorkers;
+    std::atomic<bool> failed;
+    std::atomic<bool> stopping;
+};
+
+#endif // ANNOTATIONEXPORTER_H
@@ -0,0 +1,972 @@
+#include "annotationmodel.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <climits>
+
+namespace
+{
+
+// largest extent of a chain that still fits the 16-bit offsets
+const int MAX_EXTENT = 65535;
+
+// 2 added connection paths, 3 edge records, pieces of merged edges and per chain owners
+const int SERIAL_VERSION = 3;
+
+template <typename T>
+void put(std::vector<char>& out, const T& value)
+{
+    const char* bytes = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T>
+void putRange(std::vector<char>& out, const T* values, int count)
+{
+    put(out, count);
+    const char* bytes = reinterpret_cast<const char*>(values);
+    out.insert(out.end(), bytes, bytes + count * sizeof(T));
+}
+
+template <typename T>
+void putVector(std::vector<char>& out, const std::vector<T>& values)
+{
+    putRange(out, values.data(), (int)values.size());
+}
+
+// FNV-1a, tells detected pools apart, not meant to resist tampering
+unsigned int checksum(const void* data, size_t size, unsigned int hash = 2166136261u)
+{
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; i++)
+        hash = (hash ^ bytes[i]) * 16777619u;
+    return hash;
+}
+
+// bounds checked reader over a serialized model
+class Reader
+{
+public:
+    Reader(const char* data, size_t size) : ptr(data), end(data + size), ok(true) {}
+
+    template <typename T>
+    T get()
+    {
+        T value = T();
+        if (!ok || (size_t)(end - ptr) < sizeof(T)) {
+            ok = false;
+            return value;
+        }
+        memcpy(&value, ptr, sizeof(T));
+        ptr += sizeof(T);
+        return value;
+    }
+
+    template <typename T>
+    void getVector(std::vector<T>& values)
+    {
+        int count = get<int>();
+        if (!ok || count < 0 || (size_t)(end - ptr) / sizeof(T) < (size_t)count) {
+            ok = false;
+            return;
+        }
+        values.resize(count);
+        memcpy(values.data(), ptr, count * sizeof(T));
+        ptr += count * sizeof(T);
+    }
+
+    bool good() const { return ok; }
+
+private:
+    const char* ptr;
+    const char* end;
+    bool ok;
+};
+
+typedef std::vector<std::pair<int, int>>::const_iterator StartIterator;
+
+// entries of a sorted (offset, id) list with the given offset
+std::pair<StartIterator, StartIterator> startingAt(const std::vector<std::pair<int, int>>& starts, int offset)
+{
+    auto first = std::lower_bound(starts.begin(), starts.end(), std::make_pair(offset, INT_MIN));
+    auto last = std::lower_bound(first, starts.end(), std::make_pair(offset + 1, INT_MIN));
+    return std::make_pair(first, last);
+}
+
+} //end of namespace
+
+AnnotationModel::AnnotationModel()
+    : baseChains(0), basePixels(0), baseChecksum(0)
+{
+}
+
+AnnotationModel::PointRef AnnotationModel::noPoint()
+{
+    PointRef ref;
+    ref.edge = -1;
+    ref.id = -1;
+    return ref;
+}
+
+AnnotationModel::PointRef AnnotationModel::strayRef(int id)
+{
+    PointRef ref;
+    ref.edge = -1;
+    ref.id = id;
+    return ref;
+}
+
+AnnotationModel::PointRef AnnotationModel::endRef(int edgeId, EdgeEnd end)
+{
+    PointRef ref;
+    ref.edge = edgeId;
+    ref.id = end;
+    return ref;
+}
+
+void AnnotationModel::clear()
+{
+    pixels.clear();
+    origins.clear();
+    baseChains = 0;
+    basePixels = 0;
+    baseChecksum = 0;
+    clearEdits();
+}
+
+void AnnotationModel::clearEdits()
+{
+    chainStart.clear();
+    chainEdge.clear();
+    extents.clear();
+    edges.clear();
+    pieces.clear();
+    strays.clear();
+    strayFlags.clear();
+    connections.clear();
+}
+
+void AnnotationModel::markBase()
+{
+    baseChains = (int)origins.size();
+    basePixels = (int)pixels.size();
+    baseChecksum = poolChecksum(baseChains, basePixels);
+}
+
+bool AnnotationModel::hasBase() const
+{
+    return basePixels > 0;
+}
+
+unsigned int AnnotationModel::poolChecksum(int chainCount, int pixelTotal) const
+{
+    unsigned int hash = checksum(pixels.data(), pixelTotal * sizeof(Offset));
+    return checksum(origins.data(), chainCount * sizeof(cv::Point), hash);
+}
+
+void AnnotationModel::serialize(std::vector<char>& out, bool omitBase) const
+{
+    out.clear();
+    omitBase = omitBase && hasBase();
+    put(out, SERIAL_VERSION);
+    put(out, (char)omitBase);
+    put(out, baseChains);
+    put(out, basePixels);
+    put(out, baseChecksum);
+    int skipPixels = omitBase ? basePixels : 0;
+    int skipChains = omitBase ? baseChains : 0;
+    putRange(out, pixels.data() + skipPixels, (int)pixels.size() - skipPixels);
+    putRange(out, origins.data() + skipChains, (int)origins.size() - skipChains);
+    putVector(out, chainStart);
+    putVector(out, chainEdge);
+
+    put(out, (int)edges.size());
+    for (const auto& e : edges) {
+        put(out, e.chain);
+        put(out, e.offset);
+        put(out, e.count);
+        put(out, e.head);
+        put(out, e.tail);
+        put(out, (char)e.selected);
+        put(out, (char)e.alive);
+        put(out, e.splitAt);
+        put(out, e.children[0]);
+        put(out, e.children[1]);
+        put(out, e.splitFrom);
+        put(out, e.mergedInto);
+        put(out, e.mergeFirst);
+        put(out, e.mergeLast);
+        put(out, e.mergeStart);
+        put(out, (char)e.mergeReversed);
+        put(out, e.firstPiece);
+        put(out, e.pieceCount);
+    }
+    putVector(out, pieces);
+
+    putVector(out, strays);
+    put(out, (int)strayFlags.size());
+    for (bool flag : strayFlags)
+        put(out, (char)flag);
+
+    put(out, (int)connections.size());
+    for (const auto& c : connections) {
+        put(out, c.first.edge);
+        put(out, c.first.id);
+        put(out, c.second.edge);
+        put(out, c.second.id);
+        putVector(out, c.path);
+    }
+}
+
+bool AnnotationModel::omitsBase(const char* data, size_t size)
+{
+    Reader in(data, size);
+    int version = in.get<int>();
+    bool omitted = in.get<char>() != 0;
+    return in.good() && version >= 1 && version <= SERIAL_VERSION && omitted;
+}
+
+bool AnnotationModel::deserialize(const char* data, size_t size)
+{
+    Reader in(data, size);
+    int version = in.get<int>();
+    bool omitted = in.get<char>() != 0;
+    int chains = in.get<int>();
+    int pixelTotal = in.get<int>();
+    unsigned int sum = in.get<unsigned int>();
+    if (!in.good() || version < 1 || version > SERIAL_VERSION
+            || (omitted && (!hasBase() || chains != baseChains || pixelTotal != basePixels || sum != baseChecksum))) {
+        clear();
+        return false;
+    }
+
+    std::vector<Offset> storedPixels;
+    std::vector<cv::Point> storedOrigins;
+    in.getVector(storedPixels);
+    in.getVector(storedOrigins);
+    if (omitted) {
+        // edits recorded over the same detected edges, only the appended part was stored
+        pixels.resize(basePixels);
+        origins.resize(baseChains);
+        pixels.insert(pixels.end(), storedPixels.begin(), storedPixels.end());
+        origins.insert(origins.end(), storedOrigins.begin(), storedOrigins.end());
+    } else {
+        // a full pool keeps the base it was saved with
+        pixels.swap(storedPixels);
+        origins.swap(storedOrigins);
+        baseChains = 0;
+        basePixels = 0;
+        baseChecksum = 0;
+        if (pixelTotal > 0 && chains <= (int)origins.size() && pixelTotal <= (int)pixels.size()
+                && poolChecksum(chains, pixelTotal) == sum) {
+            baseChains = chains;
+            basePixels = pixelTotal;
+            baseChecksum = sum;
+        }
+    }
+    clearEdits();
+    // older versions stored the owner of every pixel
+    std::vector<int> owner;
+    if (version >= 3) {
+        in.getVector(chainStart);
+        in.getVector(chainEdge);
+    } else {
+        in.getVector(owner);
+    }
+
+    int edgeTotal = in.get<int>();
+    for (int i = 0; i < edgeTotal && in.good(); i++) {
+        Edge e = plainEdge();
+        e.chain = in.get<int>();
+        e.offset = in.get<int>();
+        e.count = in.get<int>();
+        e.head = in.get<int>();
+        e.tail = in.get<int>();
+        e.selected = in.get<char>() != 0;
+        e.alive = in.get<char>() != 0;
+        if (version >= 3) {
+            e.splitAt = in.get<int>();
+            e.children[0] = in.get<int>();
+            e.children[1] = in.get<int>();
+            e.splitFrom = in.get<int>();
+            e.mergedInto = in.get<int>();
+            e.mergeFirst = in.get<int>();
+            e.mergeLast = in.get<int>();
+            e.mergeStart = in.get<int>();
+            e.mergeReversed = in.get<char>() != 0;
+            e.firstPiece = in.get<int>();
+            e.pieceCount = in.get<int>();
+        }
+        edges.push_back(e);
+    }
+    if (version >= 3) in.getVector(pieces);
+    for (const auto& e : edges) {
+        if (e.firstPiece < 0 || e.pieceCount < 0 || e.firstPiece + e.pieceCount > (int)pieces.size()) {
+            clear();
+            return false;
+        }
+    }
+
+    in.getVector(strays);
+    int strayTotal = in.get<int>();
+    for (int i = 0; i < strayTotal && in.good(); i++)
+        strayFlags.push_back(in.get<char>() != 0);
+
+    int connectionTotal = in.get<int>();
+    for (int i = 0; i < connectionTotal && in.good(); i++) {
+        Connection c;
+        c.first.edge = in.get<int>();
+        c.first.id = in.get<int>();
+        c.second.edge = in.get<int>();
+        c.second.id = in.get<int>();
+        if (version >= 2) in.getVector(c.path);
+        connections.push_back(c);
+    }
+
+    bool chainsOk = version >= 3 ? chainsValid() : owner.size() == pixels.size() && deriveRecords(owner);
+    if (!in.good() || strayFlags.size() != strays.size() || !chainsOk) {
+        clear();
+        return false;
+    }
+    deriveExtents();
+    return true;
+}
+
+void AnnotationModel::deriveExtents()
+{
+    extents.assign(chainStart.size(), Offset());
+    for (size_t chain = 0; chain < chainStart.size(); chain++) {
+        int end = chain + 1 < chainStart.size() ? chainStart[chain + 1] : (int)pixels.size();
+        Offset& extent = extents[chain];
+        extent.x = 0;
+        extent.y = 0;
+        for (int i = chainStart[chain]; i < end; i++) {
+            extent.x = std::max(extent.x, pixels[i].x);
+            extent.y = std::max(extent.y, pixels[i].y);
+        }
+    }
+}
+
+bool AnnotationModel::deriveRecords(const std::vector<int>& owner)
+{
+    if (!rangesValid()) return false;
+    for (int id : owner) {
+        if (id < 0 || id >= (int)edges.size() || edges[id].pieceCount > 0) return false;
+    }
+
+    // plain ranges by their first pixel, then id
+    std::vector<std::pair<int, int>> starts;
+    for (int id = 0; id < (int)edges.size(); id++) {
+        if (edges[id].pieceCount == 0 && edges[id].count > 0) starts.push_back(std::make_pair(edges[id].offset, id));
+    }
+    std::sort(starts.begin(), starts.end());
+
+    // the original edge of a chain is the oldest one covering all of it
+    chainStart.clear();
+    chainEdge.clear();
+    int begin = 0;
+    while (begin < (int)pixels.size()) {
+        int chain = edges[owner[begin]].chain;
+        int end = begin + 1;
+        while (end < (int)pixels.size() && edges[owner[end]].chain == chain) end++;
+        if (chain != (int)chainStart.size()) return false;
+        int root = -1;
+        auto range = startingAt(starts, begin);
+        for (auto it = range.first; it != range.second; it++) {
+            if (edges[it->second].count == end - begin) {
+                root = it->second;
+                break;
+            }
+        }
+        if (root < 0 || !deriveSplit(root, starts)) return false;
+        chainStart.push_back(begin);
+        chainEdge.push_back(root);
+        begin = end;
+    }
+    return chainStart.size() == origins.size();
+}
+
+bool AnnotationModel::rangesValid() const
+{
+    for (const auto& e : edges) {
+        if (e.pieceCount == 0 && (e.count < 0 || e.chain < 0 || e.chain >= (int)origins.size()
+                                  || e.offset < 0 || e.offset + e.count > (int)pixels.size()))
+            return false;
+    }
+    return true;
+}
+
+bool AnnotationModel::chainsValid() const
+{
+    if (!rangesValid() || chainStart.size() != origins.size() || chainEdge.size() != origins.size())
+        return false;
+    // chains cover the pool back to back, each from its owner's range
+    int next = 0;
+    for (size_t chain = 0; chain < chainStart.size(); chain++) {
+        int id = chainEdge[chain];
+        if (chainStart[chain] != next || id < 0 || id >= (int)edges.size()) return false;
+        const Edge& e = edges[id];
+        if (e.pieceCount > 0 || e.count <= 0 || e.chain != (int)chain || e.offset != next) return false;
+        next += e.count;
+    }
+    return next == (int)pixels.size();
+}
+
+bool AnnotationModel::deriveSplit(int id, const std::vector<std::pair<int, int>>& starts)
+{
+    const Edge& e = edges[id];
+    if (e.alive || e.splitAt >= 0 || e.mergedInto >= 0) return true;
+
+    // v1 and v2 snapshots kept no records and moved the owners to the children: a retired
+    // edge was split into two newer edges covering its range back to back, the latest
+    // split whose children lead to alive edges is the one in effect
+    auto firsts = startingAt(starts, e.offset);
+    for (auto first = firsts.second; first != firsts.first; ) {
+        int id1 = (--first)->second;
+        int count1 = edges[id1].count;
+        if (id1 <= id) break;
+        if (count1 >= e.count) continue;
+        auto seconds = startingAt(starts, e.offset + count1);
+        for (auto second = seconds.second; second != seconds.first; ) {
+            int id2 = (--second)->second;
+            if (id2 <= id) break;
+            if (edges[id2].count != e.count - count1) continue;
+            if (!deriveSplit(id1, starts) || !deriveSplit(id2, starts)) continue;
+            Edge& parent = edges[id];
+            parent.splitAt = count1 - 1;
+            parent.children[0] = id1;
+            parent.children[1] = id2;
+            edges[id1].splitFrom = id;
+            edges[id2].splitFrom = id;
+            return true;
+        }
+    }
+    return false;
+}
+
+int AnnotationModel::addEdge(const std::list<cv::Point>& points)
+{
+    std::vector<cv::Point> chain;
+    chain.reserve(points.size());
+    for (const auto& point : points) {
+        // ignore duplicate pixels at same location
+        if (!chain.empty() && chain.back() == point) continue;
+        chain.push_back(point);
+    }
+
+    // a chain longer than the offset range is stored as several edges
+    int first = -1;
+    int begin = 0;
+    while (begin < (int)chain.size()) {
+        cv::Point tl = chain[begin];
+        cv::Point br = tl;
+        int end = begin + 1;
+        for (; end < (int)chain.size(); end++) {
+            cv::Point ntl(std::min(tl.x, chain[end].x), std::min(tl.y, chain[end].y));
+            cv::Point nbr(std::max(br.x, chain[end].x), std::max(br.y, chain[end].y));
+            if (nbr.x - ntl.x > MAX_EXTENT || nbr.y - ntl.y > MAX_EXTENT) break;
+            tl = ntl;
+            br = nbr;
+        }
+        int id = appendChain(chain, begin, end, tl);
+        if (first < 0) first = id;
+        begin = end;
+    }
+    return first;
+}
+
+int AnnotationModel::appendChain(const std::vector<cv::Point>& points, int begin, int end, const cv::Point& origin, int id)
+{
+    Edge edge = plainEdge();
+    edge.chain = (int)origins.size();
+    edge.offset = (int)pixels.size();
+    edge.count = end - begin;
+    edge.head = 0;
+    edge.tail = edge.count - 1;
+    edge.alive = true;
+
+    allocateId(id);
+    origins.push_back(origin);
+    chainStart.push_back(edge.offset);
+    chainEdge.push_back(id);
+    Offset extent;
+    extent.x = 0;
+    extent.y = 0;
+    for (int i = begin; i < end; i++) {
+        Offset offset;
+        offset.x = (unsigned short)(points[i].x - origin.x);
+        offset.y = (unsigned short)(points[i].y - origin.y);
+        pixels.push_back(offset);
+        extent.x = std::max(extent.x, offset.x);
+        extent.y = std::max(extent.y, offset.y);
+    }
+    extents.push_back(extent);
+    edges[id] = edge;
+    return id;
+}
+
+AnnotationModel::Edge AnnotationModel::plainEdge()
+{
+    Edge edge;
+    edge.chain = 0;
+    edge.offset = 0;
+    edge.count = 0;
+    edge.head = 0;
+    edge.tail = -1;
+    edge.selected = false;
+    edge.alive = false;
+    edge.splitAt = -1;
+    edge.children[0] = -1;
+    edge.children[1] = -1;
+    edge.splitFrom = -1;
+    edge.mergedInto = -1;
+    edge.mergeFirst = 0;
+    edge.mergeLast = -1;
+    edge.mergeStart = 0;
+    edge.mergeReversed = false;
+    edge.firstPiece = 0;
+    edge.pieceCount = 0;
+    return edge;
+}
+
+void AnnotationModel::allocateId(int& id)
+{
+    // unused slots below a recorded id stay retired
+    if (id < 0)
+        id = (int)edges.size();
+    if (id >= (int)edges.size())
+        edges.resize(id + 1, plainEdge());
+}
+
+void AnnotationModel::addEdges(const std::vector<std::list<cv::Point>>& edgeList)
+{
+    for (const auto& points : edgeList)
+        addEdge(points);
+}
+
+int AnnotationModel::edgeCount() const
+{
+    return (int)edges.size();
+}
+
+const AnnotationModel::Edge& AnnotationModel::edge(int id) const
+{
+    return edges[id];
+}
+
+bool AnnotationModel::edgeAlive(int id) const
+{
+    return id >= 0 && id < (int)edges.size() && edges[id].alive;
+}
+
+cv::Point AnnotationModel::point(int id, int index) const
+{
+    const Edge& e = edges[id];
+    int chain = e.chain;
+    int pool = e.offset + index;
+    // merged edges have a few pieces, found by a short scan
+    for (int i = e.firstPiece; i < e.firstPiece + e.pieceCount; i++) {
+        const Piece& piece = pieces[i];
+        if (index < piece.count) {
+            chain = piece.chain;
+            pool = piece.reversed ? piece.offset + piece.count - 1 - index : piece.offset + index;
+            break;
+        }
+        index -= piece.count;
+    }
+    const Offset& offset = pixels[pool];
+    const cv::Point& origin = origins[chain];
+    return cv::Point(origin.x + offset.x, origin.y + offset.y);
+}
+
+bool AnnotationModel::pointVisible(int id, int index) const
+{
+    const Edge& e = edges[id];
+    return index >= e.head && index <= e.tail;
+}
+
+bool AnnotationModel::mayIntersect(int id, const cv::Rect& box) const
+{
+    auto meets = [this, &box](int chain) {
+        const cv::Point& origin = origins[chain];
+        const Offset& extent = extents[chain];
+        return origin.x <= box.x + box.width - 1 && origin.x + extent.x >= box.x
+                && origin.y <= box.y + box.height - 1 && origin.y + extent.y >= box.y;
+    };
+    const Edge& e = edges[id];
+    if (e.pieceCount == 0) return meets(e.chain);
+    for (int i = e.firstPiece; i < e.firstPiece + e.pieceCount; i++) {
+        if (meets(pieces[i].chain)) return true;
+    }
+    return false;
+}
+
+cv::Rect AnnotationModel::boundingRect(int id) const
+{
+    const Edge& e = edges[id];
+    if (e.pieceCount > 0) {
+        cv::Point tl = point(id, 0);
+        cv::Point br = tl;
+        for (int i = 1; i < e.count; i++) {
+            cv::Point p = point(id, i);
+            tl = cv::Point(std::min(tl.x, p.x), std::min(tl.y, p.y));
+            br = cv::Point(std::max(br.x, p.x), std::max(br.y, p.y));
+        }
+        return cv::Rect(tl, br);
+    }
+
+    Offset tl = pixels[e.offset];
+    Offset br = tl;
+    for (int i = e.offset + 1; i < e.offset + e.count; i++) {
+        tl.x = std::min(tl.x, pixels[i].x);
+        tl.y = std::min(tl.y, pixels[i].y);
+        br.x = std::max(br.x, pixels[i].x);
+        br.y = std::max(br.y, pixels[i].y);
+    }
+    const cv::Point& origin = origins[e.chain];
+    return cv::Rect(cv::Point(origin.x + tl.x, origin.y + tl.y), cv::Point(origin.x + br.x, origin.y + br.y));
+}
+
+int AnnotationModel::endIndex(int id, EdgeEnd end) const
+{
+    return end == HEAD ? edges[id].head : edges[id].tail;
+}
+
+bool AnnotationModel::canMoveEnd(int id, EdgeEnd end, int index) const
+{
+    const Edge& e = edges[id];
+    if (index < 0 || index >= e.count) return false;
+    // head and tail never cross or meet
+    if (end == HEAD) return index < e.tail;
+    return index > e.head;
+}
+
+void AnnotationModel::setEndIndex(int id, EdgeEnd end, int index)
+{
+    if (end == HEAD)
+        edges[id].head = index;
+    else
+        edges[id].tail = index;
+}
+
+void AnnotationModel::setSelected(int id, bool selected)
+{
+    edges[id].selected = selected;
+}
+
+bool AnnotationModel::splitEdge(int id, int index, int& id1, int& id2)
+{
+    if (!edgeAlive(id) || !pointVisible(id, index) || !pointVisible(id, index+1)) return false;
+    const Edge parent = edges[id];
+    allocateId(id1);
+    allocateId(id2);
+
+    Edge first = plainEdge();
+    std::vector<Piece> list;
+    rangePieces(id, 0, index, false, list);
+    setPieces(first, list, edges[id1]);
+    first.head = parent.head;
+    first.tail = index;
+    first.alive = true;
+    first.splitFrom = id;
+
+    Edge second = plainEdge();
+    list.clear();
+    rangePieces(id, index + 1, parent.count - 1, false, list);
+    setPieces(second, list, edges[id2]);
+    second.head = 0;
+    second.tail = parent.tail - index - 1;
+    second.alive = true;
+    second.splitFrom = id;
+
+    edges[id1] = first;
+    edges[id2] = second;
+
+    // the pixels stay owned by id, lookups follow the split to the children
+    Edge& retired = edges[id];
+    retired.alive = false;
+    retired.splitAt = index;
+    retired.children[0] = id1;
+    retired.children[1] = id2;
+    retired.mergedInto = -1;
+    return true;
+}
+
+void AnnotationModel::unsplitEdge(int id, int id1, int id2)
+{
+    Edge& parent = edges[id];
+    parent.head = edges[id1].head;
+    parent.tail = edges[id1].count + edges[id2].tail;
+    parent.alive = true;
+    parent.splitAt = -1;
+
+    edges[id1].alive = false;
+    edges[id2].alive = false;
+}
+
+bool AnnotationModel::mergeEdges(int id1, EdgeEnd end1, int id2, EdgeEnd end2, int& merged, int& bridge)
+{
+    if (id1 == id2 || !edgeAlive(id1) || !edgeAlive(id2)) return false;
+    const Edge a = edges[id1];
+    const Edge b = edges[id2];
+
+    // id1 runs towards its joined end, id2 away from it; pixels beyond the joined ends are left out
+    bool reversed1 = end1 == HEAD;
+    int first1 = reversed1 ? a.head : 0;
+    int last1 = reversed1 ? a.count - 1 : a.tail;
+    bool reversed2 = end2 == TAIL;
+    int first2 = reversed2 ? 0 : b.head;
+    int last2 = reversed2 ? b.tail : b.count - 1;
+
+    // 8-connected line between the joined ends, without the ends themselves
+    cv::Point from = point(id1, endIndex(id1, end1));
+    cv::Point to = point(id2, endIndex(id2, end2));
+    cv::Point delta = to - from;
+    int steps = std::max(std::abs(delta.x), std::abs(delta.y));
+    std::vector<cv::Point> gap;
+    for (int i = 1; i < steps; i++) {
+        gap.push_back(cv::Point(from.x + (int)std::lround((double)delta.x * i / steps),
+                                from.y + (int)std::lround((double)delta.y * i / steps)));
+    }
+
+    allocateId(merged);
+    if (gap.empty()) {
+        bridge = -1;
+    } else if (bridge < 0 || bridge >= (int)edges.size() || edges[bridge].count != (int)gap.size()) {
+        // the bridge gets pixels of its own at the end of the pool, kept for redo
+        cv::Point tl = gap.front();
+        for (const auto& p : gap)
+            tl = cv::Point(std::min(tl.x, p.x), std::min(tl.y, p.y));
+        bridge = appendChain(gap, 0, (int)gap.size(), tl, bridge);
+    }
+
+    Edge joined = plainEdge();
+    std::vector<Piece> list;
+    rangePieces(id1, first1, last1, reversed1, list);
+    int start2 = last1 - first1 + 1;
+    if (bridge >= 0) {
+        rangePieces(bridge, 0, edges[bridge].count - 1, false, list);
+        start2 += edges[bridge].count;
+    }
+    rangePieces(id2, first2, last2, reversed2, list);
+    setPieces(joined, list, edges[merged]);
+    joined.head = reversed1 ? last1 - a.tail : a.head;
+    joined.tail = start2 + (reversed2 ? last2 - b.head : b.tail - first2);
+    joined.selected = a.selected || b.selected;
+    joined.alive = true;
+    edges[merged] = joined;
+
+    auto retire = [this, merged](int id, int first, int last, int start, bool reversed) {
+        Edge& e = edges[id];
+        e.alive = false;
+        e.splitAt = -1;
+        e.mergedInto = merged;
+        e.mergeFirst = first;
+        e.mergeLast = last;
+        e.mergeStart = start;
+        e.mergeReversed = reversed;
+    };
+    retire(id1, first1, last1, 0, reversed1);
+    if (bridge >= 0) retire(bridge, 0, edges[bridge].count - 1, last1 - first1 + 1, false);
+    retire(id2, first2, last2, start2, reversed2);
+    return true;
+}
+
+void AnnotationModel::unmergeEdges(int id1, int id2, int merged)
+{
+    edges[merged].alive = false;
+    for (int id : {id1, id2}) {
+        edges[id].alive = true;
+        edges[id].mergedInto = -1;
+    }
+}
+
+void AnnotationModel::rangePieces(int id, int first, int last, bool reversed, std::vector<Piece>& out) const
+{
+    const Edge& e = edges[id];
+    size_t begin = out.size();
+    if (e.pieceCount == 0) {
+        Piece piece;
+        piece.chain = e.chain;
+        piece.offset = e.offset + first;
+        piece.count = last - first + 1;
+        piece.reversed = 0;
+        out.push_back(piece);
+    } else {
+        int start = 0;
+        for (int i = e.firstPiece; i < e.firstPiece + e.pieceCount; i++) {
+            const Piece& piece = pieces[i];
+            // overlap of the piece with first..last, in local indices of the piece
+            int lo = std::max(first - start, 0);
+            int hi = std::min(last - start, piece.count - 1);
+            start += piece.count;
+            if (lo > hi) continue;
+            Piece part = piece;
+            part.count = hi - lo + 1;
+            part.offset = piece.reversed ? piece.offset + piece.count - 1 - hi : piece.offset + lo;
+            out.push_back(part);
+        }
+    }
+
+    if (reversed) {
+        std::reverse(out.begin() + begin, out.end());
+        for (size_t i = begin; i < out.size(); i++)
+            out[i].reversed = !out[i].reversed;
+    }
+}
+
+void AnnotationModel::setPieces(Edge& edge, const std::vector<Piece>& list, const Edge& previous)
+{
+    edge.count = 0;
+    for (const auto& piece : list)
+        edge.count += piece.count;
+
+    // a single forward piece is a plain range, the common case after splits
+    if (list.size() == 1 && !list[0].reversed) {
+        edge.chain = list[0].chain;
+        edge.offset = list[0].offset;
+        edge.firstPiece = 0;
+        edge.pieceCount = 0;
+        return;
+    }
+    edge.chain = list.front().chain;
+    edge.offset = -1;
+    edge.pieceCount = (int)list.size();
+    // a redo recreates the same pieces, only the edge ever refers to its slot
+    if (previous.pieceCount >= edge.pieceCount) {
+        edge.firstPiece = previous.firstPiece;
+        std::copy(list.begin(), list.end(), pieces.begin() + edge.firstPiece);
+        return;
+    }
+    edge.firstPiece = (int)pieces.size();
+    pieces.insert(pieces.end(), list.begin(), list.end());
+}
+
+int AnnotationModel::pixelCount() const
+{
+    return (int)pixels.size();
+}
+
+cv::Point AnnotationModel::pixel(int poolIndex) const
+{
+    const Offset& offset = pixels[poolIndex];
+    const cv::Point& origin = origins[chainOf(poolIndex)];
+    return cv::Point(origin.x + offset.x, origin.y + offset.y);
+}
+
+int AnnotationModel::chainOf(int poolIndex) const
+{
+    return (int)(std::upper_bound(chainStart.begin(), chainStart.end(), poolIndex) - chainStart.begin()) - 1;
+}
+
+bool AnnotationModel::locatePixel(int poolIndex, int& id, int& index) const
+{
+    // owners are the plain ranges the chains were added with
+    int chain = chainOf(poolIndex);
+    id = chainEdge[chain];
+    index = poolIndex - chainStart[chain];
+
+    // each step follows one edit, the guard only protects against corrupt records
+    for (size_t steps = 0; !edges[id].alive; steps++) {
+        const Edge& e = edges[id];
+        if (steps > edges.size()) return false;
+        if (e.splitAt >= 0) {
+            if (index <= e.splitAt) {
+                id = e.children[0];
+            } else {
+                index -= e.splitAt + 1;
+                id = e.children[1];
+            }
+        } else if (e.mergedInto >= 0) {
+            if (index < e.mergeFirst || index > e.mergeLast) return false;
+            index = e.mergeReversed ? e.mergeStart + e.mergeLast - index : e.mergeStart + index - e.mergeFirst;
+            id = e.mergedInto;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+int AnnotationModel::pixelOwner(int poolIndex) const
+{
+    int id, index;
+    return locatePixel(poolIndex, id, index) ? id : -1;
+}
+
+int AnnotationModel::addStrayPoint(const cv::Point2f& pos, int id)
+{
+    if (id < 0)
+        id = (int)strays.size();
+    if (id >= (int)strays.size()) {
+        strays.resize(id + 1, pos);
+        strayFlags.resize(id + 1, false);
+    }
+    strays[id] = pos;
+    strayFlags[id] = true;
+    return id;
+}
+
+void AnnotationModel::removeStrayPoint(int id)
+{
+    strayFlags[id] = false;
+}
+
+bool AnnotationModel::strayAlive(int id) const
+{
+    return id >= 0 && id < (int)strays.size() && strayFlags[id];
+}
+
+cv::Point2f AnnotationModel::position(const PointRef& ref) const
+{
+    if (ref.edge < 0)
+        return strays[ref.id];
+    // pixel center
+    cv::Point p = point(ref.edge, endIndex(ref.edge, (EdgeEnd)ref.id));
+    return cv::Point2f(p.x + 0.5f, p.y + 0.5f);
+}
+
+void AnnotationModel::addConnection(const PointRef& first, const PointRef& second,
+                                    const std::vector<cv::Point>& path)
+{
+    Connection connection;
+    connection.first = first;
+    connection.second = second;
+    connection.path = path;
+    connections.push_back(connection);
+}
+
+void AnnotationModel::removeConnection(const PointRef& first, const PointRef& second)
+{
+    for (auto it = connections.begin(); it != connections.end(); it++) {
+        if (it->first == first && it->second == second) {
+            connections.erase(it);
+            return;
+        }
+    }
+}
+
+void AnnotationModel::moveConnections(const PointRef& from, const PointRef& to)
+{
+    for (auto& c : connections) {
+        if (c.first == from) c.first = to;
+        if (c.second == from) c.second = to;
+    }
+}
+
+const std::vector<AnnotationModel::Connection>& AnnotationModel::connectionList() const
+{
+    return connections;
+}
+
+size_t AnnotationModel::memoryBytes() const
+{
+    size_t bytes = pixels.capacity()*sizeof(Offset) + origins.capacity()*sizeof(cv::Point)
+            + (chainStart.capacity() + chainEdge.capacity())*sizeof(int) + extents.capacity()*sizeof(Offset) + edges.capacity()*sizeof(Edge) + pieces.capacity()*sizeof(Piece)
+            + strays.capacity()*sizeof(cv::Point2f) + strayFlags.capacity()/8
+            + connections.capacity()*sizeof(Connection);
+    for (const auto& c : connections)
+        bytes += c.path.capacity()*sizeof(cv::Point);
+    return bytes;
+}
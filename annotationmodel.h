@@ -0,0 +1,198 @@
+#ifndef ANNOTATIONMODEL_H
+#define ANNOTATIONMODEL_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <list>
+
+/**
+ *@brief annotation state of one image, independent of Qt: edges as ranges of
+ * a shared pixel pool, endpoint indices, selection, stray points and
+ * connections. Graphics items are views over it, batch tools can use it
+ * without a scene.
+ *
+ * Edges are referenced by id. Splitting an edge retires its id and creates
+ * two children over sub-ranges of the same pixels; merging two edges
+ * retires both and creates one over pieces of their pixels plus a short
+ * bridge appended to the pool. Existing pool indices never change.
+ *
+ * The owner of a pool pixel is the edge its chain was added with. A retired
+ * edge records what became of it (split, merged), and the alive edge holding
+ * a pixel is found by following those records, so neither splits nor merges
+ * touch the pixels themselves and both take constant time.
+ *
+ * Pixels are stored as 16-bit offsets from the origin of the chain they
+ * were detected in, 4 bytes per pixel against 8 for a cv::Point. Origin,
+ * extent, first pixel and owner are kept per chain, a pixel finds its chain
+ * by a binary search over the chain starts. Image coordinates are derived
+ * on access.
+ */
+class AnnotationModel
+{
+public:
+    enum EdgeEnd { HEAD = 0, TAIL = 1 };
+
+    struct Edge {
+        int chain;      // detected chain the pixels belong to, gives the origin
+        int offset;     // first pixel in the pool
+        int count;      // number of pixels
+        int head;       // first visible pixel, local index
+        int tail;       // last visible pixel, local index
+        bool selected;
+        bool alive;
+
+        // what became of a retired edge, -1 if nothing
+        int splitAt;        // split after this local index into children[0] and children[1]
+        int children[2];
+        int splitFrom;      // edge this one was split from
+        int mergedInto;     // merged edge holding local indices mergeFirst..mergeLast of this one
+        int mergeFirst;
+        int mergeLast;
+        int mergeStart;     // local index of mergeFirst in the merged edge
+        bool mergeReversed;
+
+        // a merged edge is a sequence of pieces instead of the range chain/offset/count
+        int firstPiece;
+        int pieceCount;
+    };
+
+    // count pixels of the pool from offset, chain gives the origin; reversed runs backwards
+    struct Piece {
+        int chain;
+        int offset;
+        int count;
+        int reversed;
+    };
+
+    // an endpoint of an edge (edge >= 0, id is EdgeEnd) or a stray point (edge < 0)
+    struct PointRef {
+        int edge;
+        int id;
+        bool operator==(const PointRef& other) const { return edge == other.edge && id == other.id; }
+        bool valid() const { return id >= 0; }
+    };
+
+    struct Connection {
+        PointRef first;
+        PointRef second;
+        // pixels between the two points, from first to second; empty for a straight segment
+        std::vector<cv::Point> path;
+    };
+
+    AnnotationModel();
+
+    static PointRef noPoint();
+    static PointRef strayRef(int id);
+    static PointRef endRef(int edgeId, EdgeEnd end);
+
+    void clear();
+
+    // marks the pool as the detected edges; detection is deterministic, so a snapshot can
+    // leave them out and be restored onto the same edges detected again
+    void markBase();
+    bool hasBase() const;
+
+    // compact binary form of the whole model, or of everything but the detected pool
+    void serialize(std::vector<char>& out, bool omitBase = false) const;
+    // a snapshot without the detected pool is only restored onto a model holding the
+    // same one; on failure the model is empty
+    bool deserialize(const char* data, size_t size);
+    // the serialized model needs the detected pool to be restored onto
+    static bool omitsBase(const char* data, size_t size);
+
+    // edges
+    int addEdge(const std::list<cv::Point>& points);
+    void addEdges(const std::vector<std::list<cv::Point>>& edges);
+    int edgeCount() const;
+    const Edge& edge(int id) const;
+    bool edgeAlive(int id) const;
+    cv::Point point(int id, int index) const;
+    bool pointVisible(int id, int index) const;
+    cv::Rect boundingRect(int id) const;
+    // the chains holding the pixels of id meet box, a cheap test before walking them
+    bool mayIntersect(int id, const cv::Rect& box) const;
+
+    int endIndex(int id, EdgeEnd end) const;
+    bool canMoveEnd(int id, EdgeEnd end, int index) const;
+    void setEndIndex(int id, EdgeEnd end, int index);
+
+    void setSelected(int id, bool selected);
+
+    // split between local pixels index and index+1; allocates id1/id2 if negative, otherwise
+    // reuses them, which also recreates ids recorded by a session journal
+    bool splitEdge(int id, int index, int& id1, int& id2);
+    void unsplitEdge(int id, int id1, int id2);
+    // joins end1 of id1 to end2 of id2 into one edge running from the far end of id1 to the
+    // far end of id2; pixels beyond the joined ends are left out and a gap between them is
+    // bridged by a straight line. Ids are allocated if negative, otherwise reused like splitEdge
+    bool mergeEdges(int id1, EdgeEnd end1, int id2, EdgeEnd end2, int& merged, int& bridge);
+    void unmergeEdges(int id1, int id2, int merged);
+
+    // pixel pool, shared by all edges
+    int pixelCount() const;
+    cv::Point pixel(int poolIndex) const;
+    // alive edge holding the pixel and its local index there, false if none holds it
+    bool locatePixel(int poolIndex, int& id, int& index) const;
+    int pixelOwner(int poolIndex) const;
+
+    // stray points and connections
+    // appends a new stray point if id is negative, otherwise (re)creates that id
+    int addStrayPoint(const cv::Point2f& pos, int id = -1);
+    void removeStrayPoint(int id);
+    bool strayAlive(int id) const;
+    cv::Point2f position(const PointRef& ref) const;
+    void addConnection(const PointRef& first, const PointRef& second,
+                       const std::vector<cv::Point>& path = std::vector<cv::Point>());
+    void removeConnection(const PointRef& first, const PointRef& second);
+    // reattaches the connections of from to to, e.g. when an edge end moves to a new edge
+    void moveConnections(const PointRef& from, const PointRef& to);
+    const std::vector<Connection>& connectionList() const;
+
+    // bytes held by the model, for cache budgets
+    size_t memoryBytes() const;
+
+private:
+    struct Offset {
+        unsigned short x;
+        unsigned short y;
+    };
+
+    void clearEdits();
+    unsigned int poolChecksum(int chainCount, int pixelTotal) const;
+    // the chain is owned by a new edge, or by id if given
+    int appendChain(const std::vector<cv::Point>& points, int begin, int end, const cv::Point& origin, int id = -1);
+    int chainOf(int poolIndex) const;
+    static Edge plainEdge();
+    void allocateId(int& id);
+    // pieces covering local indices first..last of id, appended in the order given by reversed
+    void rangePieces(int id, int first, int last, bool reversed, std::vector<Piece>& out) const;
+    // pieces are stored in the slot of previous, the edge the id held before, if they fit
+    void setPieces(Edge& edge, const std::vector<Piece>& list, const Edge& previous);
+    // fills in split records missing from older snapshots and the owners of their chains
+    // from the per pixel owners they stored, false if the snapshot is inconsistent
+    bool deriveRecords(const std::vector<int>& owner);
+    bool rangesValid() const;
+    bool chainsValid() const;
+    void deriveExtents();
+    bool deriveSplit(int id, const std::vector<std::pair<int, int>>& starts);
+
+    std::vector<Offset> pixels;
+    // per chain, in pool order
+    std::vector<cv::Point> origins;
+    std::vector<int> chainStart;
+    std::vector<int> chainEdge;
+    // largest offset of the chain, its bounds run from the origin to origin + extent;
+    // not serialized, derived from the pixels
+    std::vector<Offset> extents;
+    // the first chains and pixels came from detection, markBase()
+    int baseChains;
+    int basePixels;
+    unsigned int baseChecksum;
+    std::vector<Edge> edges;
+    std::vector<Piece> pieces;
+    std::vector<cv::Point2f> strays;
+    std::vector<bool> strayFlags;
+    std::vector<Connection> connections;
+};
+
+#endif // ANNOTATIONMODEL_H
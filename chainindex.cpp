@@ -0,0 +1,107 @@
+#include "chainindex.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <cfloat>
+
+namespace
+{
+
+// cell size in pixels, an 8-connected chain puts at most a few dozen pixels in a cell
+const int CELL = 16;
+
+} //end of namespace
+
+ChainIndex::ChainIndex()
+    : cols(0), rows(0), firstIndex(0)
+{
+}
+
+void ChainIndex::build(const AnnotationModel& model, int id, int first, int last)
+{
+    clear();
+    if (last < first) return;
+
+    firstIndex = first;
+    centers.reserve(last - first + 1);
+    std::vector<cv::Point> pixels;
+    pixels.reserve(last - first + 1);
+    for (int i = first; i <= last; i++) {
+        cv::Point p = model.point(id, i);
+        pixels.push_back(p);
+        centers.push_back(cv::Point2f(p.x + 0.5f, p.y + 0.5f));
+    }
+    bounds = cv::boundingRect(pixels);
+    cols = bounds.width / CELL + 1;
+    rows = bounds.height / CELL + 1;
+
+    // counting sort of the pixels into their cells
+    auto cellOf = [this](const cv::Point& p) {
+        return ((p.y - bounds.y) / CELL) * cols + (p.x - bounds.x) / CELL;
+    };
+    cellStart.assign(cols * rows + 1, 0);
+    for (const auto& p : pixels)
+        cellStart[cellOf(p) + 1]++;
+    for (int c = 0; c < cols * rows; c++)
+        cellStart[c + 1] += cellStart[c];
+    cellIndices.resize(pixels.size());
+    std::vector<int> fill(cellStart.begin(), cellStart.end() - 1);
+    for (int i = 0; i < (int)pixels.size(); i++)
+        cellIndices[fill[cellOf(pixels[i])]++] = i;
+}
+
+void ChainIndex::clear()
+{
+    centers.clear();
+    cellStart.clear();
+    cellIndices.clear();
+    cols = 0;
+    rows = 0;
+}
+
+bool ChainIndex::empty() const
+{
+    return centers.empty();
+}
+
+int ChainIndex::nearest(const cv::Point2f& pos) const
+{
+    if (empty()) return -1;
+
+    // cell of the query, clamped into the grid when the cursor is off the edge's box
+    int cx = std::min(std::max((int)((pos.x - bounds.x) / CELL), 0), cols - 1);
+    int cy = std::min(std::max((int)((pos.y - bounds.y) / CELL), 0), rows - 1);
+
+    int best = -1;
+    float bestDist = FLT_MAX;
+    int maxRing = std::max(cols, rows);
+    for (int r = 0; r <= maxRing; r++) {
+        for (int y = cy - r; y <= cy + r; y++) {
+            if (y < 0 || y >= rows) continue;
+            // inner rows only contribute their first and last cell of the ring
+            int step = (y == cy - r || y == cy + r) ? 1 : std::max(1, 2*r);
+            for (int x = cx - r; x <= cx + r; x += step) {
+                if (x < 0 || x >= cols) continue;
+                int c = y * cols + x;
+                for (int k = cellStart[c]; k < cellStart[c + 1]; k++) {
+                    cv::Point2f d = centers[cellIndices[k]] - pos;
+                    float dist = d.x*d.x + d.y*d.y;
+                    if (dist < bestDist) {
+                        bestDist = dist;
+                        best = cellIndices[k];
+                    }
+                }
+            }
+        }
+
+        // anything in the next ring is at least this far from pos; a side that reached
+        // the end of the grid has no cells left, which also covers pos outside the grid
+        float left = cx - r > 0 ? pos.x - (bounds.x + (cx - r) * CELL) : FLT_MAX;
+        float right = cx + r < cols - 1 ? bounds.x + (cx + r + 1) * CELL - pos.x : FLT_MAX;
+        float top = cy - r > 0 ? pos.y - (bounds.y + (cy - r) * CELL) : FLT_MAX;
+        float bottom = cy + r < rows - 1 ? bounds.y + (cy + r + 1) * CELL - pos.y : FLT_MAX;
+        float margin = std::min(std::min(left, right), std::min(top, bottom));
+        if (margin == FLT_MAX) break;
+        if (best >= 0 && bestDist <= margin * margin) break;
+    }
+    return best + firstIndex;
+}
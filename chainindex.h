@@ -0,0 +1,41 @@
+#ifndef CHAININDEX_H
+#define CHAININDEX_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include "annotationmodel.h"
+
+/**
+ *@brief nearest pixel of one edge within a range of local indices, for
+ * dragging an endpoint straight to the pixel under the cursor.
+ *
+ * The pixels of the range are bucketed into a coarse grid over their
+ * bounding box. A query visits rings of cells around the cell of the query
+ * point and stops as soon as no unvisited cell can hold a closer pixel, so
+ * it touches a handful of cells however long the edge is.
+ */
+class ChainIndex
+{
+public:
+    ChainIndex();
+
+    // indexes the local indices first..last of edge id
+    void build(const AnnotationModel& model, int id, int first, int last);
+    void clear();
+    bool empty() const;
+
+    // local index of the pixel whose center is nearest to pos (image coordinates)
+    int nearest(const cv::Point2f& pos) const;
+
+private:
+    cv::Rect bounds;
+    int cols;
+    int rows;
+    // local indices bucketed by cell, cell c holds cellIndices[cellStart[c] .. cellStart[c+1])
+    std::vector<int> cellStart;
+    std::vector<int> cellIndices;
+    std::vector<cv::Point2f> centers;   // by local index - first
+    int firstIndex;
+};
+
+#endif // CHAININDEX_H
@@ -0,0 +1,119 @@
+#include "cocowriter.h"
+#include <QFileInfo>
+#include <cmath>
+#include <algorithm>
+
+namespace
+{
+
+const char* CATEGORY = "region";
+// copy chunk when appending the annotations to the output
+const qint64 COPY_CHUNK = 1 << 20;
+
+QByteArray number(double value)
+{
+    return QByteArray::number(value, 'f', 2);
+}
+
+QByteArray quoted(const QString& text)
+{
+    QString escaped = text;
+    escaped.replace("\\", "\\\\");
+    escaped.replace("\"", "\\\"");
+    return "\"" + escaped.toUtf8() + "\"";
+}
+
+} //end of namespace
+
+CocoWriter::CocoWriter()
+    : firstImage(true), firstAnnotation(true), nextAnnotationId(1)
+{
+}
+
+CocoWriter::~CocoWriter()
+{
+    if (json.isOpen()) close();
+}
+
+bool CocoWriter::open(const QString& path)
+{
+    json.setFileName(path);
+    annotations.setFileName(path + ".annotations.part");
+    if (!json.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    if (!annotations.open(QIODevice::ReadWrite | QIODevice::Truncate)) {
+        json.close();
+        return false;
+    }
+    firstImage = true;
+    firstAnnotation = true;
+    nextAnnotationId = 1;
+    json.write("{\"images\":[");
+    return true;
+}
+
+void CocoWriter::writeSeparator(QFile& file, bool& first)
+{
+    if (!first) file.write(",");
+    file.write("\n");
+    first = false;
+}
+
+void CocoWriter::addImage(int id, const QString& fileName, int width, int height)
+{
+    QByteArray entry = "{\"id\":" + QByteArray::number(id)
+            + ",\"file_name\":" + quoted(fileName)
+            + ",\"width\":" + QByteArray::number(width)
+            + ",\"height\":" + QByteArray::number(height) + "}";
+
+    std::lock_guard<std::mutex> lock(mutex);
+    writeSeparator(json, firstImage);
+    json.write(entry);
+}
+
+void CocoWriter::addAnnotation(int imageId, const std::vector<cv::Point2f>& polygon)
+{
+    // shoelace area and bounding box of the polygon
+    double area = 0;
+    float minX = polygon[0].x, minY = polygon[0].y, maxX = minX, maxY = minY;
+    QByteArray segmentation;
+    for (size_t i = 0; i < polygon.size(); i++) {
+        const cv::Point2f& p = polygon[i];
+        const cv::Point2f& q = polygon[(i + 1) % polygon.size()];
+        area += p.x*q.y - q.x*p.y;
+        minX = std::min(minX, p.x);
+        minY = std::min(minY, p.y);
+        maxX = std::max(maxX, p.x);
+        maxY = std::max(maxY, p.y);
+        if (i > 0) segmentation += ",";
+        segmentation += number(p.x) + "," + number(p.y);
+    }
+
+    QByteArray entry = ",\"image_id\":" + QByteArray::number(imageId)
+            + ",\"category_id\":1,\"iscrowd\":0"
+            + ",\"segmentation\":[[" + segmentation + "]]"
+            + ",\"area\":" + number(std::fabs(area)/2)
+            + ",\"bbox\":[" + number(minX) + "," + number(minY) + ","
+            + number(maxX - minX) + "," + number(maxY - minY) + "]}";
+
+    std::lock_guard<std::mutex> lock(mutex);
+    writeSeparator(annotations, firstAnnotation);
+    annotations.write("{\"id\":" + QByteArray::number(nextAnnotationId++) + entry);
+}
+
+bool CocoWriter::close()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!json.isOpen()) return false;
+
+    json.write("\n],\"annotations\":[");
+    annotations.seek(0);
+    while (!annotations.atEnd())
+        json.write(annotations.read(COPY_CHUNK));
+    json.write(QByteArray("\n],\"categories\":[{\"id\":1,\"name\":\"") + CATEGORY + "\"}]}\n");
+
+    bool ok = json.error() == QFile::NoError && annotations.error() == QFile::NoError;
+    json.close();
+    annotations.close();
+    annotations.remove();
+    return ok;
+}
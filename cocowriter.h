@@ -0,0 +1,39 @@
+#ifndef COCOWRITER_H
+#define COCOWRITER_H
+
+#include <QFile>
+#include <QString>
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <mutex>
+
+/**
+ *@brief writes a COCO instance segmentation file while images are exported.
+ *
+ * Entries are written as they come, nothing is kept in memory. Images go
+ * straight to the output file, annotations to a side file that is appended
+ * in close(), since COCO keeps them in two separate arrays. Thread safe.
+ */
+class CocoWriter
+{
+public:
+    CocoWriter();
+    ~CocoWriter();
+
+    bool open(const QString& path);
+    void addImage(int id, const QString& fileName, int width, int height);
+    void addAnnotation(int imageId, const std::vector<cv::Point2f>& polygon);
+    bool close();
+
+private:
+    void writeSeparator(QFile& file, bool& first);
+
+    QFile json;
+    QFile annotations;
+    bool firstImage;
+    bool firstAnnotation;
+    int nextAnnotationId;
+    std::mutex mutex;
+};
+
+#endif // COCOWRITER_H
@@ -0,0 +1,160 @@
+#include "connectionlayer.h"
+#include "labelimage.h"
+#include <QPainter>
+#include <QStyleOptionGraphicsItem>
+
+ConnectionLayer::ConnectionLayer(LabelImage *labelImage)
+    : QGraphicsItem(labelImage), image(labelImage)
+{
+    penWidth = 1;
+    // exposedRect is used to skip segments outside of the repainted area
+    setFlag(ItemUsesExtendedStyleOption);
+}
+
+void ConnectionLayer::addConnection(AnnotationModel::PointRef point1, AnnotationModel::PointRef point2,
+                                    const std::vector<cv::Point>& path)
+{
+    Segment segment;
+    segment.first = point1;
+    segment.second = point2;
+    for (const auto& p : path)
+        segment.inner.push_back(mapFromParent(image->image2item(QPointF(p.x + 0.5, p.y + 0.5))));
+    segment.line = polyline(point1, point2, segment.inner);
+
+    int index = (int)segments.size();
+    segments.push_back(segment);
+    pointSegments.emplace(key(point1), index);
+    pointSegments.emplace(key(point2), index);
+
+    QRectF rect = segmentRect(segment.line);
+    growBounds(rect);
+    update(rect);
+}
+
+void ConnectionLayer::removeConnection(AnnotationModel::PointRef point1, AnnotationModel::PointRef point2)
+{
+    auto eraseEntry = [this](AnnotationModel::PointRef point, int index) {
+        auto range = pointSegments.equal_range(key(point));
+        for (auto it = range.first; it != range.second; it++) {
+            if (it->second == index) {
+                pointSegments.erase(it);
+                return;
+            }
+        }
+    };
+
+    for (int i = 0; i < (int)segments.size(); i++) {
+        if (!(segments[i].first == point1) || !(segments[i].second == point2)) continue;
+
+        update(segmentRect(segments[i].line));
+        eraseEntry(segments[i].first, i);
+        eraseEntry(segments[i].second, i);
+
+        // swap with the last segment so removal does not shift the buffer
+        int last = (int)segments.size() - 1;
+        if (i != last) {
+            eraseEntry(segments[last].first, last);
+            eraseEntry(segments[last].second, last);
+            segments[i] = segments[last];
+            pointSegments.emplace(key(segments[i].first), i);
+            pointSegments.emplace(key(segments[i].second), i);
+        }
+        segments.pop_back();
+        return;
+    }
+}
+
+void ConnectionLayer::pointMoved(AnnotationModel::PointRef point)
+{
+    auto range = pointSegments.equal_range(key(point));
+    for (auto it = range.first; it != range.second; it++)
+        updateSegment(it->second);
+}
+
+int ConnectionLayer::connectionCount() const
+{
+    return (int)segments.size();
+}
+
+void ConnectionLayer::updateSegment(int index)
+{
+    Segment& segment = segments[index];
+    QPolygonF line = polyline(segment.first, segment.second, segment.inner);
+    if (line == segment.line) return;
+
+    // invalidate both the old and the new extent of the segment
+    update(segmentRect(segment.line));
+    segment.line = line;
+    QRectF rect = segmentRect(line);
+    growBounds(rect);
+    update(rect);
+}
+
+ConnectionLayer::PointKey ConnectionLayer::key(AnnotationModel::PointRef point) const
+{
+    return PointKey(point.edge, point.id);
+}
+
+QPointF ConnectionLayer::position(AnnotationModel::PointRef point) const
+{
+    // positions come from the model, views of the points may not exist
+    cv::Point2f pos = image->model().position(point);
+    return mapFromParent(image->image2item(QPointF(pos.x, pos.y)));
+}
+
+QPolygonF ConnectionLayer::polyline(const AnnotationModel::PointRef& first, const AnnotationModel::PointRef& second,
+                                    const std::vector<QPointF>& inner) const
+{
+    // the ends follow the points, the path in between stays where it was traced
+    QPolygonF line;
+    line.reserve((int)inner.size() + 2);
+    line << position(first);
+    for (const auto& p : inner)
+        line << p;
+    line << position(second);
+    return line;
+}
+
+QRectF ConnectionLayer::segmentRect(const QPolygonF& line) const
+{
+    double pad = penWidth/2;
+    return line.boundingRect().adjusted(-pad, -pad, pad, pad);
+}
+
+void ConnectionLayer::growBounds(const QRectF& rect)
+{
+    // bounds only grow, a stale larger rect is cheaper than recomputing it on every removal
+    if (bounds.contains(rect)) return;
+    prepareGeometryChange();
+    bounds = bounds.isNull() ? rect : bounds.united(rect);
+}
+
+QRectF ConnectionLayer::boundingRect() const
+{
+    return bounds;
+}
+
+void ConnectionLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
+{
+    painter->setPen(QPen(Qt::black, penWidth));
+    QVector<QLineF> lines;
+    for (const auto& segment : segments) {
+        if (!segmentRect(segment.line).intersects(option->exposedRect)) continue;
+        // straight connections are batched, traced ones are drawn one by one
+        if (segment.line.size() == 2)
+            lines.push_back(QLineF(segment.line[0], segment.line[1]));
+        else
+            painter->drawPolyline(segment.line);
+    }
+    painter->drawLines(lines);
+}
+
+size_t ConnectionLayer::memoryBytes() const
+{
+    size_t bytes = segments.capacity()*sizeof(Segment);
+    for (const auto& s : segments)
+        bytes += s.inner.capacity()*sizeof(QPointF) + s.line.capacity()*sizeof(QPointF);
+    // a red-black tree node per entry
+    bytes += pointSegments.size()*(sizeof(std::pair<const PointKey, int>) + 4*sizeof(void*));
+    return bytes;
+}
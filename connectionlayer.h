@@ -0,0 +1,56 @@
+#ifndef CONNECTIONLAYER_H
+#define CONNECTIONLAYER_H
+
+#include <QGraphicsItem>
+#include <QPolygonF>
+#include <vector>
+#include <map>
+#include "annotationmodel.h"
+
+class LabelImage;
+
+/**
+ *@brief draws the connections of the AnnotationModel, child of the LabelImage
+ */
+class ConnectionLayer : public QGraphicsItem
+{
+public:
+    ConnectionLayer(LabelImage *labelImage);
+
+    void addConnection(AnnotationModel::PointRef point1, AnnotationModel::PointRef point2,
+                       const std::vector<cv::Point>& path = std::vector<cv::Point>());
+    void removeConnection(AnnotationModel::PointRef point1, AnnotationModel::PointRef point2);
+    void pointMoved(AnnotationModel::PointRef point);
+    int connectionCount() const;
+    size_t memoryBytes() const;
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+private:
+    typedef std::pair<int, int> PointKey;
+    PointKey key(AnnotationModel::PointRef point) const;
+    QPointF position(AnnotationModel::PointRef point) const;
+    QRectF segmentRect(const QPolygonF& line) const;
+    QPolygonF polyline(const AnnotationModel::PointRef& first, const AnnotationModel::PointRef& second,
+                       const std::vector<QPointF>& inner) const;
+    void updateSegment(int index);
+    void growBounds(const QRectF& rect);
+
+    struct Segment {
+        AnnotationModel::PointRef first;
+        AnnotationModel::PointRef second;
+        std::vector<QPointF> inner;     // live-wire pixels between the points, item coordinates
+        QPolygonF line;
+    };
+
+    // vertex buffer, one polyline per connection, two points for a straight one
+    std::vector<Segment> segments;
+    // segments touching each point, for incremental updates on point moves
+    std::multimap<PointKey, int> pointSegments;
+    LabelImage* image;
+    QRectF bounds;
+    double penWidth;
+};
+
+#endif // CONNECTIONLAYER_H
@@ -0,0 +1,170 @@
+#include "edgedetectjob.h"
+#include "ED.h"
+#include "edstatscollector.h"
+#include <QThreadPool>
+#include <QRunnable>
+#include <QMetaObject>
+#include <opencv2/highgui/highgui.hpp>
+
+namespace
+{
+
+class Runner : public QRunnable
+{
+public:
+    Runner(const std::function<void()>& job) : job(job) {}
+    void run() override { job(); }
+
+private:
+    std::function<void()> job;
+};
+
+} //end of namespace
+
+EdgeDetectJob::EdgeDetectJob(QObject *receiver, const ImageBuffer& image, const AnnotationModel* detected)
+    : image(image), hasEdges(detected != NULL), gradient(false), index(NULL), receiver(receiver), stopped(false)
+{
+    if (detected) edges = *detected;
+}
+
+EdgeDetectJob::~EdgeDetectJob()
+{
+    delete index;
+}
+
+void EdgeDetectJob::decodeFirst(const QString& path)
+{
+    sourcePath = path;
+}
+
+void EdgeDetectJob::gradientOnly()
+{
+    gradient = true;
+}
+
+void EdgeDetectJob::start(const std::function<void(bool ok)>& finished)
+{
+    // the runner keeps the job alive until it is done, cancelled or not
+    std::shared_ptr<EdgeDetectJob> self = shared_from_this();
+    QThreadPool::globalInstance()->start(new Runner([self, finished]() {
+        self->run(finished);
+    }));
+}
+
+void EdgeDetectJob::cancel()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    stopped = true;
+    receiver = NULL;
+}
+
+bool EdgeDetectJob::cancelled() const
+{
+    return stopped;
+}
+
+void EdgeDetectJob::run(const std::function<void(bool ok)>& finished)
+{
+    if (stopped) return;
+    bool ok = gradient ? computeGradient() : computeEdges();
+    if (stopped) return;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!receiver) return;
+    std::shared_ptr<EdgeDetectJob> self = shared_from_this();
+    // queued calls to a deleted receiver are discarded by Qt
+    QMetaObject::invokeMethod(receiver, [self, finished, ok]() {
+        if (!self->cancelled()) finished(ok);
+    }, Qt::QueuedConnection);
+}
+
+bool EdgeDetectJob::computeEdges()
+{
+    if (!sourcePath.isEmpty()) {
+        cv::Mat full = cv::imread(sourcePath.toStdString());
+        // edges of the preview would not match the image coordinates, keep the preview only
+        if (full.empty()) return false;
+        image = ImageBuffer(full, hasEdges ? ImageBuffer::NO_LUMINANCE : ImageBuffer::SMOOTHED_LUMINANCE);
+    } else if (!hasEdges) {
+        // the display view is already converted, only luminance is missing
+        image.addLuminance();
+    }
+
+    if (!hasEdges)
+        detect(image, edges, sourcePath);
+    else if (!edges.hasBase())
+        edges.markBase();
+
+    if (!stopped) index = buildIndex(edges, edgePoints);
+    return true;
+}
+
+bool EdgeDetectJob::computeGradient()
+{
+    image.addLuminance();
+    cv::Mat smoothed;
+    if (image.luminanceSmoothed())
+        smoothed = image.luminance();
+    else
+        ED::smooth(image.luminance(), smoothed);
+    ED::getGradient(smoothed, gradM, gradO);
+    return true;
+}
+
+void EdgeDetectJob::detect(const ImageBuffer& image, AnnotationModel& edges, const QString& source)
+{
+    std::vector<std::list<cv::Point>> detected;
+    cv::Mat smoothed;
+    if (image.luminanceSmoothed())
+        smoothed = image.luminance();
+    else
+        ED::smooth(image.luminance(), smoothed);
+    EDStats stats;
+    ED::detectEdgesSmoothed(smoothed, detected, ED::DEFAULT_PROPOSAL_THRESH,
+                            ED::DEFAULT_ANCHOR_INTERVAL, ED::DEFAULT_ANCHOR_THRESH, &stats);
+    EDStatsCollector::instance().add(stats, source);
+    edges.addEdges(detected);
+    edges.markBase();
+}
+
+const ImageBuffer& EdgeDetectJob::buffer() const
+{
+    return image;
+}
+
+const AnnotationModel& EdgeDetectJob::model() const
+{
+    return edges;
+}
+
+const cv::Mat& EdgeDetectJob::magnitude() const
+{
+    return gradM;
+}
+
+const cv::Mat& EdgeDetectJob::orientation() const
+{
+    return gradO;
+}
+
+cv::flann::Index* EdgeDetectJob::takeIndex(std::vector<cv::Point2f>& points)
+{
+    points.swap(edgePoints);
+    edgePoints.clear();
+    cv::flann::Index* taken = index;
+    index = NULL;
+    return taken;
+}
+
+cv::flann::Index* EdgeDetectJob::buildIndex(const AnnotationModel& model, std::vector<cv::Point2f>& points)
+{
+    // the pixel pool never changes after detection, split edges share it
+    points.clear();
+    points.reserve(model.pixelCount());
+    for (int i = 0; i < model.pixelCount(); i++) {
+        cv::Point point = model.pixel(i);
+        points.push_back(cv::Point2f(point.x+0.5, point.y+0.5));
+    }
+    if (points.empty()) return NULL;
+    return new cv::flann::Index(cv::Mat(points).reshape(1), cv::flann::KDTreeIndexParams(1));
+}
@@ -0,0 +1,74 @@
+#ifndef EDGEDETECTJOB_H
+#define EDGEDETECTJOB_H
+
+#include <QObject>
+#include <opencv2/flann/miniflann.hpp>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include "imagebuffer.h"
+#include "annotationmodel.h"
+
+/**
+ *@brief detects the edges of one image and builds their nearest neighbour
+ * index on the global thread pool, or computes the image's gradient planes
+ * for the live-wire. finished is called on the receiver's
+ * thread, unless the job is cancelled first; it is passed false if the
+ * full image could not be decoded, the preview is then kept without edges.
+ *
+ * ED itself cannot be interrupted, a cancelled job skips the remaining
+ * steps and drops its result.
+ */
+class EdgeDetectJob : public std::enable_shared_from_this<EdgeDetectJob>
+{
+public:
+    // edges detected ahead of time skip ED, only the index is built
+    EdgeDetectJob(QObject *receiver, const ImageBuffer& image, const AnnotationModel* detected = NULL);
+    ~EdgeDetectJob();
+
+    // decodes the image at path before anything else, the given image is a preview of it
+    void decodeFirst(const QString& path);
+    // computes the gradient planes of the image for the live-wire, no edges and no index
+    void gradientOnly();
+
+    void start(const std::function<void(bool ok)>& finished);
+    void cancel();
+    bool cancelled() const;
+
+    // results, valid once finished is called
+    const ImageBuffer& buffer() const;
+    const AnnotationModel& model() const;
+    // gradient planes of a gradientOnly() job
+    const cv::Mat& magnitude() const;
+    const cv::Mat& orientation() const;
+    // the caller owns the index afterwards
+    cv::flann::Index* takeIndex(std::vector<cv::Point2f>& points);
+
+    // kd-tree over the pixel pool, points are pixel centers indexed like the pool
+    static cv::flann::Index* buildIndex(const AnnotationModel& model, std::vector<cv::Point2f>& points);
+    // the detection every session is recorded over, marked as the model's base
+    static void detect(const ImageBuffer& image, AnnotationModel& edges, const QString& source);
+
+private:
+    void run(const std::function<void(bool ok)>& finished);
+    bool computeEdges();
+    bool computeGradient();
+
+    ImageBuffer image;
+    QString sourcePath;
+    AnnotationModel edges;
+    bool hasEdges;
+    bool gradient;
+    cv::Mat gradM;
+    cv::Mat gradO;
+    std::vector<cv::Point2f> edgePoints;
+    cv::flann::Index* index;
+
+    // guards receiver, so it is not used after cancel() returns
+    std::mutex mutex;
+    QObject* receiver;
+    std::atomic<bool> stopped;
+};
+
+#endif // EDGEDETECTJOB_H
@@ -5,25 +5,58 @@
 #include <QTimeLine>
 #include <QtDebug>
 #include "action.h"
+#include "profiler.h"
 
-EdgeItem::EdgeItem(LabelImage* labelImage, const std::list<cv::Point>& points)
+namespace
 {
-    std::vector<QPointF> temp;
-    for (auto point : points) {
-        QPointF curr(point.x, point.y);
-        temp.push_back(curr);
-    }
-    init(labelImage, temp, 0, temp.size()-1);
-}
 
-EdgeItem::EdgeItem(LabelImage *labelImage, const std::vector<QPointF>& points, int start, int end)
+// drawing style, shared by all edges
+const Qt::GlobalColor COLOR_DEFAULT = Qt::green;
+const Qt::GlobalColor COLOR_SELECTED = Qt::cyan;
+const Qt::GlobalColor COLOR_HOVER = Qt::red;
+const Qt::GlobalColor COLOR_BLINK = Qt::yellow;
+const Qt::GlobalColor COLOR_SPLIT_A = Qt::cyan;
+const Qt::GlobalColor COLOR_SPLIT_B = Qt::cyan;
+const Qt::GlobalColor COLOR_SPLIT_LINE = Qt::yellow;
+
+const double BORDER_WIDTH = 0.1;
+const double EDGE_WIDTH = 1.2;
+const double SPLIT_LINE_LENGTH = 6;
+const double SPLIT_LINE_WIDTH = 0.3;
+// padding to the bouding rectangle, need to cover border and split line
+const double PADDING = std::max((EDGE_WIDTH-1)/2 + BORDER_WIDTH, SPLIT_LINE_LENGTH/2 - 0.5);
+
+} //end of namespace
+
+EdgeItem::EdgeItem(LabelImage *labelImage, int id)
+    : image(labelImage), edgeId(id)
 {
-    init(labelImage, points, start, end);
+    cv::Rect rect = image->model().boundingRect(edgeId);
+    bbx.setTopLeft(QPointF(rect.tl().x, rect.tl().y));
+    bbx.setBottomRight(QPointF(rect.br().x, rect.br().y));
+
+    color = COLOR_DEFAULT;
+    borderWidth = BORDER_WIDTH;
+    splitIndex = -0.25;
+    showSplit = false;
+
+    pHead = NULL;
+    pTail = NULL;
+
+    setZValue(0);
+//    setCacheMode(DeviceCoordinateCache);
 }
 
 EdgeItem::~EdgeItem()
 {
     removeFromScene();
+    delete pHead;
+    delete pTail;
+}
+
+int EdgeItem::id() const
+{
+    return edgeId;
 }
 
 void EdgeItem::removeFromScene()
@@ -41,81 +74,16 @@ void EdgeItem::removeFromScene()
         scene()->removeItem(this);
 }
 
-void EdgeItem::init(LabelImage *labelImage, const std::vector<QPointF>& points, int start, int end)
-{
-    image = labelImage;
-
-    QPointF tl(points[start].x(), points[start].y());
-    QPointF br(points[start].x(), points[start].y());
-    QPointF prev;
-
-    for (int i = start; i <= end; i++) {
-        QPointF curr(points[i]);
-        // ignore duplicate pixels at same location
-        if (!prev.isNull() && prev == curr) continue;
-        if (curr.x() < tl.x()) tl.setX(curr.x());
-        if (curr.x() > br.x()) br.setX(curr.x());
-        if (curr.y() < tl.y()) tl.setY(curr.y());
-        if (curr.y() > br.y()) br.setY(curr.y());
-        qpoints.push_back(curr);
-        prev = curr;
-    }
-    bbx.setTopLeft(tl);
-    bbx.setBottomRight(br);
-
-    // spoints: points in local coordinate (origin at bounding rectangle center)
-    for (auto point : qpoints)
-        spoints.push_back(point - (br + tl)/2);
-
-    selected = false;
-
-    colorDefault = Qt::green;
-    colorSelected = Qt::cyan;
-    colorHover = Qt::red;
-    colorBlink = Qt::yellow;
-
-    color = colorDefault;
-    borderWidth = 0.1;
-    initBorderWidth = borderWidth;
-    edgeWidth = 1.2;
-    splitLineLength = 6;
-    splitLineWidth = 0.3;
-    // padding to the bouding rectangle, need to cover border and split line
-    padding = std::max((edgeWidth-1)/2 + borderWidth, splitLineLength/2 - 0.5);
-
-    splitIndex = -0.25;
-    colorSplitA = Qt::cyan;
-    colorSplitB = Qt::cyan;
-    colorSplitLine = Qt::yellow;
-    showSplit = false;
-
-    pHead = NULL;
-    pTail = NULL;
-
-    setZValue(0);
-//    setCacheMode(DeviceCoordinateCache);
-}
-
-
 void EdgeItem::createEndPoints()
 {
     if (!pHead)
-        pHead = new EndPoint(this, image, 0);
-    scene()->addItem(pHead);
-
-    if (!pTail)
-        pTail = new EndPoint(this, image, qpoints.size()-1);
-    scene()->addItem(pTail);
-}
-
-void EdgeItem::createEndPoints(int headIndex, int tailIndex)
-{
-    if (!pHead)
-        pHead = new EndPoint(this, image, headIndex);
+        pHead = new EndPoint(this, image, AnnotationModel::HEAD);
+    pHead->syncPosition();
     scene()->addItem(pHead);
 
     if (!pTail)
-        pTail = new EndPoint(this, image, tailIndex);
+        pTail = new EndPoint(this, image, AnnotationModel::TAIL);
+    pTail->syncPosition();
     scene()->addItem(pTail);
 }
 
@@ -131,77 +99,92 @@ EndPoint* EdgeItem::tail() const
 
 bool EdgeItem::pointVisible(int pointIndex) const
 {
-    bool afterHead = pHead ? pointIndex >= (int)(pHead->indexOnEdge()) : pointIndex >= 0;
-    bool beforeTail = pTail ? pointIndex <= (int)(pTail->indexOnEdge()) : pointIndex < (int)points().size();
-    return afterHead && beforeTail;
+    return image->model().pointVisible(edgeId, pointIndex);
 }
 
-std::vector<QPointF> EdgeItem::points() const
+int EdgeItem::pointCount() const
 {
-    return qpoints;
+    return image->model().edge(edgeId).count;
+}
+
+QPointF EdgeItem::point(int pointIndex) const
+{
+    cv::Point p = image->model().point(edgeId, pointIndex);
+    return QPointF(p.x, p.y);
+}
+
+QPointF EdgeItem::localPoint(int pointIndex) const
+{
+    // local coordinate, origin at bounding rectangle center
+    return point(pointIndex) - bbx.center();
 }
 
 QPointF EdgeItem::center() const
 {
     // center of bounding rectangle in scene coordinate
-    return QPointF(image->boundingRect().left() + (bbx.left()+bbx.right())/2,
-                   image->boundingRect().top() + (bbx.top()+bbx.bottom())/2);
+    return image->boundingRect().topLeft() + bbx.center();
 }
 
 QRectF EdgeItem::boundingRect() const
 {
     // bounding rectangle in local coordinate
-    return QRectF(-bbx.width()/2-padding, -bbx.height()/2-padding,
-                  bbx.width()+1+padding*2, bbx.height()+1+padding*2);
+    return QRectF(-bbx.width()/2-PADDING, -bbx.height()/2-PADDING,
+                  bbx.width()+1+PADDING*2, bbx.height()+1+PADDING*2);
 }
 
 QPainterPath EdgeItem::shape() const
 {
     // rectangles as pixels
-    float dist = (edgeWidth-1)/2;
+    const AnnotationModel::Edge& edge = image->model().edge(edgeId);
+    float dist = (EDGE_WIDTH-1)/2;
     QPainterPath path;
     path.setFillRule(Qt::WindingFill);
-    for (unsigned int i = 0; i < points().size(); i++)
-        if (pointVisible(i))
-            path.addRect(spoints[i].x()-dist, spoints[i].y()-dist, dist*2+1, dist*2+1);
+    for (int i = edge.head; i <= edge.tail; i++) {
+        QPointF p = localPoint(i);
+        path.addRect(p.x()-dist, p.y()-dist, dist*2+1, dist*2+1);
+    }
 
     return path;
 }
 
 QPainterPath EdgeItem::shapeSplitPointA() const
 {
-    float dist = (edgeWidth-1)/2;
+    float dist = (EDGE_WIDTH-1)/2;
     QPainterPath path;
     int r = round(splitIndex);
     int i = splitIndex > r ? r : r-1;
-    if (pointVisible(i))
-        path.addRect(spoints[i].x()-dist, spoints[i].y()-dist, dist*2+1, dist*2+1);
+    if (pointVisible(i)) {
+        QPointF p = localPoint(i);
+        path.addRect(p.x()-dist, p.y()-dist, dist*2+1, dist*2+1);
+    }
     return path;
 }
 
 QPainterPath EdgeItem::shapeSplitPointB() const
 {
-    float dist = (edgeWidth-1)/2;
+    float dist = (EDGE_WIDTH-1)/2;
     QPainterPath path;
     int r = round(splitIndex);
     int i = splitIndex > r ? r+1 : r;
-    if (pointVisible(i))
-        path.addRect(spoints[i].x()-dist, spoints[i].y()-dist, dist*2+1, dist*2+1);
+    if (pointVisible(i)) {
+        QPointF p = localPoint(i);
+        path.addRect(p.x()-dist, p.y()-dist, dist*2+1, dist*2+1);
+    }
     return path;
 }
 
 QPainterPath EdgeItem::shapeSplitLine() const
 {
     // draw a line between two pixels
-    float half = splitLineLength/2;
+    float half = SPLIT_LINE_LENGTH/2;
     QPainterPath path;
     int r = round(splitIndex);
     int a = splitIndex > r ? r : r-1;
     int b = splitIndex > r ? r+1 : r;
 
     if (pointVisible(a) && pointVisible(b)){
-        QPointF pointA = spoints[a] + QPointF(0.5, 0.5);
-        QPointF pointB = spoints[b] + QPointF(0.5, 0.5);
+        QPointF pointA = localPoint(a) + QPointF(0.5, 0.5);
+        QPointF pointB = localPoint(b) + QPointF(0.5, 0.5);
         QPointF mid = (pointA + pointB) / 2;
         QPointF d = (pointB - pointA) / QLineF(pointA, pointB).length();
         QLineF n = QLineF(QPointF(0,0), d).normalVector();
@@ -221,14 +204,14 @@ void EdgeItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
     painter->drawPath(shape());
 
     if (showSplit) {
-        painter->setPen(QPen(colorSplitA, borderWidth));
-        painter->setBrush(QBrush(colorSplitA));
+        painter->setPen(QPen(COLOR_SPLIT_A, borderWidth));
+        painter->setBrush(QBrush(COLOR_SPLIT_A));
         painter->drawPath(shapeSplitPointA());
-        painter->setPen(QPen(colorSplitB, borderWidth));
-        painter->setBrush(QBrush(colorSplitB));
+        painter->setPen(QPen(COLOR_SPLIT_B, borderWidth));
+        painter->setBrush(QBrush(COLOR_SPLIT_B));
         painter->drawPath(shapeSplitPointB());
-        painter->setPen(QPen(colorSplitLine, splitLineWidth, Qt::DashLine));
-        painter->setBrush(QBrush(colorSplitLine));
+        painter->setPen(QPen(COLOR_SPLIT_LINE, SPLIT_LINE_WIDTH, Qt::DashLine));
+        painter->setBrush(QBrush(COLOR_SPLIT_LINE));
         painter->drawPath(shapeSplitLine());
     }
 }
@@ -240,12 +223,12 @@ double EdgeItem::convertSplitIndex(const QPointF& pos, const int pointIndex)
     len_f = std::numeric_limits<double>::infinity();
     len_b = std::numeric_limits<double>::infinity();
 
-    if (pointIndex+1 < (int)points().size()) {
-        forward = points()[pointIndex+1] + QPointF(0.5, 0.5);
+    if (pointIndex+1 < pointCount()) {
+        forward = point(pointIndex+1) + QPointF(0.5, 0.5);
         len_f = QLineF(pos, forward).length();
     }
     if (pointIndex > 0) {
-        backward = points()[pointIndex-1] + QPointF(0.5, 0.5);
+        backward = point(pointIndex-1) + QPointF(0.5, 0.5);
         len_b = QLineF(pos, backward).length();
     }
 
@@ -258,10 +241,11 @@ double EdgeItem::convertSplitIndex(const QPointF& pos, const int pointIndex)
 
 void EdgeItem::hoverEnter(const QPointF& pos, const int pointIndex)
 {
-    if (!selected) {
+    ProfileScope scope(Profiler::HOVER_ENTER);
+    if (!isSelected()) {
         showSplit = true;
         splitIndex = convertSplitIndex(pos, pointIndex);
-        color = colorHover;
+        color = COLOR_HOVER;
     }
     setZValue(1);
     if(pHead) pHead->setVisible(true);
@@ -271,9 +255,9 @@ void EdgeItem::hoverEnter(const QPointF& pos, const int pointIndex)
 
 void EdgeItem::hoverLeave()
 {
-    if (!selected) {
+    if (!isSelected()) {
         showSplit = false;
-        color = colorDefault;
+        color = COLOR_DEFAULT;
     }
     setZValue(0);
     if(pHead) pHead->setVisible(false);
@@ -291,29 +275,22 @@ bool EdgeItem::showingSplit() const
     return showSplit;
 }
 
-std::vector<EdgeItem*> EdgeItem::split()
+int EdgeItem::splitPosition() const
 {
-    std::vector<EdgeItem*> edges;
-
+    // the edge is split between the returned index and the next one
     int r = round(splitIndex);
     int a = splitIndex > r ? r : r-1;
     int b = splitIndex > r ? r+1 : r;
-    if (!pointVisible(a) || !pointVisible(b)) return edges;
-
-    EdgeItem* edge1 = new EdgeItem(image, qpoints, 0, a);
-    EdgeItem* edge2 = new EdgeItem(image, qpoints, b, qpoints.size()-1) ;
-
-    edges.push_back(edge1);
-    edges.push_back(edge2);
-
-    return edges;
+    if (!pointVisible(a) || !pointVisible(b)) return -1;
+    return a;
 }
 
 void EdgeItem::blink()
 {
-    QTimeLine *timer = new QTimeLine(500);
+    QTimeLine *timer = new QTimeLine(500, this);
     timer->setFrameRange(0, 100);
     QObject::connect(timer, SIGNAL(frameChanged(int)), this, SLOT(setBlinkParameters(int)));
+    QObject::connect(timer, SIGNAL(finished()), timer, SLOT(deleteLater()));
     timer->start();
 }
 
@@ -321,14 +298,14 @@ void EdgeItem::setBlinkParameters(int animationProgress)
 {
     double scaleFactor = 1 + 4*(100-animationProgress)/100.0;
     if (animationProgress < 99) {
-        color = colorBlink;
-        borderWidth = initBorderWidth * scaleFactor;
+        color = COLOR_BLINK;
+        borderWidth = BORDER_WIDTH * scaleFactor;
         setZValue(1);
         if(pHead) pHead->setVisible(true);
         if(pTail) pTail->setVisible(true);
     } else {
-        color = selected ? colorSelected : colorDefault;
-        borderWidth = initBorderWidth;
+        color = isSelected() ? COLOR_SELECTED : COLOR_DEFAULT;
+        borderWidth = BORDER_WIDTH;
         setZValue(0);
         if(pHead) pHead->setVisible(false);
         if(pTail) pTail->setVisible(false);
@@ -338,22 +315,20 @@ void EdgeItem::setBlinkParameters(int animationProgress)
 
 void EdgeItem::select()
 {
-    selected = true;
+    image->model().setSelected(edgeId, true);
     showSplit = false;
-    color = colorSelected;
+    color = COLOR_SELECTED;
     update(boundingRect());
 }
 
 void EdgeItem::unselect()
 {
-    selected = false;
-    color = colorDefault;
+    image->model().setSelected(edgeId, false);
+    color = COLOR_DEFAULT;
     update(boundingRect());
 }
 
 bool EdgeItem::isSelected() const
 {
-    return selected;
+    return image->model().edge(edgeId).selected;
 }
-
-
@@ -8,23 +8,26 @@
 class LabelImage;
 class EndPoint;
 
+/**
+ *@brief view of one edge of the AnnotationModel, pixels and endpoint
+ * indices are read from the model, only hover/blink state lives here.
+ */
 class EdgeItem : public QGraphicsObject
 {
     Q_OBJECT
 public:
-    EdgeItem(LabelImage *labelImage, const std::list<cv::Point>& points);
-    EdgeItem(LabelImage *labelImage, const std::vector<QPointF>& points, int start, int end);
+    EdgeItem(LabelImage *labelImage, int edgeId);
     ~EdgeItem();
 
-    void init(LabelImage *labelImage, const std::vector<QPointF>& points, int start, int end);
+    int id() const;
 
     void removeFromScene();
 
-    std::vector<QPointF> points() const;
+    int pointCount() const;
+    QPointF point(int pointIndex) const;
     QPointF center() const;
 
     void createEndPoints();
-    void createEndPoints(int headIndex, int tailIndex);
     EndPoint* head() const;
     EndPoint* tail() const;
     bool pointVisible(int pointIndex) const;
@@ -44,7 +47,7 @@ public:
     void setShowSplit(bool show);
     bool showingSplit() const;
 
-    std::vector<EdgeItem*> split();
+    int splitPosition() const;
     void select();
     void unselect();
     bool isSelected() const;
@@ -55,31 +58,19 @@ public Q_SLOTS:
     void setBlinkParameters(int animationProgress); // percentage
 
 private:
-    bool selected;
-    QColor colorDefault;
-    QColor colorHover;
-    QColor colorSelected;
-    QColor colorBlink;
+    QPointF localPoint(int pointIndex) const;
+
+    LabelImage* image;
+    int edgeId;
+    QRectF bbx;
 
     EndPoint* pHead;
     EndPoint* pTail;
     double splitIndex;
-    QColor colorSplitA;
-    QColor colorSplitB;
-    QColor colorSplitLine;
-    double splitLineLength;
-    double splitLineWidth;
     bool showSplit;
 
-    std::vector<QPointF> qpoints;
-    std::vector<QPointF> spoints;
-    QRectF bbx;
     QColor color;
     double borderWidth;
-    double initBorderWidth;
-    double edgeWidth;
-    double padding;
-    LabelImage* image;
 };
 
 #endif // EDGEITEM_H
@@ -0,0 +1,125 @@
+#include "edstatscollector.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QFile>
+#include <algorithm>
+#include <cfloat>
+
+EDStatsCollector::Summary::Summary()
+    : count(0), sum(0), min(DBL_MAX), max(-DBL_MAX)
+{
+}
+
+void EDStatsCollector::Summary::add(double value)
+{
+    count++;
+    sum += value;
+    min = std::min(min, value);
+    max = std::max(max, value);
+}
+
+namespace
+{
+
+QJsonObject toJsonObject(double count, double sum, double min, double max)
+{
+    QJsonObject object;
+    object["sum"] = sum;
+    object["mean"] = count ? sum / count : 0.0;
+    object["min"] = count ? min : 0.0;
+    object["max"] = count ? max : 0.0;
+    return object;
+}
+
+} //end of namespace
+
+EDStatsCollector& EDStatsCollector::instance()
+{
+    static EDStatsCollector collector;
+    return collector;
+}
+
+EDStatsCollector::EDStatsCollector()
+    : calls(0), errors(0)
+{
+    std::fill(lengthHistogram, lengthHistogram + EDStats::LENGTH_BINS, 0);
+}
+
+void EDStatsCollector::add(const EDStats& stats, const QString& source)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    calls++;
+    if (stats.error) {
+        errors++;
+        return;
+    }
+
+    if (stats.total_ms > total.max) slowestSource = source;
+    smooth.add(stats.smooth_ms);
+    gradient.add(stats.gradient_ms);
+    anchor.add(stats.anchor_ms);
+    trace.add(stats.trace_ms);
+    total.add(stats.total_ms);
+    anchors.add(stats.anchors);
+    visitedAnchors.add(stats.visited_anchors);
+    tracedPixels.add((double)stats.traced_pixels);
+    edges.add(stats.edges);
+    scratchBytes.add((double)stats.peak_scratch_bytes);
+    for (int i = 0; i < EDStats::LENGTH_BINS; i++)
+        lengthHistogram[i] += stats.length_histogram[i];
+}
+
+void EDStatsCollector::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    calls = 0;
+    errors = 0;
+    smooth = gradient = anchor = trace = total = Summary();
+    anchors = visitedAnchors = tracedPixels = edges = scratchBytes = Summary();
+    std::fill(lengthHistogram, lengthHistogram + EDStats::LENGTH_BINS, 0);
+    slowestSource.clear();
+}
+
+QByteArray EDStatsCollector::toJson() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto summary = [](const Summary& s) { return toJsonObject(s.count, s.sum, s.min, s.max); };
+
+    QJsonObject stages;
+    stages["smooth"] = summary(smooth);
+    stages["gradient"] = summary(gradient);
+    stages["anchors"] = summary(anchor);
+    stages["trace"] = summary(trace);
+    stages["total"] = summary(total);
+
+    // bin i counts lengths from 2^i, the last bin is open
+    QJsonArray histogram;
+    for (int i = 0; i < EDStats::LENGTH_BINS; i++) {
+        QJsonObject bin;
+        bin["min_length"] = 1 << i;
+        bin["edges"] = (double)lengthHistogram[i];
+        histogram.append(bin);
+    }
+
+    QJsonObject root;
+    root["calls"] = (double)calls;
+    root["errors"] = (double)errors;
+    root["stage_ms"] = stages;
+    root["anchors"] = summary(anchors);
+    root["visited_anchors"] = summary(visitedAnchors);
+    root["traced_pixels"] = summary(tracedPixels);
+    root["edges"] = summary(edges);
+    root["peak_scratch_bytes"] = summary(scratchBytes);
+    root["edge_length_histogram"] = histogram;
+    root["slowest_source"] = slowestSource;
+    return QJsonDocument(root).toJson();
+}
+
+bool EDStatsCollector::writeJson(const QString& fileName) const
+{
+    QByteArray json = toJson();
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    return file.write(json) == json.size();
+}
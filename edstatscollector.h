@@ -0,0 +1,51 @@
+#ifndef EDSTATSCOLLECTOR_H
+#define EDSTATSCOLLECTOR_H
+
+#include <QByteArray>
+#include <QString>
+#include <mutex>
+#include "ED.h"
+
+/**
+ *@brief aggregate of the EDStats of every detection in the process, for
+ * tuning the thresholds and spotting pathological images.
+ *
+ * Detections run on the prefetcher, video and edge detection threads, they
+ * all add() to the shared instance under one mutex. The aggregate keeps
+ * count, sum, min and max per stage and the slowest image seen, it is
+ * exported as JSON from the File menu or with --ed-stats on exit.
+ */
+class EDStatsCollector
+{
+public:
+    static EDStatsCollector& instance();
+
+    // source names the image or frame in the JSON, e.g. its path
+    void add(const EDStats& stats, const QString& source = QString());
+    void clear();
+
+    QByteArray toJson() const;
+    bool writeJson(const QString& fileName) const;
+
+private:
+    struct Summary {
+        quint64 count;
+        double sum;
+        double min;
+        double max;
+        Summary();
+        void add(double value);
+    };
+
+    EDStatsCollector();
+
+    mutable std::mutex mutex;
+    quint64 calls;
+    quint64 errors;
+    Summary smooth, gradient, anchor, trace, total;
+    Summary anchors, visitedAnchors, tracedPixels, edges, scratchBytes;
+    quint64 lengthHistogram[EDStats::LENGTH_BINS];
+    QString slowestSource;
+};
+
+#endif // EDSTATSCOLLECTOR_H
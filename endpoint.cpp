@@ -3,37 +3,39 @@
 #include <QGraphicsSceneMouseEvent>
 #include <QDebug>
 #include "action.h"
+#include "profiler.h"
 
-EndPoint::EndPoint(EdgeItem* edgeItem, LabelImage* labelImage, unsigned int pointIndex)
-    : parent(edgeItem), image(labelImage), index(pointIndex)
+namespace
 {
-    QPointF imagePos = parent->points()[index] + QPointF(0.5,0.5);
-    radius = 1;
-    color = Qt::blue;
-    createModeColor = Qt::yellow;
-    borderWidth = 0.2;
-    padding = borderWidth;
-
-    setPos(image->image2item(imagePos));
-    oldPos = pos();
-    setFlag(ItemIsMovable);
-    setFlag(ItemSendsGeometryChanges);
-//    setCacheMode(DeviceCoordinateCache);
-    setZValue(2);
-    setVisible(false);
-}
 
-EndPoint::EndPoint(LabelImage* labelImage, QPointF position)
-    : parent(NULL), image(labelImage), index(0)
+// drawing style, shared by all endpoints
+const Qt::GlobalColor COLOR_DEFAULT = Qt::blue;
+const Qt::GlobalColor COLOR_CREATE_MODE = Qt::yellow;
+const double RADIUS = 1;
+const double BORDER_WIDTH = 0.2;
+const double PADDING = BORDER_WIDTH;
+
+} //end of namespace
+
+EndPoint::EndPoint(EdgeItem* edgeItem, LabelImage* labelImage, AnnotationModel::EdgeEnd edgeEnd)
+    : parent(edgeItem), image(labelImage), end(edgeEnd), stray(-1)
 {
-    radius = 1;
-    color = Qt::blue;
-    createModeColor = Qt::yellow;
-    borderWidth = 0.2;
-    padding = borderWidth;
+    init();
+    syncPosition();
+}
 
-    setPos(position);
+EndPoint::EndPoint(LabelImage* labelImage, int strayId)
+    : parent(NULL), image(labelImage), end(AnnotationModel::HEAD), stray(strayId)
+{
+    init();
+    cv::Point2f position = image->model().position(ref());
+    setPos(image->image2item(QPointF(position.x, position.y)));
     oldPos = pos();
+}
+
+void EndPoint::init()
+{
+    oldIndex = 0;
     setFlag(ItemIsMovable);
     setFlag(ItemSendsGeometryChanges);
 //    setCacheMode(DeviceCoordinateCache);
@@ -41,52 +43,46 @@ EndPoint::EndPoint(LabelImage* labelImage, QPointF position)
     setVisible(false);
 }
 
-
 unsigned int EndPoint::indexOnEdge() const
 {
-    return index;
+    if (!parent) return 0;
+    return image->model().endIndex(parent->id(), end);
 }
 
-QVariant EndPoint::itemChange(GraphicsItemChange change, const QVariant &value)
+AnnotationModel::PointRef EndPoint::ref() const
 {
-    QPointF newPos = value.toPointF();
-    if (change == ItemPositionChange && scene() && parent) {
-        QPointF inc, dec;
-        double len_i, len_d, len_o;
-        len_i = std::numeric_limits<double>::infinity();
-        len_d = std::numeric_limits<double>::infinity();
-        len_o = QLineF(newPos, oldPos).length();
-
-        bool canIncrement = true;
-        if (index+1 >= parent->points().size()) canIncrement = false;
-        if (this == parent->head() && index+1 >= parent->tail()->indexOnEdge()) canIncrement = false;
-
-        bool canDecrement = true;
-        if (index <= 0) canDecrement = false;
-        if (this == parent->tail() && index-1 <= parent->head()->indexOnEdge()) canDecrement = false;
-
-        if (canIncrement) {
-            inc = parent->points()[index+1] + QPointF(0.5, 0.5);
-            inc = image->image2item(inc);
-            len_i = QLineF(newPos, inc).length();
-        }
-        if (canDecrement) {
-            dec = parent->points()[index-1] + QPointF(0.5, 0.5);
-            dec = image->image2item(dec);
-            len_d = QLineF(newPos, dec).length();
-        }
+    AnnotationModel::PointRef r;
+    r.edge = parent ? parent->id() : -1;
+    r.id = parent ? (int)end : stray;
+    return r;
+}
 
-        if (len_i <= len_d && len_i <= len_o){
-            newPos = inc;
-            index++;
-        } else if (len_d <= len_i && len_d <= len_o){
-            newPos = dec;
-            index--;
-        } else {
-            newPos = oldPos;
+void EndPoint::syncPosition()
+{
+    // place on the pixel center of the current index
+    QPointF newPos = parent->point(indexOnEdge()) + QPointF(0.5, 0.5);
+    newPos = image->image2item(newPos);
+    oldPos = newPos;
+    setPos(newPos); // will trriger itemChange
+}
+
+QVariant EndPoint::itemChange(GraphicsItemChange change, const QVariant &value)
+{
+    if (change == ItemPositionChange && scene() && parent && !dragIndex.empty()) {
+        // the drag itself, not every geometry or selection change of the item
+        ProfileScope scope(Profiler::ENDPOINT_CHANGE);
+        // jump straight to the pixel nearest to the cursor, within the range the end may take
+        QPointF imagePos = image->item2image(value.toPointF());
+        int index = dragIndex.nearest(cv::Point2f(imagePos.x(), imagePos.y()));
+        if (index != (int)indexOnEdge()) {
+            image->model().setEndIndex(parent->id(), end, index);
+            parent->update(parent->boundingRect());
         }
+        QPointF newPos = image->image2item(parent->point(index) + QPointF(0.5, 0.5));
         oldPos = newPos;
         return newPos;
+    } else if (change == ItemPositionHasChanged) {
+        image->updateConnections(this);
     }
     return QGraphicsObject::itemChange(change, value);
 }
@@ -95,8 +91,14 @@ void EndPoint::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
     oldPos = pos();
     if (parent) {
-        oldIndex = index;
+        oldIndex = indexOnEdge();
         parent->setShowSplit(false);
+        // head and tail never meet, the other end bounds the range
+        const AnnotationModel::Edge& e = image->model().edge(parent->id());
+        if (end == AnnotationModel::HEAD)
+            dragIndex.build(image->model(), parent->id(), 0, e.tail - 1);
+        else
+            dragIndex.build(image->model(), parent->id(), e.head + 1, e.count - 1);
     }
     update(boundingRect());
     QGraphicsObject::mousePressEvent(event);
@@ -104,29 +106,32 @@ void EndPoint::mousePressEvent(QGraphicsSceneMouseEvent *event)
 
 void EndPoint::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 {
-    if (parent) {
+    dragIndex.clear();
+    if (image->inCreateMode() && (!parent || oldIndex == indexOnEdge())) {
+        // a click on a point in create mode starts or ends a connection
+        AnnotationModel::PointRef anchor = image->getConnectPoint();
+        if (!anchor.valid()) {
+            image->updateConnectPoint(ref());
+        } else if (!(anchor == ref())) {
+            ConnectPoint* act = new ConnectPoint(image, anchor, ref(), event->scenePos(),
+                                                 image->liveWirePath(pos()));
+            act->perform();
+            image->addAction(act);
+            image->updateConnectPoint(image->inLiveWireMode() ? ref() : AnnotationModel::noPoint());
+        }
+        if (parent && !parent->isSelected())
+            parent->setShowSplit(true);
+    } else if (parent) {
         EdgeItem* nnEdge = NULL;
-        // instead of recompute the nn, update a mask to prevent hover on hidden pixels
-        image->updateNNMask(parent);
+        // hidden pixels are masked by the head/tail indices in the model
         image->searchNN(event->pos(), nnEdge);
         if (parent != nnEdge)
             parent->hoverLeave();
         // add action to queue
-        if (oldIndex != index)
-            image->addAction(new EndPointMove(this, oldIndex, index));
+        if (oldIndex != indexOnEdge())
+            image->addAction(new EndPointMove(image, parent->id(), end, oldIndex, indexOnEdge()));
         if (!parent->isSelected())
             parent->setShowSplit(true);
-    } else {
-        //TODO: mouse handling for connecting points
-        if (image->inCreateMode() && ! image->getConnectPoint()) {
-            image->updateConnectPoint(this);
-        } else if (image->inCreateMode() && image->getConnectPoint()) {
-            Action* act = new ConnectPoint(image, image->getConnectPoint(), this, event->pos());
-            act->perform();
-            image->addAction(act);
-            image->updateConnectPoint(NULL);
-        }
-
     }
     update(boundingRect());
     QGraphicsObject::mouseReleaseEvent(event);
@@ -134,34 +139,25 @@ void EndPoint::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
 
 void EndPoint::moveTo(unsigned int newIndex)
 {
-    bool canMove = true;
-    if (newIndex >= parent->points().size()) canMove = false;
-    if (this == parent->head() && newIndex >= parent->tail()->indexOnEdge()) canMove = false;
-    if (this == parent->tail() && newIndex <= parent->head()->indexOnEdge()) canMove = false;
-
-    if (canMove) {
-        index = newIndex;
-        QPointF newPos = parent->points()[index] + QPointF(0.5, 0.5);
-        newPos = image->image2item(newPos);
-        oldPos = newPos;
-        setPos(newPos); // will trriger itemChange
+    if (image->model().canMoveEnd(parent->id(), end, newIndex)) {
+        image->model().setEndIndex(parent->id(), end, newIndex);
+        syncPosition();
     }
 
-    image->updateNNMask(parent);
     update(boundingRect());
     parent->update(parent->boundingRect());
 }
 
 QRectF EndPoint::boundingRect() const
 {
-    return QRectF(-radius-padding, -radius-padding,
-                  (radius+padding)*2, (radius+padding)*2);
+    return QRectF(-RADIUS-PADDING, -RADIUS-PADDING,
+                  (RADIUS+PADDING)*2, (RADIUS+PADDING)*2);
 }
 
 QPainterPath EndPoint::shape() const
 {
     QPainterPath path;
-    path.addEllipse(QPointF(0,0), radius, radius);
+    path.addEllipse(QPointF(0,0), RADIUS, RADIUS);
     return path;
 }
 
@@ -171,11 +167,11 @@ void EndPoint::paint(QPainter *painter, const QStyleOptionGraphicsItem *option,
     Q_UNUSED(widget);
 
     if (!image->inCreateMode()) {
-        painter->setPen(QPen(color, borderWidth));
-        painter->setBrush(QBrush(color));
+        painter->setPen(QPen(COLOR_DEFAULT, BORDER_WIDTH));
+        painter->setBrush(QBrush(COLOR_DEFAULT));
     } else {
-        painter->setPen(QPen(createModeColor, borderWidth));
-        painter->setBrush(QBrush(createModeColor));
+        painter->setPen(QPen(COLOR_CREATE_MODE, BORDER_WIDTH));
+        painter->setBrush(QBrush(COLOR_CREATE_MODE));
     }
     painter->drawPath(shape());
 }
@@ -3,18 +3,22 @@
 
 #include <QGraphicsObject>
 #include "edgeitem.h"
+#include "annotationmodel.h"
+#include "chainindex.h"
 
 class EndPoint : public QGraphicsObject
 {
     Q_OBJECT
 public:
-    EndPoint(EdgeItem* edgeItem, LabelImage* labelImage, unsigned int pointIndex);
+    EndPoint(EdgeItem* edgeItem, LabelImage* labelImage, AnnotationModel::EdgeEnd edgeEnd);
 
-    EndPoint(LabelImage* labelImage, QPointF position);
+    EndPoint(LabelImage* labelImage, int strayId);
 
     unsigned int indexOnEdge() const;
+    AnnotationModel::PointRef ref() const;
 
     void moveTo(unsigned int newIndex);
+    void syncPosition();
 
     void blink();
 
@@ -29,16 +33,16 @@ protected:
     void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override;
 
 private:
-    double radius;
-    QColor color;
-    QColor createModeColor;
-    double borderWidth;
-    double padding;
+    void init();
+
     EdgeItem* parent;
     LabelImage* image;
-    unsigned int index;
+    AnnotationModel::EdgeEnd end;
+    int stray;
     unsigned int oldIndex;
     QPointF oldPos;
+    // pixels this end may be dragged to, built when a drag starts
+    ChainIndex dragIndex;
 };
 
 #endif // ENDPOINT_H
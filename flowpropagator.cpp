@@ -0,0 +1,114 @@
+#include "flowpropagator.h"
+#include <opencv2/video/tracking.hpp>
+#include <algorithm>
+#include <map>
+
+namespace
+{
+
+// samples per edge, spread evenly over its visible range including both ends
+const int SAMPLES_PER_EDGE = 16;
+
+// Lucas-Kanade window and pyramid depth, 3 levels follow motion of a few dozen pixels
+const int FLOW_WINDOW = 21;
+const int FLOW_LEVELS = 3;
+
+// snapped samples farther than this from any detected pixel are dropped
+const float SNAP_RADIUS = 4;
+// nearest pool pixels looked at per sample, some may belong to retired edges
+const int SNAP_CANDIDATES = 4;
+// an edge matches when at least this many samples of one selected edge land on it
+const int MIN_VOTES = 3;
+
+} //end of namespace
+
+FlowPropagator::FlowPropagator()
+    : groups(0)
+{
+}
+
+void FlowPropagator::sample(const cv::Mat& gray, const AnnotationModel& model)
+{
+    prevGray = gray;
+    samples.clear();
+    sampleGroup.clear();
+    groups = 0;
+
+    for (int id = 0; id < model.edgeCount(); id++) {
+        if (!model.edgeAlive(id) || !model.edge(id).selected) continue;
+        const AnnotationModel::Edge& e = model.edge(id);
+        int length = e.tail - e.head + 1;
+        int count = std::min(length, SAMPLES_PER_EDGE);
+        for (int i = 0; i < count; i++) {
+            int index = count > 1 ? e.head + (int)((long long)i * (length - 1) / (count - 1)) : e.head;
+            cv::Point p = model.point(id, index);
+            samples.push_back(cv::Point2f(p.x + 0.5f, p.y + 0.5f));
+            sampleGroup.push_back(groups);
+        }
+        groups++;
+    }
+}
+
+bool FlowPropagator::empty() const
+{
+    return samples.empty() || prevGray.empty();
+}
+
+void FlowPropagator::track(const cv::Mat& gray, const AnnotationModel& model, cv::flann::Index& index,
+                           std::vector<Match>& matches) const
+{
+    matches.clear();
+    if (empty() || gray.size() != prevGray.size()) return;
+
+    // sparse flow, only the sampled pixels are tracked
+    std::vector<cv::Point2f> moved;
+    std::vector<uchar> status;
+    std::vector<float> error;
+    cv::calcOpticalFlowPyrLK(prevGray, gray, samples, moved, status, error,
+                             cv::Size(FLOW_WINDOW, FLOW_WINDOW), FLOW_LEVELS);
+
+    // one batched query for all samples
+    cv::Mat query = cv::Mat(moved).reshape(1);
+    cv::Mat indices, dists;
+    index.knnSearch(query, indices, dists, SNAP_CANDIDATES);
+
+    // per selected edge of the last frame, the local indices its samples landed on per edge
+    std::vector<std::map<int, std::vector<int>>> votes(groups);
+    for (int i = 0; i < (int)moved.size(); i++) {
+        if (!status[i]) continue;
+        for (int k = 0; k < SNAP_CANDIDATES; k++) {
+            if (dists.at<float>(i, k) > SNAP_RADIUS * SNAP_RADIUS) break;
+            int pool = indices.at<int>(i, k);
+            if (pool < 0 || pool >= model.pixelCount()) continue;
+            int id, local;
+            if (!model.locatePixel(pool, id, local)) continue;
+            votes[sampleGroup[i]][id].push_back(local);
+            break;
+        }
+    }
+
+    // edges matched by several selected edges are merged into one range
+    std::map<int, Match> byEdge;
+    for (const auto& group : votes) {
+        auto best = group.end();
+        for (auto it = group.begin(); it != group.end(); it++) {
+            if (best == group.end() || it->second.size() > best->second.size()) best = it;
+        }
+        if (best == group.end() || (int)best->second.size() < MIN_VOTES) continue;
+
+        auto range = std::minmax_element(best->second.begin(), best->second.end());
+        auto found = byEdge.find(best->first);
+        if (found == byEdge.end()) {
+            Match match;
+            match.edge = best->first;
+            match.head = *range.first;
+            match.tail = *range.second;
+            byEdge[best->first] = match;
+        } else {
+            found->second.head = std::min(found->second.head, *range.first);
+            found->second.tail = std::max(found->second.tail, *range.second);
+        }
+    }
+    for (const auto& match : byEdge)
+        matches.push_back(match.second);
+}
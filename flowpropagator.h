@@ -0,0 +1,46 @@
+#ifndef FLOWPROPAGATOR_H
+#define FLOWPROPAGATOR_H
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/flann/miniflann.hpp>
+#include <vector>
+#include "annotationmodel.h"
+
+/**
+ *@brief carries the selected edges of one video frame over to the next.
+ *
+ * sample() keeps a few pixels of the visible range of each selected edge,
+ * track() moves only those pixels with pyramidal Lucas-Kanade flow and
+ * snaps them onto the edges detected in the next frame through its spatial
+ * index. The edge most samples land on is the match, trimmed to the range
+ * they cover. No dense flow is computed, the cost grows with the number of
+ * selected edges and not with the frame size.
+ */
+class FlowPropagator
+{
+public:
+    struct Match {
+        int edge;
+        int head;   // local indices covered by the snapped samples, head <= tail
+        int tail;
+    };
+
+    FlowPropagator();
+
+    // gray is the 8-bit luminance of the frame the model belongs to
+    void sample(const cv::Mat& gray, const AnnotationModel& model);
+    bool empty() const;
+
+    // index as built by EdgeDetectJob::buildIndex() over the pixel pool of model
+    void track(const cv::Mat& gray, const AnnotationModel& model, cv::flann::Index& index,
+               std::vector<Match>& matches) const;
+
+private:
+    cv::Mat prevGray;
+    std::vector<cv::Point2f> samples;
+    // selected edge each sample was taken from, numbered 0 .. groups-1
+    std::vector<int> sampleGroup;
+    int groups;
+};
+
+#endif // FLOWPROPAGATOR_H
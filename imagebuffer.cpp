@@ -0,0 +1,206 @@
+#include "imagebuffer.h"
+#include "ED.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+
+// QImage cleanup function, drops the reference held by the view
+void releaseMat(void *info)
+{
+    delete static_cast<cv::Mat*>(info);
+}
+
+// fixed point BGR to luminance weights, the same as cv::cvtColor(CV_BGR2GRAY)
+const int GRAY_SHIFT = 14;
+const int GRAY_B = 1868;
+const int GRAY_G = 9617;
+const int GRAY_R = 4899;
+
+inline
+uchar luma(const uchar* bgr)
+{
+    return (uchar)((bgr[0]*GRAY_B + bgr[1]*GRAY_G + bgr[2]*GRAY_R + (1 << (GRAY_SHIFT-1))) >> GRAY_SHIFT);
+}
+
+/**
+ *@brief reads each source row once and writes the luminance row, and the
+ * RGB display row when the display needs a swizzle. Luminance is smoothed
+ * stripe by stripe while it is still in cache, each stripe converts a few
+ * extra rows around it so the blur matches a blur of the whole image.
+ */
+class FusedConvert : public cv::ParallelLoopBody
+{
+public:
+    FusedConvert(const cv::Mat& source, cv::Mat& display, cv::Mat& gray, bool smooth)
+        : src(source), dst(display), lum(gray), blur(smooth) {}
+
+    void operator()(const cv::Range& range) const override
+    {
+        // without a luminance plane only the display is swizzled
+        bool gray = !lum.empty();
+        int halo = gray && blur ? ED::smoothRadius() : 0;
+        int first = std::max(0, range.start - halo);
+        int last = std::min(src.rows, range.end + halo);
+
+        // luminance of the stripe plus halo, written straight to the output if not smoothing
+        cv::Mat stripe;
+        if (gray) stripe = blur ? cv::Mat(last - first, src.cols, CV_8UC1) : lum.rowRange(first, last);
+        int channels = src.channels();
+        bool swizzle = !dst.empty() && dst.data != src.data;
+
+        for (int r = first; r < last; r++) {
+            const uchar* in = src.ptr<uchar>(r);
+            uchar* out = gray ? stripe.ptr<uchar>(r - first) : NULL;
+            if (channels == 1) {
+                if (out) memcpy(out, in, src.cols);
+                continue;
+            }
+            bool inStripe = r >= range.start && r < range.end;
+            uchar* rgb = swizzle && inStripe ? dst.ptr<uchar>(r) : NULL;
+            for (int c = 0; c < src.cols; c++, in += channels) {
+                if (out) out[c] = luma(in);
+                if (rgb) {
+                    rgb[0] = in[2];
+                    rgb[1] = in[1];
+                    rgb[2] = in[0];
+                    rgb += 3;
+                }
+            }
+        }
+
+        if (gray && blur) {
+            // the ROI reads the halo rows of its parent as border
+            cv::Mat roi = stripe.rowRange(range.start - first, range.end - first);
+            cv::Mat out = lum.rowRange(range.start, range.end);
+            ED::smooth(roi, out);
+        }
+    }
+
+private:
+    const cv::Mat& src;
+    cv::Mat& dst;
+    cv::Mat& lum;
+    bool blur;
+};
+
+} //end of namespace
+
+ImageBuffer::ImageBuffer()
+    : mode(NO_LUMINANCE)
+{
+}
+
+ImageBuffer::ImageBuffer(const cv::Mat& mat, Luminance luminance)
+    : source(mat), mode(luminance)
+{
+    convert();
+}
+
+void ImageBuffer::convert()
+{
+    if (source.empty()) return;
+
+    QImage::Format format;
+
+    switch (source.type()) {
+    case CV_8UC3:
+#if QT_VERSION >= QT_VERSION_CHECK(5, 14, 0)
+        // Qt reads BGR directly, no conversion at all
+        display = source;
+        format = QImage::Format_BGR888;
+#else
+        // swizzled into the display buffer in the same pass as luminance
+        display.create(source.rows, source.cols, CV_8UC3);
+        format = QImage::Format_RGB888;
+#endif
+        break;
+    case CV_8UC1:
+        display = source;
+        format = QImage::Format_Grayscale8;
+        break;
+    case CV_8UC4:
+        display = source;
+        format = QImage::Format_ARGB32;
+        break;
+    default:
+        return;
+    }
+
+    if (mode == NO_LUMINANCE && display.data == source.data) {
+        // a view of the decoded pixels, nothing to compute
+        createView(format);
+        return;
+    }
+
+    if (mode != NO_LUMINANCE)
+        gray.create(source.rows, source.cols, CV_8UC1);
+    // stripes of at least 64 rows keep the halo overhead small
+    double stripes = std::max(1, source.rows / 64);
+    cv::parallel_for_(cv::Range(0, source.rows), FusedConvert(source, display, gray, mode == SMOOTHED_LUMINANCE), stripes);
+
+    createView(format);
+}
+
+void ImageBuffer::createView(QImage::Format format)
+{
+    view = QImage(display.data, display.cols, display.rows, static_cast<int>(display.step),
+                  format, releaseMat, new cv::Mat(display));
+}
+
+bool ImageBuffer::empty() const
+{
+    return view.isNull();
+}
+
+int ImageBuffer::width() const
+{
+    return source.cols;
+}
+
+int ImageBuffer::height() const
+{
+    return source.rows;
+}
+
+const cv::Mat& ImageBuffer::mat() const
+{
+    return source;
+}
+
+const QImage& ImageBuffer::image() const
+{
+    return view;
+}
+
+const cv::Mat& ImageBuffer::luminance() const
+{
+    return gray;
+}
+
+bool ImageBuffer::luminanceSmoothed() const
+{
+    return mode == SMOOTHED_LUMINANCE;
+}
+
+void ImageBuffer::addLuminance(Luminance luminance)
+{
+    if (luminance == NO_LUMINANCE || !gray.empty() || source.empty()) return;
+
+    mode = luminance;
+    gray.create(source.rows, source.cols, CV_8UC1);
+    // without a display plane the pass writes luminance only, the view stays swizzled
+    cv::Mat noDisplay;
+    double stripes = std::max(1, source.rows / 64);
+    cv::parallel_for_(cv::Range(0, source.rows), FusedConvert(source, noDisplay, gray, mode == SMOOTHED_LUMINANCE), stripes);
+}
+
+size_t ImageBuffer::memoryBytes() const
+{
+    size_t bytes = source.total()*source.elemSize() + gray.total()*gray.elemSize();
+    if (display.data != source.data)
+        bytes += display.total()*display.elemSize();
+    return bytes;
+}
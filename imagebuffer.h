@@ -0,0 +1,48 @@
+#ifndef IMAGEBUFFER_H
+#define IMAGEBUFFER_H
+
+#include <QImage>
+#include <opencv2/core/core.hpp>
+
+/**
+ *@brief decoded image owned by a ref-counted cv::Mat and viewed by a QImage
+ * without copying. The QImage keeps its own reference to the pixels, so it
+ * stays valid after the ImageBuffer and the source cv::Mat are gone.
+ */
+class ImageBuffer
+{
+public:
+    // which luminance plane to compute along with the display view
+    enum Luminance { NO_LUMINANCE, LUMINANCE, SMOOTHED_LUMINANCE };
+
+    ImageBuffer();
+    explicit ImageBuffer(const cv::Mat& mat, Luminance luminance = SMOOTHED_LUMINANCE);
+
+    bool empty() const;
+    int width() const;
+    int height() const;
+
+    // pixels as decoded, BGR or gray
+    const cv::Mat& mat() const;
+    // display view sharing memory with mat() whenever Qt can read the layout
+    const QImage& image() const;
+    // 8-bit luminance for edge detection, smoothed with ED::smooth() if requested, empty with NO_LUMINANCE
+    const cv::Mat& luminance() const;
+    bool luminanceSmoothed() const;
+    // computes the luminance plane of a buffer decoded without one, the display view is kept as is
+    void addLuminance(Luminance luminance = SMOOTHED_LUMINANCE);
+    // bytes held by the planes, shared planes counted once
+    size_t memoryBytes() const;
+
+private:
+    void convert();
+    void createView(QImage::Format format);
+
+    cv::Mat source;
+    cv::Mat display;
+    cv::Mat gray;
+    Luminance mode;
+    QImage view;
+};
+
+#endif // IMAGEBUFFER_H
@@ -0,0 +1,213 @@
+#include "imagelistmodel.h"
+#include "thumbnailcache.h"
+#include "sessionjournal.h"
+#include <QRunnable>
+#include <QFileInfo>
+#include <QMetaObject>
+#include <QThread>
+#include <functional>
+#include <algorithm>
+
+namespace
+{
+
+// rows added to the view per fetchMore()
+const int FETCH_BATCH = 256;
+// thumbnails kept in memory, the disk cache holds the rest
+const int MEMORY_THUMBNAILS = 2000;
+
+// a session directory exists once the image has been edited, a file system access
+bool hasSession(const QString& imagePath)
+{
+    return QFileInfo(SessionJournal::sessionDirFor(imagePath)).isDir();
+}
+
+class ThumbnailTask : public QRunnable
+{
+public:
+    ThumbnailTask(const std::function<void()>& job) : job(job) {}
+    void run() override { job(); }
+
+private:
+    std::function<void()> job;
+};
+
+} //end of namespace
+
+ImageListModel::ImageListModel(QObject *parent)
+    : QAbstractListModel(parent), fetched(0), thumbnails(MEMORY_THUMBNAILS), requestPriority(0)
+{
+    // decoding is I/O bound as much as CPU bound, keep the GUI thread free
+    pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1));
+}
+
+ImageListModel::~ImageListModel()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+void ImageListModel::setImages(const QStringList& images)
+{
+    pool.clear();
+    beginResetModel();
+    paths = images;
+    titles.clear();
+    annotated.clear();
+    pending.clear();
+    statusPending.clear();
+    fetched = 0;
+    endResetModel();
+}
+
+const QStringList& ImageListModel::images() const
+{
+    return paths;
+}
+
+void ImageListModel::setTitle(int row, const QString& title)
+{
+    titles[row] = title;
+    if (row < fetched) emit dataChanged(index(row), index(row), {Qt::DisplayRole});
+}
+
+void ImageListModel::refreshStatus(int row)
+{
+    annotated.remove(row);
+    if (row < paths.size()) requestStatus(row);
+}
+
+QModelIndex ImageListModel::indexOf(int row)
+{
+    if (row < 0 || row >= paths.size()) return QModelIndex();
+    if (row >= fetched) {
+        beginInsertRows(QModelIndex(), fetched, row);
+        fetched = row + 1;
+        endInsertRows();
+    }
+    return index(row);
+}
+
+int ImageListModel::rowCount(const QModelIndex& parent) const
+{
+    return parent.isValid() ? 0 : fetched;
+}
+
+bool ImageListModel::canFetchMore(const QModelIndex& parent) const
+{
+    return !parent.isValid() && fetched < paths.size();
+}
+
+void ImageListModel::fetchMore(const QModelIndex& parent)
+{
+    if (parent.isValid()) return;
+    int count = std::min(FETCH_BATCH, paths.size() - fetched);
+    if (count <= 0) return;
+    beginInsertRows(QModelIndex(), fetched, fetched + count - 1);
+    fetched += count;
+    endInsertRows();
+}
+
+Qt::ItemFlags ImageListModel::flags(const QModelIndex& index) const
+{
+    if (!index.isValid()) return Qt::NoItemFlags;
+    // the check box shows the status, it is not editable
+    return Qt::ItemIsEnabled | Qt::ItemIsSelectable | Qt::ItemNeverHasChildren;
+}
+
+QVariant ImageListModel::data(const QModelIndex& index, int role) const
+{
+    if (!index.isValid() || index.row() >= fetched) return QVariant();
+    int row = index.row();
+    const QString& path = paths[row];
+
+    switch (role) {
+    case Qt::DisplayRole:
+        return titles.contains(row) ? titles[row] : QFileInfo(path).fileName();
+    case Qt::ToolTipRole:
+        return path;
+    case Qt::CheckStateRole: {
+        auto it = annotated.find(row);
+        if (it != annotated.end()) return it.value() ? Qt::Checked : Qt::Unchecked;
+        // a pending thumbnail brings the status along
+        if (!pending.count(path)) requestStatus(row);
+        return Qt::Unchecked;
+    }
+    case Qt::DecorationRole: {
+        QImage* image = thumbnails.object(path);
+        if (image) return *image;
+        requestThumbnail(row);
+        return QVariant();
+    }
+    default:
+        return QVariant();
+    }
+}
+
+void ImageListModel::requestThumbnail(int row) const
+{
+    QString path = paths[row];
+    if (pending.count(path)) return;
+    pending.insert(path);
+
+    // the model is only touched on the GUI thread, the worker just decodes
+    ImageListModel* self = const_cast<ImageListModel*>(this);
+    auto job = [self, row, path]() {
+        QImage image = ThumbnailCache::thumbnail(path, THUMBNAIL_SIZE);
+        bool edited = hasSession(path);
+        QMetaObject::invokeMethod(self, [self, row, path, image, edited]() {
+            self->thumbnailReady(row, path, image, edited);
+        }, Qt::QueuedConnection);
+    };
+    // rows painted last are the ones on screen, serve them first
+    pool.start(new ThumbnailTask(job), ++requestPriority);
+}
+
+void ImageListModel::requestStatus(int row) const
+{
+    QString path = paths[row];
+    if (statusPending.count(path)) return;
+    statusPending.insert(path);
+
+    ImageListModel* self = const_cast<ImageListModel*>(this);
+    auto job = [self, row, path]() {
+        bool edited = hasSession(path);
+        QMetaObject::invokeMethod(self, [self, row, path, edited]() {
+            self->statusReady(row, path, edited);
+        }, Qt::QueuedConnection);
+    };
+    pool.start(new ThumbnailTask(job), ++requestPriority);
+}
+
+void ImageListModel::thumbnailReady(int row, const QString& path, const QImage& image, bool edited)
+{
+    // the list may have been replaced meanwhile
+    if (row >= paths.size() || paths[row] != path) return;
+    // a status requested since is newer
+    if (!statusPending.count(path)) statusReady(row, path, edited);
+    // unreadable images stay pending, so they are not retried on every paint
+    if (image.isNull()) return;
+    pending.erase(path);
+    thumbnails.insert(path, new QImage(image));
+    if (row < fetched) emit dataChanged(index(row), index(row), {Qt::DecorationRole});
+}
+
+void ImageListModel::statusReady(int row, const QString& path, bool edited)
+{
+    if (row >= paths.size() || paths[row] != path) return;
+    statusPending.erase(path);
+    auto it = annotated.find(row);
+    if (it != annotated.end() && it.value() == edited) return;
+    annotated[row] = edited;
+    if (row < fetched) emit dataChanged(index(row), index(row), {Qt::CheckStateRole});
+}
+
+size_t ImageListModel::memoryBytes() const
+{
+    size_t bytes = 0;
+    for (const auto& path : thumbnails.keys()) {
+        const QImage* image = thumbnails.object(path);
+        if (image) bytes += (size_t)image->bytesPerLine() * image->height();
+    }
+    return bytes;
+}
@@ -0,0 +1,67 @@
+#ifndef IMAGELISTMODEL_H
+#define IMAGELISTMODEL_H
+
+#include <QAbstractListModel>
+#include <QStringList>
+#include <QThreadPool>
+#include <QCache>
+#include <QImage>
+#include <QHash>
+#include <set>
+
+/**
+ *@brief image list for the tree view, with thumbnails and annotation status.
+ *
+ * Rows are exposed in batches through canFetchMore()/fetchMore(), so the
+ * view only lays out what is scrolled to. Thumbnails are requested when a
+ * row is first painted and come from ThumbnailCache on a worker pool,
+ * newest requests first. Until then the row shows its name only. The
+ * annotation status is looked up on the same pool, with the thumbnail
+ * when one is requested, and shows unchecked until it is known.
+ */
+class ImageListModel : public QAbstractListModel
+{
+    Q_OBJECT
+public:
+    static const int THUMBNAIL_SIZE = 64;
+
+    explicit ImageListModel(QObject *parent = 0);
+    ~ImageListModel();
+
+    void setImages(const QStringList& paths);
+    const QStringList& images() const;
+    // replaces the file name shown for row
+    void setTitle(int row, const QString& title);
+    // re-reads whether row has a session, after the image was edited
+    void refreshStatus(int row);
+    // fetches rows up to row, so it can be selected
+    QModelIndex indexOf(int row);
+    // thumbnails held in memory
+    size_t memoryBytes() const;
+
+    int rowCount(const QModelIndex& parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
+    Qt::ItemFlags flags(const QModelIndex& index) const override;
+    bool canFetchMore(const QModelIndex& parent) const override;
+    void fetchMore(const QModelIndex& parent) override;
+
+private:
+    void requestThumbnail(int row) const;
+    void requestStatus(int row) const;
+    void thumbnailReady(int row, const QString& path, const QImage& image, bool edited);
+    void statusReady(int row, const QString& path, bool edited);
+
+    QStringList paths;
+    QHash<int, QString> titles;
+    int fetched;
+
+    // mutable, filled lazily from data()
+    mutable QHash<int, bool> annotated;
+    mutable QCache<QString, QImage> thumbnails;
+    mutable std::set<QString> pending;
+    mutable std::set<QString> statusPending;
+    mutable int requestPriority;
+    mutable QThreadPool pool;
+};
+
+#endif // IMAGELISTMODEL_H
@@ -0,0 +1,173 @@
+#include "imageprefetcher.h"
+#include "ED.h"
+#include "edstatscollector.h"
+#include <QRunnable>
+#include <QThread>
+#include <QMutexLocker>
+#include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+
+class ImagePrefetcher::Task : public QRunnable
+{
+public:
+    Task(ImagePrefetcher* owner, const QString& path) : owner(owner), path(path) {}
+    // also runs when the pool drops the task before it started
+    ~Task() { owner->finished(path); }
+
+    void run() override
+    {
+        ImageBuffer buffer;
+        AnnotationModel edges;
+        load(path, buffer, edges);
+        owner->store(path, buffer, edges);
+    }
+
+private:
+    ImagePrefetcher* owner;
+    QString path;
+};
+
+ImagePrefetcher::ImagePrefetcher(QObject *parent)
+    : QObject(parent)
+{
+    lookahead = 3;
+    memoryBudget = size_t(1) << 30;
+    cachedBytes = 0;
+    useCounter = 0;
+    // leave a core for the GUI thread
+    pool.setMaxThreadCount(std::max(1, QThread::idealThreadCount() - 1));
+}
+
+ImagePrefetcher::~ImagePrefetcher()
+{
+    pool.clear();
+    pool.waitForDone();
+}
+
+void ImagePrefetcher::setImages(const QStringList& paths)
+{
+    pool.clear();
+    images = paths;
+}
+
+void ImagePrefetcher::setLookahead(int count)
+{
+    lookahead = count;
+}
+
+void ImagePrefetcher::setMemoryBudget(size_t bytes)
+{
+    QMutexLocker lock(&mutex);
+    memoryBudget = bytes;
+    evict();
+}
+
+void ImagePrefetcher::prefetch(int index)
+{
+    // drop queued work for images the user moved away from
+    pool.clear();
+    for (int i = index; i < index + lookahead && i < images.size(); i++) {
+        if (i >= 0) schedule(images[i]);
+    }
+}
+
+void ImagePrefetcher::schedule(const QString& path)
+{
+    {
+        QMutexLocker lock(&mutex);
+        auto it = cache.find(path);
+        if (it != cache.end()) {
+            // keep it away from eviction while it is in the lookahead window
+            it->second.lastUse = ++useCounter;
+            return;
+        }
+        if (pending.count(path)) return;
+        pending.insert(path);
+    }
+
+    pool.start(new Task(this, path));
+}
+
+void ImagePrefetcher::load(const QString& path, ImageBuffer& buffer, AnnotationModel& edges)
+{
+    cv::Mat image = cv::imread(path.toStdString());
+    buffer = ImageBuffer(image);
+    edges.clear();
+    if (buffer.empty()) return;
+
+    std::vector<std::list<cv::Point>> detected;
+    EDStats stats;
+    ED::detectEdgesSmoothed(buffer.luminance(), detected, ED::DEFAULT_PROPOSAL_THRESH,
+                            ED::DEFAULT_ANCHOR_INTERVAL, ED::DEFAULT_ANCHOR_THRESH, &stats);
+    EDStatsCollector::instance().add(stats, path);
+    edges.addEdges(detected);
+}
+
+void ImagePrefetcher::store(const QString& path, const ImageBuffer& buffer, const AnnotationModel& edges)
+{
+    {
+        QMutexLocker lock(&mutex);
+        // no longer loading by the time ready() is received
+        pending.erase(path);
+        if (!buffer.empty()) {
+            Entry& entry = cache[path];
+            cachedBytes -= entry.bytes;
+            entry.buffer = buffer;
+            entry.edges = edges;
+            entry.bytes = buffer.memoryBytes() + edges.memoryBytes();
+            entry.lastUse = ++useCounter;
+            cachedBytes += entry.bytes;
+            evict();
+        }
+    }
+    emit ready(path);
+}
+
+bool ImagePrefetcher::take(const QString& path, ImageBuffer& buffer, AnnotationModel& edges)
+{
+    QMutexLocker lock(&mutex);
+    auto it = cache.find(path);
+    if (it == cache.end()) return false;
+    it->second.lastUse = ++useCounter;
+    buffer = it->second.buffer;
+    edges = it->second.edges;
+    return true;
+}
+
+bool ImagePrefetcher::loading(const QString& path)
+{
+    QMutexLocker lock(&mutex);
+    return pending.count(path) > 0;
+}
+
+void ImagePrefetcher::finished(const QString& path)
+{
+    QMutexLocker lock(&mutex);
+    pending.erase(path);
+}
+
+void ImagePrefetcher::evict()
+{
+    // least recently used first, called with the mutex held
+    while (cachedBytes > memoryBudget && cache.size() > 1) {
+        auto oldest = cache.begin();
+        for (auto it = cache.begin(); it != cache.end(); it++) {
+            if (it->second.lastUse < oldest->second.lastUse)
+                oldest = it;
+        }
+        cachedBytes -= oldest->second.bytes;
+        cache.erase(oldest);
+    }
+}
+
+size_t ImagePrefetcher::memoryBytes()
+{
+    QMutexLocker lock(&mutex);
+    return cachedBytes;
+}
+
+int ImagePrefetcher::cachedCount()
+{
+    QMutexLocker lock(&mutex);
+    return (int)cache.size();
+}
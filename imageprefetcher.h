@@ -0,0 +1,73 @@
+#ifndef IMAGEPREFETCHER_H
+#define IMAGEPREFETCHER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+#include <QMutex>
+#include <map>
+#include <set>
+#include "imagebuffer.h"
+#include "annotationmodel.h"
+
+/**
+ *@brief decodes the images following the current one and runs edge
+ * detection on them on worker threads. Results are kept in an LRU cache
+ * bounded by memory, so moving to the next image needs no imread and no
+ * detection.
+ */
+class ImagePrefetcher : public QObject
+{
+    Q_OBJECT
+public:
+    explicit ImagePrefetcher(QObject *parent = 0);
+    ~ImagePrefetcher();
+
+    void setImages(const QStringList& paths);
+    void setLookahead(int count);
+    void setMemoryBudget(size_t bytes);
+
+    // schedules the lookahead images starting at index
+    void prefetch(int index);
+    // fills buffer and edges if the image has been decoded and detected
+    bool take(const QString& path, ImageBuffer& buffer, AnnotationModel& edges);
+    // the image is being decoded and detected, ready() follows
+    bool loading(const QString& path);
+    // images and edges held by the cache
+    size_t memoryBytes();
+    int cachedCount();
+
+signals:
+    // emitted on a worker once the load of path is done, take() tells whether it succeeded
+    void ready(const QString& path);
+
+private:
+    class Task;
+
+    struct Entry {
+        ImageBuffer buffer;
+        AnnotationModel edges;
+        size_t bytes;
+        quint64 lastUse;
+    };
+
+    static void load(const QString& path, ImageBuffer& buffer, AnnotationModel& edges);
+    void schedule(const QString& path);
+    void store(const QString& path, const ImageBuffer& buffer, const AnnotationModel& edges);
+    void finished(const QString& path);
+    void evict();
+
+    QStringList images;
+    int lookahead;
+    size_t memoryBudget;
+
+    QThreadPool pool;
+    QMutex mutex;
+    std::map<QString, Entry> cache;
+    // queued or running, so an image is never loaded twice
+    std::set<QString> pending;
+    size_t cachedBytes;
+    quint64 useCounter;
+};
+
+#endif // IMAGEPREFETCHER_H
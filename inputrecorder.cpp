@@ -0,0 +1,131 @@
+#include "inputrecorder.h"
+#include "ED.h"
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QKeyEvent>
+
+namespace
+{
+
+const quint32 MAGIC = 0x424c5243;   // "BLRC"
+// 2 the header holds the session state with its undo history instead of the model
+const quint32 VERSION = 2;
+
+} //end of namespace
+
+InputRecorder::Header::Header()
+    : proposalThresh(ED::DEFAULT_PROPOSAL_THRESH), anchorInterval(ED::DEFAULT_ANCHOR_INTERVAL),
+      anchorThresh(ED::DEFAULT_ANCHOR_THRESH), scrollX(0), scrollY(0)
+{
+}
+
+InputRecorder::InputRecorder(const QString& fileName)
+    : file(fileName)
+{
+}
+
+InputRecorder::~InputRecorder()
+{
+    stop();
+}
+
+bool InputRecorder::start(const Header& header)
+{
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    out.setDevice(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << MAGIC << VERSION;
+    out << header.imagePath << (qint32)header.proposalThresh << (qint32)header.anchorInterval
+        << (qint32)header.anchorThresh << header.session << header.viewportSize << header.transform
+        << (qint32)header.scrollX << (qint32)header.scrollY;
+    clock.start();
+    return out.status() == QDataStream::Ok;
+}
+
+void InputRecorder::record(const QMouseEvent* event)
+{
+    Event e;
+    switch (event->type()) {
+    case QEvent::MouseButtonPress:
+    case QEvent::MouseButtonDblClick:
+        e.type = Event::MOUSE_PRESS;
+        break;
+    case QEvent::MouseButtonRelease:
+        e.type = Event::MOUSE_RELEASE;
+        break;
+    default:
+        e.type = Event::MOUSE_MOVE;
+    }
+    e.pos = event->localPos();
+    e.button = event->button();
+    e.buttons = event->buttons();
+    e.modifiers = event->modifiers();
+    e.value = 0;
+    write(e);
+}
+
+void InputRecorder::record(const QWheelEvent* event)
+{
+    Event e;
+    e.type = Event::WHEEL;
+    e.pos = event->posF();
+    e.button = Qt::NoButton;
+    e.buttons = event->buttons();
+    e.modifiers = event->modifiers();
+    e.value = event->delta();
+    write(e);
+}
+
+void InputRecorder::record(const QKeyEvent* event)
+{
+    Event e;
+    e.type = Event::KEY_PRESS;
+    e.button = Qt::NoButton;
+    e.buttons = Qt::NoButton;
+    e.modifiers = event->modifiers();
+    e.value = event->key();
+    write(e);
+}
+
+void InputRecorder::write(const Event& event)
+{
+    if (!file.isOpen()) return;
+    out << event.type << (qint64)(clock.nsecsElapsed() / 1000) << event.pos << event.button << event.buttons
+        << event.modifiers << event.value;
+}
+
+void InputRecorder::stop()
+{
+    if (file.isOpen()) file.close();
+}
+
+bool InputRecorder::load(const QString& fileName, Header& header, std::vector<Event>& events)
+{
+    QFile in(fileName);
+    if (!in.open(QIODevice::ReadOnly)) return false;
+    QDataStream stream(&in);
+    stream.setVersion(QDataStream::Qt_5_0);
+
+    quint32 magic, version;
+    stream >> magic >> version;
+    if (magic != MAGIC || version != VERSION) return false;
+    qint32 proposal, interval, anchor, scrollX, scrollY;
+    stream >> header.imagePath >> proposal >> interval >> anchor >> header.session >> header.viewportSize
+           >> header.transform >> scrollX >> scrollY;
+    if (stream.status() != QDataStream::Ok) return false;
+    header.proposalThresh = proposal;
+    header.anchorInterval = interval;
+    header.anchorThresh = anchor;
+    header.scrollX = scrollX;
+    header.scrollY = scrollY;
+
+    // a recording cut short keeps the events read so far
+    events.clear();
+    while (!stream.atEnd()) {
+        Event e;
+        stream >> e.type >> e.time >> e.pos >> e.button >> e.buttons >> e.modifiers >> e.value;
+        if (stream.status() != QDataStream::Ok) break;
+        events.push_back(e);
+    }
+    return true;
+}
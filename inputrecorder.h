@@ -0,0 +1,78 @@
+#ifndef INPUTRECORDER_H
+#define INPUTRECORDER_H
+
+#include <QString>
+#include <QPointF>
+#include <QSize>
+#include <QTransform>
+#include <QFile>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <vector>
+
+class QMouseEvent;
+class QWheelEvent;
+class QKeyEvent;
+
+/**
+ *@brief records the input a LabelWidget receives together with what is
+ * needed to rebuild its starting state, for replay by ReplayHarness.
+ *
+ * The header keeps the image path, the ED thresholds, the session state at
+ * the start (edits and undo history) and the view transform, so viewport positions of the events
+ * hit the same edges again. Events are streamed to the file as they come
+ * in, with their time since the start in microseconds.
+ */
+class InputRecorder
+{
+public:
+    struct Header {
+        QString imagePath;
+        int proposalThresh;
+        int anchorInterval;
+        int anchorThresh;
+        QByteArray session;     // LabelImage::sessionState(), restored over the detected edges
+        QSize viewportSize;
+        QTransform transform;
+        int scrollX;
+        int scrollY;
+        Header();
+    };
+
+    struct Event {
+        enum Type {
+            MOUSE_MOVE,
+            MOUSE_PRESS,
+            MOUSE_RELEASE,
+            WHEEL,
+            KEY_PRESS
+        };
+        quint8 type;
+        qint64 time;
+        QPointF pos;            // viewport coordinates
+        qint32 button;
+        qint32 buttons;
+        qint32 modifiers;
+        qint32 value;           // key, or wheel delta
+    };
+
+    explicit InputRecorder(const QString& fileName);
+    ~InputRecorder();
+
+    bool start(const Header& header);
+    void record(const QMouseEvent* event);
+    void record(const QWheelEvent* event);
+    void record(const QKeyEvent* event);
+    void stop();
+
+    static bool load(const QString& fileName, Header& header, std::vector<Event>& events);
+
+private:
+    void write(const Event& event);
+
+    QFile file;
+    QDataStream out;
+    QElapsedTimer clock;
+};
+
+#endif // INPUTRECORDER_H
@@ -1,18 +1,73 @@
 #include "labelimage.h"
-#include "mat_qimage.h"
+#include <QGraphicsScene>
 #include "edgeitem.h"
 #include "endpoint.h"
 #include <QGraphicsSceneHoverEvent>
-#include "ED.h"
 #include <QKeyEvent>
 #include <QDebug>
 #include <QTime>
 #include "action.h"
+#include "connectionlayer.h"
+#include "regionlayer.h"
+#include "regionbuilder.h"
+#include "profiler.h"
+#include "memoryreport.h"
+#include <QTimeLine>
+#include "sessionjournal.h"
+#include "sessionstate.h"
+#include "edgedetectjob.h"
+#include <QTimer>
+#include <QGraphicsPathItem>
+#include <QElapsedTimer>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
 
-LabelImage::LabelImage(LabelWidget *labelWidget, const cv::Mat& image)
-    : parent(labelWidget)
+namespace
 {
-    qimage = mat_to_qimage_ref(image);
+
+// kinds of session journal records
+const quint8 RECORD_ACTION = 1;
+const quint8 RECORD_UNDO = 2;
+const quint8 RECORD_REDO = 3;
+
+// a compacted snapshot replaces the journal after this many records or this much time
+const int SNAPSHOT_RECORDS = 1000;
+const int AUTOSAVE_INTERVAL_MS = 30000;
+
+// time spent inserting edge items per event loop pass, keeps input and painting responsive
+const int INSERT_BUDGET_MS = 8;
+
+// what Qt and FLANN allocate behind an item or an indexed point, estimated from their sources:
+// the private data of a QGraphicsObject, a KD-tree node per point plus the copied point and index
+const size_t ITEM_PRIVATE_BYTES = 400;
+const size_t KDTREE_POINT_BYTES = 2*sizeof(float) + sizeof(int) + 48;
+
+// an edge is taken by a box or lasso when this share of its visible pixels is inside
+const double LASSO_COVERAGE = 0.9;
+
+// largest gap between the joined ends of two merged edges, in pixels
+const int MAX_MERGE_GAP = 10;
+
+AnnotationModel::EdgeEnd farEnd(AnnotationModel::EdgeEnd joined)
+{
+    return joined == AnnotationModel::HEAD ? AnnotationModel::TAIL : AnnotationModel::HEAD;
+}
+
+// pixels settled per live-wire pass while following the cursor, well within a frame
+const int WIRE_BUDGET = 150000;
+// half size of the live-wire search window, larger distances connect straight
+const int WIRE_RADIUS = 500;
+
+} //end of namespace
+
+LabelImage::LabelImage(LabelWidget *labelWidget, const ImageBuffer& image)
+    : buffer(image), parent(labelWidget)
+{
+    // shares the decoded pixels, the caller's cv::Mat may go out of scope
+    qimage = buffer.image();
+    imageSize = qimage.size();
+    failed = false;
     setZValue(-1);
     setAcceptHoverEvents(true);
 //    setCacheMode(ItemCoordinateCache);
@@ -20,66 +75,463 @@ LabelImage::LabelImage(LabelWidget *labelWidget, const cv::Mat& image)
     pCurrEdge = NULL;
     kdtree = NULL;
     radiusNN = 10;
-    maxActionListSize = 100;
+    // actions are a few dozen bytes, this keeps tens of thousands of steps
+    maxHistoryBytes = 4 << 20;
+    usedHistoryBytes = 0;
+    batchDepth = 0;
+    indexSuspended = 0;
+    insertPos = 0;
+    insertTimer = new QTimer(this);
+    insertTimer->setInterval(0);
+    connect(insertTimer, &QTimer::timeout, this, &LabelImage::insertChunk);
+    journal = NULL;
+    replaying = false;
+    recordsSinceSnapshot = 0;
+    autosaveTimer = new QTimer(this);
+    autosaveTimer->setInterval(AUTOSAVE_INTERVAL_MS);
+    connect(autosaveTimer, &QTimer::timeout, [this]() {
+        if (recordsSinceSnapshot > 0) snapshotSession();
+    });
     createMode = false;
-    pConnectPoint = NULL;
+    connectPoint = AnnotationModel::noPoint();
+    // child items, drawn above the image and below the edges
+    pRegions = new RegionLayer(this);
+    pConnections = new ConnectionLayer(this);
+    regionTimer = new QTimer(this);
+    regionTimer->setSingleShot(true);
+    regionTimer->setInterval(0);
+    connect(regionTimer, &QTimer::timeout, [this]() { pRegions->rebuild(); });
+
+    liveWireMode = false;
+    wirePreview = new QGraphicsPathItem(this);
+    wirePreview->setPen(QPen(Qt::green, 1));
+    wirePreview->setZValue(1);
+    wirePreview->hide();
+    lassoBox = false;
+    lassoPreview = new QGraphicsPathItem(this);
+    lassoPreview->setPen(QPen(Qt::white, 0, Qt::DashLine));
+    lassoPreview->setZValue(1);
+    lassoPreview->hide();
+    wireTimer = new QTimer(this);
+    wireTimer->setInterval(0);
+    connect(wireTimer, &QTimer::timeout, this, &LabelImage::continueLiveWire);
 }
 
 LabelImage::~LabelImage()
 {
+    if (loadJob) loadJob->cancel();
+    if (gradientJob) gradientJob->cancel();
+
+    if (journal) {
+        // compact on close, the closer thread waits for the writes, not the GUI thread
+        if (recordsSinceSnapshot > 0) snapshotSession();
+        SessionJournal::close(journal);
+        journal = NULL;
+    }
+
     if (kdtree) {
         delete kdtree;
         kdtree = NULL;
     }
-    ind2edge.clear();
-    global2local.clear();
     edgePoints.clear();
 
-    for (auto pEdge : pEdges)
+    for (auto pEdge : views)
         delete pEdge;
-    pEdges.clear();
+    views.clear();
+
+    for (auto pAction : actionList)
+        delete pAction;
+    actionList.clear();
+    for (auto pAction : redoList)
+        delete pAction;
+    redoList.clear();
+
+    for (auto stray : strayViews)
+        delete stray.second;
+    strayViews.clear();
 
     pCurrEdge = NULL;
 }
 
-void LabelImage::addEdges(const cv::Mat &image)
+void LabelImage::setPreview(const QString& imagePath, const QSize& size)
 {
-    std::vector<std::list<cv::Point>> edges;
-    ED::detectEdges(image, edges);
-    for (const auto &edge : edges){
-        if (edge.size() == 0) continue;
-        EdgeItem* item = new EdgeItem(this, edge);
-        pEdges.insert(item);
-        scene()->addItem(item);
-        item->setPos(item->center());
-        item->createEndPoints();
-    }
-    buildKD();
+    prepareGeometryChange();
+    previewOf = imagePath;
+    imageSize = size;
 }
 
-void LabelImage::buildKD()
+void LabelImage::addEdges(const AnnotationModel* detected)
 {
-    edgePoints.clear();
-    ind2edge.clear();
-    if (kdtree) delete(kdtree);
+    if (loadJob) loadJob->cancel();
+    loadJob = std::make_shared<EdgeDetectJob>(this, buffer, detected);
+    if (!previewOf.isEmpty())
+        loadJob->decodeFirst(previewOf);
+    loadJob->start([this](bool ok) { edgesDetected(ok); });
+}
 
-    for (auto pEdge : pEdges) {
-        edge2ind[pEdge] = edgePoints.size();
-        for (int i = 0; i < (int)pEdge->points().size(); i++){
-            auto point = pEdge->points()[i];
-            cv::Point2f curr(point.x()+0.5, point.y()+0.5);
-            edgePoints.push_back(curr);
-            ind2edge[edgePoints.size()-1] = pEdge;
-            global2local[edgePoints.size()-1] = i;
-            pointMask[edgePoints.size()-1] = true;
+bool LabelImage::loadingEdges() const
+{
+    return loadJob != NULL;
+}
+
+bool LabelImage::loadFailed() const
+{
+    return failed;
+}
+
+bool LabelImage::insertingEdges() const
+{
+    return insertTimer->isActive();
+}
+
+void LabelImage::edgesDetected(bool ok)
+{
+    std::shared_ptr<EdgeDetectJob> job = loadJob;
+    loadJob.reset();
+
+    if (!ok) {
+        // the preview stays without edges; the session is closed unwritten, so edits
+        // made on the preview cannot overwrite it and it is restored on the next open
+        qWarning() << "cannot decode" << previewOf;
+        failed = true;
+        pendingFlow = FlowPropagator();
+        closeSession();
+        emit decodeFailed(previewOf);
+        return;
+    }
+
+    // same pixels now with the luminance plane, or the full image replacing the preview
+    buffer = job->buffer();
+    if (!previewOf.isEmpty()) {
+        previewOf.clear();
+        qimage = buffer.image();
+        if (qimage.size() != imageSize) {
+            prepareGeometryChange();
+            imageSize = qimage.size();
+        }
+        update();
+    }
+
+    annotations = job->model();
+    if (liveWireMode) ensureGradient();
+    if (!pendingState.isEmpty()) {
+        QByteArray state;
+        state.swap(pendingState);
+        // the snapshot holds the edits made to these edges
+        if (!restoreSessionState(state)) {
+            // unreadable, or recorded over other edges; kept on disk, the edges start unedited
+            qWarning() << "cannot restore the session snapshot";
+            annotations = job->model();
+            closeSession();
+            emit sessionFailed();
+        }
+    }
+
+    rebuildViews();
+    if (annotations.hasBase()) {
+        // bridges of restored merges are not in the index, their pixels resolve through the merged edges
+        if (kdtree) delete kdtree;
+        kdtree = job->takeIndex(edgePoints);
+    } else {
+        // a full snapshot brings its own pool, the index of the job covers the detected edges only
+        buildKD();
+    }
+    for (const auto& connection : annotations.connectionList()) {
+        for (auto ref : {connection.first, connection.second}) {
+            if (ref.edge < 0) strayView(ref.id);
         }
+        pConnections->addConnection(connection.first, connection.second, connection.path);
+    }
+    scheduleRegions();
+
+    if (journal) replaySession();
+    if (!pendingFlow.empty()) {
+        applyFlow(pendingFlow);
+        pendingFlow = FlowPropagator();
+    }
+}
+
+void LabelImage::rebuildViews()
+{
+    for (auto pEdge : views)
+        delete pEdge;
+    views.assign(annotations.edgeCount(), NULL);
+    pCurrEdge = NULL;
+
+    // items are inserted from the event loop, the scene index is rebuilt once at the end
+    if (insertTimer->isActive())
+        resumeIndex();
+    insertQueue = insertionOrder();
+    insertPos = 0;
+    if (insertQueue.empty()) {
+        insertTimer->stop();
+        return;
+    }
+    suspendIndex();
+    insertTimer->start();
+}
+
+std::vector<int> LabelImage::insertionOrder()
+{
+    // edges in the viewport first, longest first, then the rest by distance to the viewport
+    QRectF visible = boundingRect();
+    if (scene()) {
+        QRectF sceneRect = parent->mapToScene(parent->viewport()->rect()).boundingRect();
+        visible = mapRectFromScene(sceneRect);
+    }
+    visible.moveTopLeft(item2image(visible.topLeft()));
+    QPointF center = visible.center();
+
+    std::vector<std::pair<std::pair<double, int>, int>> keys;
+    for (int id = 0; id < annotations.edgeCount(); id++) {
+        if (!annotations.edgeAlive(id)) continue;
+        cv::Rect r = annotations.boundingRect(id);
+        QRectF rect(r.x, r.y, r.width + 1, r.height + 1);
+        double distance = visible.intersects(rect) ? 0 : QLineF(center, rect.center()).length();
+        const AnnotationModel::Edge& e = annotations.edge(id);
+        keys.push_back(std::make_pair(std::make_pair(distance, -(e.tail - e.head)), id));
+    }
+    std::sort(keys.begin(), keys.end());
+
+    std::vector<int> order;
+    order.reserve(keys.size());
+    for (const auto& key : keys)
+        order.push_back(key.second);
+    return order;
+}
+
+void LabelImage::insertChunk()
+{
+    QElapsedTimer elapsed;
+    elapsed.start();
+    while (insertPos < insertQueue.size() && elapsed.elapsed() < INSERT_BUDGET_MS) {
+        int id = insertQueue[insertPos++];
+        // replayed edits may have split the edge or shown it already
+        if (!annotations.edgeAlive(id) || (views[id] && views[id]->scene())) continue;
+        showEdge(id);
+    }
+    if (insertPos < insertQueue.size()) return;
+
+    insertTimer->stop();
+    insertQueue.clear();
+    insertPos = 0;
+    resumeIndex();
+}
+
+void LabelImage::suspendIndex()
+{
+    if (indexSuspended++ > 0 || !scene()) return;
+    scene()->setItemIndexMethod(QGraphicsScene::NoIndex);
+}
+
+void LabelImage::resumeIndex()
+{
+    if (--indexSuspended > 0 || !scene()) return;
+    scene()->setItemIndexMethod(QGraphicsScene::BspTreeIndex);
+}
+
+void LabelImage::openSession(const QString& imagePath, const AnnotationModel* detected)
+{
+    journal = new SessionJournal(SessionJournal::sessionDirFor(imagePath));
+    journal->load(pendingState, pendingRecords);
+
+    // detection is deterministic: snapshots leave the detected edges out and are
+    // restored onto them, a journal without snapshot replays on fresh edges
+    addEdges(detected);
+}
+
+void LabelImage::closeSession()
+{
+    // nothing more is written, the files stay as they are for the next open
+    pendingState.clear();
+    pendingRecords.clear();
+    recordsSinceSnapshot = 0;
+    autosaveTimer->stop();
+    SessionJournal::close(journal);
+    journal = NULL;
+}
+
+void LabelImage::replaySession()
+{
+    replaying = true;
+    for (const auto& record : pendingRecords)
+        replayRecord(record);
+    replaying = false;
+
+    recordsSinceSnapshot = (int)pendingRecords.size();
+    pendingRecords.clear();
+    autosaveTimer->start();
+}
+
+void LabelImage::snapshotSession()
+{
+    if (!journal) return;
+    journal->snapshot(sessionState());
+    recordsSinceSnapshot = 0;
+}
+
+QByteArray LabelImage::sessionState() const
+{
+    QByteArray state;
+    QDataStream out(&state, QIODevice::WriteOnly);
+    out.setVersion(SessionState::STREAM_VERSION);
+    SessionState::writeModel(out, annotations);
+    out << (quint32)actionList.size();
+    for (auto it = actionList.rbegin(); it != actionList.rend(); it++)
+        (*it)->write(out);
+    out << (quint32)redoList.size();
+    for (auto act : redoList)
+        act->write(out);
+    return state;
+}
+
+void LabelImage::restoreSession(const QByteArray& state)
+{
+    // restored by edgesDetected() like a snapshot of the journal
+    pendingState = state;
+}
+
+bool LabelImage::restoreSessionState(const QByteArray& state)
+{
+    QDataStream in(state);
+    in.setVersion(SessionState::STREAM_VERSION);
+    if (!SessionState::readModel(in, annotations))
+        return false;
+
+    // history, oldest first so addAction restores the order
+    quint32 count;
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        Action* act = Action::read(this, in);
+        if (!act) break;
+        actionList.push_front(act);
+        usedHistoryBytes += act->byteSize();
+    }
+    in >> count;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+        Action* act = Action::read(this, in);
+        if (!act) break;
+        redoList.push_back(act);
+        usedHistoryBytes += act->byteSize();
     }
-    kdtree = new cv::flann::Index(cv::Mat(edgePoints).reshape(1), cv::flann::KDTreeIndexParams(1));
+    return true;
+}
+
+void LabelImage::journalRecord(quint8 kind, const Action* act)
+{
+    if (!journal || replaying) return;
+
+    QByteArray record;
+    QDataStream out(&record, QIODevice::WriteOnly);
+    out.setVersion(SessionState::STREAM_VERSION);
+    out << kind;
+    if (act) act->write(out);
+    journal->append(record);
 
+    if (++recordsSinceSnapshot >= SNAPSHOT_RECORDS)
+        snapshotSession();
+}
+
+void LabelImage::replayRecord(const QByteArray& record)
+{
+    QDataStream in(record);
+    in.setVersion(SessionState::STREAM_VERSION);
+    quint8 kind;
+    in >> kind;
+    if (kind == RECORD_ACTION) {
+        Action* act = Action::read(this, in);
+        if (!act) return;
+        act->perform();
+        addAction(act);
+    } else if (kind == RECORD_UNDO) {
+        reverseAction();
+    } else if (kind == RECORD_REDO) {
+        redoAction();
+    }
+}
+
+AnnotationModel& LabelImage::model()
+{
+    return annotations;
+}
+
+void LabelImage::sampleSelection(FlowPropagator& flow) const
+{
+    if (loadJob || buffer.luminance().empty()) return;
+    flow.sample(buffer.luminance(), annotations);
+}
+
+void LabelImage::propagate(const FlowPropagator& flow)
+{
+    if (flow.empty()) return;
+    if (loadingEdges())
+        pendingFlow = flow;
+    else
+        applyFlow(flow);
+}
+
+void LabelImage::applyFlow(const FlowPropagator& flow)
+{
+    if (!kdtree || buffer.luminance().empty()) return;
+
+    std::vector<FlowPropagator::Match> matches;
+    flow.track(buffer.luminance(), annotations, *kdtree, matches);
+
+    MacroAction* macro = new MacroAction(this);
+    for (const auto& match : matches) {
+        const AnnotationModel::Edge& e = annotations.edge(match.edge);
+        if (!e.selected) macro->add(new SelectEdge(this, match.edge, true));
+        if (match.head >= match.tail) continue;
+        // the end moving away first, head and tail may not cross on the way
+        std::vector<Action*> moves;
+        if (match.head != e.head)
+            moves.push_back(new EndPointMove(this, match.edge, AnnotationModel::HEAD, e.head, match.head));
+        if (match.tail != e.tail)
+            moves.push_back(new EndPointMove(this, match.edge, AnnotationModel::TAIL, e.tail, match.tail));
+        if (moves.size() == 2 && match.head >= e.tail) std::swap(moves[0], moves[1]);
+        for (auto act : moves)
+            macro->add(act);
+    }
+    commitMacro(macro);
+}
+
+EdgeItem* LabelImage::edgeView(int id)
+{
+    if (id >= (int)views.size())
+        views.resize(id+1, NULL);
+    if (!views[id])
+        views[id] = new EdgeItem(this, id);
+    return views[id];
+}
+
+void LabelImage::showEdge(int id)
+{
+    EdgeItem* item = edgeView(id);
+    scene()->addItem(item);
+    item->setPos(item->center());
+    item->createEndPoints();
+}
+
+void LabelImage::hideEdge(int id)
+{
+    // views are cheap to rebuild from the model, free them instead of keeping them for undo
+    if (id >= (int)views.size() || !views[id]) return;
+    EdgeItem* item = views[id];
+    if (pCurrEdge == item) pCurrEdge = NULL;
+    item->removeFromScene();
+    delete item;
+    views[id] = NULL;
+}
+
+void LabelImage::buildKD()
+{
+    if (kdtree) delete(kdtree);
+    kdtree = EdgeDetectJob::buildIndex(annotations, edgePoints);
 }
 
 void LabelImage::searchNN(const QPointF& pos, EdgeItem*& pEdge, int& localIndex)
 {
+    ProfileScope scope(Profiler::SEARCH_NN);
     pEdge = NULL;
 
     if (!kdtree) return;
@@ -91,12 +543,16 @@ void LabelImage::searchNN(const QPointF& pos, EdgeItem*& pEdge, int& localIndex)
     std::vector<int> indices;
     std::vector<float> dists;
     // search for points in the circle
-    kdtree->radiusSearch(query, indices, dists, pow(radiusNN,2), (int)(pow(radiusNN,2)*CV_PI));
+    int found = kdtree->radiusSearch(query, indices, dists, pow(radiusNN,2), (int)(pow(radiusNN,2)*CV_PI));
 
-    for (int i = 0; i < (int)indices.size(); i++) {
-        if (pointMask[indices[i]] && dists[i] > 0) {
-            pEdge = ind2edge[indices[i]];
-            localIndex = global2local[indices[i]];
+    for (int i = 0; i < std::min(found, (int)indices.size()); i++) {
+        int id, local;
+        if (!annotations.locatePixel(indices[i], id, local)) continue;
+        // not inserted into the scene yet
+        if (id >= (int)views.size() || !views[id] || !views[id]->scene()) continue;
+        if (annotations.pointVisible(id, local) && dists[i] > 0) {
+            pEdge = edgeView(id);
+            localIndex = local;
             break;
         }
     }
@@ -109,45 +565,27 @@ void LabelImage::searchNN(const QPointF& pos, EdgeItem*& pEdge)
     searchNN(pos, pEdge, temp);
 }
 
-void LabelImage::updateNNMask(EdgeItem* pEdge)
-{
-    for (int i = 0; i < (int)pEdge->points().size(); i++) {
-        if (pEdge->pointVisible(i)) {
-            pointMask[edge2ind[pEdge]+i] = true;
-        } else {
-            pointMask[edge2ind[pEdge]+i] = false;
-        }
-    }
-}
-
 QRectF LabelImage::boundingRect() const
 {
-    return QRectF(-qimage.width()/2.0, -qimage.height()/2.0, qimage.width(), qimage.height());
+    return QRectF(-imageSize.width()/2.0, -imageSize.height()/2.0, imageSize.width(), imageSize.height());
 }
 
 void LabelImage::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
 {
     Q_UNUSED(option);
+    ProfileScope scope(Profiler::IMAGE_PAINT);
 
-    QRectF target(-qimage.width()/2.0, -qimage.height()/2.0, qimage.width(), qimage.height());
+    // a preview is smaller than the image and scaled up to its full size
+    QRectF target = boundingRect();
     QRectF source(0.0, 0.0, qimage.width(), qimage.height());
 
     painter->drawImage(target, qimage, source);
-
-    // paint connections
-    QPainterPath path;
-    for (int i = 0; i < (int)connections.size(); i++) {
-        QVector<QPointF> points;
-        points.push_back(connections[i].first->pos());
-        points.push_back(connections[i].second->pos());
-//        QLineF line = QLineF(connections[i].first->pos(), connections[i].second->pos());
-        path.addPolygon(QPolygonF(points));
-    }
-    painter->drawPath(path);
 }
 
 void LabelImage::hoverMoveEvent(QGraphicsSceneHoverEvent *event)
 {
+    ProfileScope scope(Profiler::HOVER_MOVE);
+    Profiler::mark(Profiler::HOVER_TO_PAINT);
     QPointF lastPos = item2image(event->lastPos());
     EdgeItem* prev;
     searchNN(lastPos, prev);
@@ -158,6 +596,7 @@ void LabelImage::hoverMoveEvent(QGraphicsSceneHoverEvent *event)
     if(prev && prev != curr) prev->hoverLeave();
     pCurrEdge = curr;
     if(curr) curr->hoverEnter(pos, localIndex);
+    updateLiveWire(event->pos());
     QGraphicsObject::hoverMoveEvent(event);
 }
 
@@ -179,24 +618,89 @@ void LabelImage::hoverLeaveEvent(QGraphicsSceneHoverEvent *event)
     searchNN(lastPos, prev);
     pCurrEdge = NULL;
     if(prev) prev->hoverLeave();
+    hideLiveWire();
     QGraphicsObject::hoverLeaveEvent(event);
 }
 
 void LabelImage::mousePressEvent(QGraphicsSceneMouseEvent *event)
 {
+    if (event->button() == Qt::LeftButton && !createMode
+            && (event->modifiers() & (Qt::ShiftModifier | Qt::ControlModifier))) {
+        // accepting the press delivers the moves and the release of the drag to this item
+        lassoBox = event->modifiers() & Qt::ShiftModifier;
+        lasso.clear();
+        lasso << event->pos();
+        event->accept();
+        return;
+    }
+
     // TODO: NN for endpoints in createMode
-    if (createMode && pConnectPoint) {
-        Action* act = new ConnectPoint(this, pConnectPoint, NULL, event->pos());
+    if (createMode && connectPoint.valid()) {
+        ConnectPoint* act = new ConnectPoint(this, connectPoint, AnnotationModel::noPoint(), event->pos(),
+                                             liveWirePath(event->pos()));
         act->perform();
         addAction(act);
+        // a traced outline continues from the new point
+        if (liveWireMode) updateConnectPoint(act->target());
     } else if (!createMode && pCurrEdge) {
-        Action* act = new SelectEdge(pCurrEdge);
+        Action* act = new SelectEdge(this, pCurrEdge->id());
         act->perform();
         addAction(act);
     }
     QGraphicsObject::mousePressEvent(event);
 }
 
+void LabelImage::mouseMoveEvent(QGraphicsSceneMouseEvent *event)
+{
+    if (lasso.isEmpty()) {
+        QGraphicsObject::mouseMoveEvent(event);
+        return;
+    }
+
+    QPointF pos = event->pos();
+    if (lassoBox) {
+        QPointF start = lasso.first();
+        lasso.clear();
+        lasso << start << QPointF(pos.x(), start.y()) << pos << QPointF(start.x(), pos.y());
+    } else if (QLineF(lasso.last(), pos).length() >= 1) {
+        // freehand, one vertex per pixel moved at most
+        lasso << pos;
+    }
+
+    QPainterPath path;
+    path.addPolygon(lasso);
+    path.closeSubpath();
+    lassoPreview->setPath(path);
+    lassoPreview->show();
+}
+
+void LabelImage::mouseReleaseEvent(QGraphicsSceneMouseEvent *event)
+{
+    if (lasso.isEmpty()) {
+        QGraphicsObject::mouseReleaseEvent(event);
+        return;
+    }
+
+    std::vector<cv::Point2f> polygon;
+    polygon.reserve(lasso.size());
+    for (const auto& p : lasso) {
+        QPointF imagePos = item2image(p);
+        polygon.push_back(cv::Point2f(imagePos.x(), imagePos.y()));
+    }
+    lasso.clear();
+    lassoPreview->hide();
+
+    // one macro action for the whole selection
+    if (polygon.size() >= 3)
+        selectEdges(edgesInPolygon(polygon), !(event->modifiers() & Qt::AltModifier));
+}
+
+std::vector<int> LabelImage::edgesInPolygon(const std::vector<cv::Point2f>& polygon)
+{
+    cv::Rect image(0, 0, imageSize.width(), imageSize.height());
+    return RegionBuilder::edgesInPolygon(annotations, polygon, image, LASSO_COVERAGE);
+}
+
 QPointF LabelImage::image2item(const QPointF &pos)
 {
     return pos + boundingRect().topLeft();
@@ -215,93 +719,218 @@ EdgeItem* LabelImage::currEdge()
 void LabelImage::splitEdge()
 {
     if (pCurrEdge && pCurrEdge->showingSplit()) {
-        SplitEdge* pAction = new SplitEdge(this, pCurrEdge);
+        SplitEdge* pAction = new SplitEdge(this, pCurrEdge->id(), pCurrEdge->splitPosition());
         pAction->perform();
         addAction(pAction);
         pCurrEdge = NULL;
     }
 }
 
-void LabelImage::performSplitEdge(EdgeItem* oldEdge, EdgeItem* newEdge1, EdgeItem* newEdge2)
+bool LabelImage::performSplitEdge(int oldEdge, int splitIndex, int& newEdge1, int& newEdge2)
 {
-    scene()->addItem(newEdge1);
-    newEdge1->setPos(newEdge1->center());
-    newEdge1->createEndPoints(oldEdge->head()->indexOnEdge(), (int)(newEdge1->points().size())-1);
+    // the model keeps the pixels in place, the parent only records its children
+    if (!annotations.splitEdge(oldEdge, splitIndex, newEdge1, newEdge2)) return false;
+    moveConnections(AnnotationModel::endRef(oldEdge, AnnotationModel::HEAD),
+                    AnnotationModel::endRef(newEdge1, AnnotationModel::HEAD));
+    moveConnections(AnnotationModel::endRef(oldEdge, AnnotationModel::TAIL),
+                    AnnotationModel::endRef(newEdge2, AnnotationModel::TAIL));
 
-    scene()->addItem(newEdge2);
-    newEdge2->setPos(newEdge2->center());
-    newEdge2->createEndPoints(0, oldEdge->tail()->indexOnEdge() - (int)(newEdge1->points().size()));
+    hideEdge(oldEdge);
+    showEdge(newEdge1);
+    showEdge(newEdge2);
+    scheduleRegions();
+    return true;
+}
+
+void LabelImage::reverseSplitEdge(int oldEdge, int newEdge1, int newEdge2)
+{
+    annotations.unsplitEdge(oldEdge, newEdge1, newEdge2);
+    moveConnections(AnnotationModel::endRef(newEdge1, AnnotationModel::HEAD),
+                    AnnotationModel::endRef(oldEdge, AnnotationModel::HEAD));
+    moveConnections(AnnotationModel::endRef(newEdge2, AnnotationModel::TAIL),
+                    AnnotationModel::endRef(oldEdge, AnnotationModel::TAIL));
 
-    // update pEdges
-    pEdges.erase(oldEdge);
-    pEdges.insert(newEdge1);
-    pEdges.insert(newEdge2);
+    hideEdge(newEdge1);
+    hideEdge(newEdge2);
+    showEdge(oldEdge);
+    scheduleRegions();
+}
+
+void LabelImage::mergeSelected()
+{
+    std::vector<int> selected;
+    for (int id = 0; id < annotations.edgeCount(); id++) {
+        if (annotations.edgeAlive(id) && annotations.edge(id).selected) selected.push_back(id);
+    }
+    if (selected.size() != 2) return;
 
-    // update ind2edge and global2local
-    for (int i = 0; i < (int)(oldEdge->points().size()); i++){
-        if (i < (int)(newEdge1->points().size())){
-            ind2edge[edge2ind[oldEdge]+i] = newEdge1;
-        } else {
-            ind2edge[edge2ind[oldEdge]+i] = newEdge2;
-            global2local[edge2ind[oldEdge]+i] = i - (int)(newEdge1->points().size());
+    // the closest pair of visible ends is joined
+    int best = -1;
+    int bestGap = MAX_MERGE_GAP + 1;
+    for (int i = 0; i < 4; i++) {
+        AnnotationModel::EdgeEnd end1 = (AnnotationModel::EdgeEnd)(i / 2);
+        AnnotationModel::EdgeEnd end2 = (AnnotationModel::EdgeEnd)(i % 2);
+        cv::Point d = annotations.point(selected[0], annotations.endIndex(selected[0], end1))
+                - annotations.point(selected[1], annotations.endIndex(selected[1], end2));
+        int gap = std::max(std::abs(d.x), std::abs(d.y));
+        if (gap < bestGap) {
+            bestGap = gap;
+            best = i;
         }
     }
+    if (best < 0) return;
 
-    // update edge2ind
-    edge2ind[newEdge1] = edge2ind[oldEdge];
-    edge2ind[newEdge2] = edge2ind[oldEdge] + (int)(newEdge1->points().size());
-    edge2ind.erase(oldEdge);
+    Action* act = new MergeEdges(this, selected[0], (AnnotationModel::EdgeEnd)(best / 2),
+                                 selected[1], (AnnotationModel::EdgeEnd)(best % 2));
+    act->perform();
+    addAction(act);
+}
+
+bool LabelImage::performMergeEdges(int edge1, AnnotationModel::EdgeEnd end1, int edge2, AnnotationModel::EdgeEnd end2,
+                                   int& merged, int& bridge)
+{
+    // constant work in the model, the kd-tree keeps resolving pixels through the merge records
+    if (!annotations.mergeEdges(edge1, end1, edge2, end2, merged, bridge)) return false;
+    // the far ends live on as the ends of the merged edge, the joined ends keep their connections
+    moveConnections(AnnotationModel::endRef(edge1, farEnd(end1)), AnnotationModel::endRef(merged, AnnotationModel::HEAD));
+    moveConnections(AnnotationModel::endRef(edge2, farEnd(end2)), AnnotationModel::endRef(merged, AnnotationModel::TAIL));
 
-    // remove old edge, keep it in memory in case of reverse action
-    oldEdge->hoverLeave();
-    oldEdge->removeFromScene();
+    hideEdge(edge1);
+    hideEdge(edge2);
+    showEdge(merged);
+    if (annotations.edge(merged).selected) edgeView(merged)->select();
+    scheduleRegions();
+    return true;
 }
 
-void LabelImage::reverseSplitEdge(EdgeItem* oldEdge, EdgeItem* newEdge1, EdgeItem* newEdge2)
+void LabelImage::reverseMergeEdges(int edge1, AnnotationModel::EdgeEnd end1, int edge2, AnnotationModel::EdgeEnd end2,
+                                   int merged)
 {
-    scene()->addItem(oldEdge);
-    oldEdge->setPos(oldEdge->center());
-    oldEdge->createEndPoints(newEdge1->head()->indexOnEdge(),
-                             (int)(newEdge1->points().size()) + newEdge2->tail()->indexOnEdge());
+    annotations.unmergeEdges(edge1, edge2, merged);
+    moveConnections(AnnotationModel::endRef(merged, AnnotationModel::HEAD), AnnotationModel::endRef(edge1, farEnd(end1)));
+    moveConnections(AnnotationModel::endRef(merged, AnnotationModel::TAIL), AnnotationModel::endRef(edge2, farEnd(end2)));
 
-    // update pEdges
-    pEdges.erase(newEdge1);
-    pEdges.erase(newEdge2);
-    pEdges.insert(oldEdge);
+    hideEdge(merged);
+    for (int id : {edge1, edge2}) {
+        showEdge(id);
+        if (annotations.edge(id).selected) edgeView(id)->select();
+    }
+    scheduleRegions();
+}
 
-    // update ind2edge and global2local
-    for (int i = 0; i < (int)(newEdge1->points().size()); i++) {
-        ind2edge[edge2ind[newEdge1]+i] = oldEdge;
+void LabelImage::moveConnections(const AnnotationModel::PointRef& from, const AnnotationModel::PointRef& to)
+{
+    // the layer keys segments by their points, they are readded under the new one
+    std::vector<AnnotationModel::Connection> moved;
+    for (const auto& connection : annotations.connectionList()) {
+        if (connection.first == from || connection.second == from) moved.push_back(connection);
+    }
+    if (moved.empty()) return;
+
+    annotations.moveConnections(from, to);
+    for (auto& connection : moved) {
+        pConnections->removeConnection(connection.first, connection.second);
+        if (connection.first == from) connection.first = to;
+        if (connection.second == from) connection.second = to;
+        pConnections->addConnection(connection.first, connection.second, connection.path);
     }
-    for (int i = 0; i < (int)(newEdge2->points().size()); i++) {
-        ind2edge[edge2ind[newEdge2]+i] = oldEdge;
-        global2local[edge2ind[newEdge2]+i] = i + (int)(newEdge1->points().size());
+}
+
+void LabelImage::moveEndPoint(int edgeId, AnnotationModel::EdgeEnd end, int index)
+{
+    if (!annotations.edgeAlive(edgeId)) return;
+    EdgeItem* view = edgeView(edgeId);
+    EndPoint* point = end == AnnotationModel::HEAD ? view->head() : view->tail();
+    if (point) {
+        point->moveTo(index);
+    } else if (annotations.canMoveEnd(edgeId, end, index)) {
+        annotations.setEndIndex(edgeId, end, index);
+        pRegions->pointMoved(AnnotationModel::endRef(edgeId, end));
     }
+    view->blink();
+}
 
-    // update edge2ind
-    edge2ind[oldEdge] = edge2ind[newEdge1];
-    edge2ind.erase(newEdge1);
-    edge2ind.erase(newEdge2);
+void LabelImage::selectEdge(int edgeId, bool select)
+{
+    if (!annotations.edgeAlive(edgeId)) return;
+    if (select)
+        edgeView(edgeId)->select();
+    else
+        edgeView(edgeId)->unselect();
+    scheduleRegions();
+}
 
-    // remove edge but keep in memory
-    newEdge1->hoverLeave();
-    newEdge2->hoverLeave();
-    newEdge1->removeFromScene();
-    newEdge2->removeFromScene();
+void LabelImage::blinkEdge(int edgeId)
+{
+    if (batchDepth > 0) {
+        pendingBlinks.push_back(edgeId);
+        return;
+    }
+    if (edgeId < (int)views.size() && views[edgeId])
+        views[edgeId]->blink();
+}
+
+void LabelImage::selectEdges(const std::vector<int>& edgeIds, bool select)
+{
+    MacroAction* macro = new MacroAction(this);
+    for (int id : edgeIds) {
+        if (!annotations.edgeAlive(id) || annotations.edge(id).selected == select) continue;
+        macro->add(new SelectEdge(this, id, select));
+    }
+    commitMacro(macro);
+}
+
+void LabelImage::beginBatch(bool items)
+{
+    // one index rebuild for items added or removed, rebuilding it for a selection would cost more than it saves
+    if (items) suspendIndex();
+    if (batchDepth++ > 0) return;
+
+    // one repaint for the whole batch
+    parent->setUpdatesEnabled(false);
+}
+
+void LabelImage::endBatch(bool items)
+{
+    if (items) resumeIndex();
+    if (--batchDepth > 0) return;
+
+    // re-enabling updates schedules a single repaint of the view
+    parent->setUpdatesEnabled(true);
+
+    // blinking hundreds of edges only costs timelines, keep it for small batches
+    const int maxBlinks = 16;
+    if ((int)pendingBlinks.size() <= maxBlinks) {
+        for (int id : pendingBlinks)
+            blinkEdge(id);
+    }
+    pendingBlinks.clear();
+}
+
+bool LabelImage::inBatch() const
+{
+    return batchDepth > 0;
 }
 
 void LabelImage::addAction(Action* act)
 {
-    if (actionList.size() >= maxActionListSize) {
+    for (auto pAction : redoList) {
+        usedHistoryBytes -= pAction->byteSize();
+        delete pAction;
+    }
+    redoList.clear();
+
+    actionList.push_front(act);
+    usedHistoryBytes += act->byteSize();
+    journalRecord(RECORD_ACTION, act);
+
+    // drop the oldest steps once over budget
+    while (usedHistoryBytes > maxHistoryBytes && actionList.size() > 1) {
         Action* temp = actionList.back();
         actionList.pop_back();
+        usedHistoryBytes -= temp->byteSize();
         delete temp;
     }
-    actionList.push_front(act);
-
-    for (auto pAction : redoList)
-        delete pAction;
-    redoList.clear();
 }
 
 void LabelImage::reverseAction()
@@ -311,6 +940,7 @@ void LabelImage::reverseAction()
         act->reverse();
         actionList.pop_front();
         redoList.push_back(act);
+        journalRecord(RECORD_UNDO, NULL);
     }
 }
 
@@ -321,7 +951,74 @@ void LabelImage::redoAction()
         act->perform();
         redoList.pop_back();
         actionList.push_front(act);
+        journalRecord(RECORD_REDO, NULL);
+    }
+}
+
+void LabelImage::commitMacro(MacroAction* macro)
+{
+    if (macro->empty()) {
+        delete macro;
+        return;
+    }
+    macro->perform();
+    addAction(macro);
+}
+
+size_t LabelImage::historyBytes() const
+{
+    return usedHistoryBytes;
+}
+
+void LabelImage::memoryReport(MemoryReport& report) const
+{
+    report.add(MemoryReport::EDGES, "annotation model", annotations.memoryBytes(), annotations.edgeCount());
+    report.add(MemoryReport::EDGES, "edge queues", (insertQueue.capacity() + pendingBlinks.capacity())*sizeof(int));
+
+    report.add(MemoryReport::SPATIAL_INDEX, "kd-tree points", edgePoints.capacity()*sizeof(cv::Point2f),
+               edgePoints.size());
+    if (kdtree)
+        report.add(MemoryReport::SPATIAL_INDEX, "kd-tree (estimate)", edgePoints.size()*KDTREE_POINT_BYTES);
+
+    // qimage is a view of the buffer's display plane, counted with the buffer
+    report.add(MemoryReport::IMAGE_BUFFERS, "image buffer", buffer.memoryBytes());
+    report.add(MemoryReport::IMAGE_BUFFERS, "gradient planes",
+               gradM.total()*gradM.elemSize() + gradO.total()*gradO.elemSize());
+
+    size_t pending = pendingState.size();
+    for (const auto& record : pendingRecords)
+        pending += record.size();
+    report.add(MemoryReport::UNDO_HISTORY, "undo and redo actions", usedHistoryBytes,
+               actionList.size() + redoList.size());
+    report.add(MemoryReport::UNDO_HISTORY, "unjournaled records", pending, pendingRecords.size());
+
+    // hidden endpoints stay allocated with their edge, blink timelines delete themselves when done
+    size_t edgeItems = 0, endPoints = 0, timeLines = 0;
+    for (const auto item : views) {
+        if (!item) continue;
+        edgeItems++;
+        if (item->head()) endPoints++;
+        if (item->tail()) endPoints++;
+        timeLines += item->findChildren<QTimeLine*>().size();
     }
+    report.add(MemoryReport::SCENE_ITEMS, "edge items", edgeItems*(sizeof(EdgeItem) + ITEM_PRIVATE_BYTES)
+               + views.capacity()*sizeof(EdgeItem*), edgeItems);
+    report.add(MemoryReport::SCENE_ITEMS, "endpoints", endPoints*(sizeof(EndPoint) + ITEM_PRIVATE_BYTES),
+               endPoints);
+    report.add(MemoryReport::SCENE_ITEMS, "stray points", strayViews.size()*(sizeof(EndPoint) + ITEM_PRIVATE_BYTES),
+               strayViews.size());
+    report.add(MemoryReport::SCENE_ITEMS, "blink timelines", timeLines*(sizeof(QTimeLine) + ITEM_PRIVATE_BYTES),
+               timeLines);
+    report.add(MemoryReport::SCENE_ITEMS, "connections", pConnections->memoryBytes(),
+               pConnections->connectionCount());
+
+    report.add(MemoryReport::CACHES, "regions and masks", pRegions->memoryBytes(), pRegions->regionCount());
+    report.add(MemoryReport::CACHES, "live-wire search", liveWire.memoryBytes());
+}
+
+void LabelImage::setHistoryBudget(size_t bytes)
+{
+    maxHistoryBytes = bytes;
 }
 
 void LabelImage::toggleCreateMode()
@@ -345,45 +1042,175 @@ void LabelImage::enterCreateMode()
 void LabelImage::exitCreateMode()
 {
     createMode = false;
+    connectPoint = AnnotationModel::noPoint();
+    hideLiveWire();
 }
 
-void LabelImage::addStrayPoint(EndPoint* point)
+AnnotationModel::PointRef LabelImage::createStrayPoint(const QPointF& pos, int id)
 {
-    pStrayPoints.insert(point);
+    QPointF imagePos = item2image(pos);
+    id = annotations.addStrayPoint(cv::Point2f(imagePos.x(), imagePos.y()), id);
+    strayView(id);
+    return AnnotationModel::strayRef(id);
 }
 
-void LabelImage::removeStrayPoint(EndPoint* point)
+EndPoint* LabelImage::strayView(int id)
 {
-    pStrayPoints.erase(point);
+    auto it = strayViews.find(id);
+    if (it != strayViews.end()) return it->second;
+
+    // stray points have no edge to show them on hover, they stay visible
+    EndPoint* view = new EndPoint(this, id);
+    if (scene()) scene()->addItem(view);
+    view->setVisible(true);
+    strayViews[id] = view;
+    return view;
 }
 
-void LabelImage::addConnection(EndPoint* point1, EndPoint* point2)
+void LabelImage::removeStrayPoint(int id)
 {
-    connections.emplace_back(point1, point2);
-//    std::make_pair<EndPoint*,EndPoint*>(
+    annotations.removeStrayPoint(id);
+    auto it = strayViews.find(id);
+    if (it != strayViews.end()) {
+        delete it->second;
+        strayViews.erase(it);
+    }
 }
 
-void LabelImage::removeConnection(EndPoint* point1, EndPoint* point2)
+void LabelImage::addConnection(AnnotationModel::PointRef point1, AnnotationModel::PointRef point2,
+                               const std::vector<cv::Point>& path)
 {
-    for (auto it = connections.begin(); it != connections.end(); it++) {
-        if (it->first == point1 && it->second == point2) {
-            connections.erase(it);
-            return;
-        }
-    }
+    annotations.addConnection(point1, point2, path);
+    pConnections->addConnection(point1, point2, path);
+    scheduleRegions();
 }
 
-EndPoint* LabelImage::getConnectPoint()
+void LabelImage::removeConnection(AnnotationModel::PointRef point1, AnnotationModel::PointRef point2)
 {
-    return pConnectPoint;
+    annotations.removeConnection(point1, point2);
+    pConnections->removeConnection(point1, point2);
+    scheduleRegions();
 }
 
-void LabelImage::updateConnectPoint(EndPoint* point)
+void LabelImage::updateConnections(EndPoint* point)
 {
-    pConnectPoint = point;
+    pConnections->pointMoved(point->ref());
+    // a pending rebuild walks every region anyway, views being created have not moved
+    if (!regionTimer->isActive() && point->scene()) pRegions->pointMoved(point->ref());
 }
 
+void LabelImage::scheduleRegions()
+{
+    regionTimer->start();
+}
 
+AnnotationModel::PointRef LabelImage::getConnectPoint()
+{
+    return connectPoint;
+}
+
+void LabelImage::updateConnectPoint(AnnotationModel::PointRef point)
+{
+    connectPoint = point;
+    if (!point.valid()) hideLiveWire();
+}
+
+void LabelImage::toggleLiveWire()
+{
+    liveWireMode = !liveWireMode;
+    if (liveWireMode) ensureGradient();
+    else hideLiveWire();
+}
+
+bool LabelImage::inLiveWireMode() const
+{
+    return liveWireMode;
+}
 
+bool LabelImage::ensureGradient()
+{
+    if (liveWire.hasGradient()) return true;
+    if (loadingEdges() || gradientJob || buffer.empty()) return false;
 
+    // 3 bytes per pixel, only computed once the live-wire is used on this image
+    gradientJob = std::make_shared<EdgeDetectJob>(this, buffer);
+    gradientJob->gradientOnly();
+    gradientJob->start([this](bool) {
+        std::shared_ptr<EdgeDetectJob> job = gradientJob;
+        gradientJob.reset();
+        gradM = job->magnitude();
+        gradO = job->orientation();
+        liveWire.setGradient(gradM, gradO);
+    });
+    return false;
+}
+
+bool LabelImage::seedLiveWire()
+{
+    if (!liveWireMode || !connectPoint.valid() || !ensureGradient()) return false;
 
+    // the search is only restarted when the anchor changes
+    cv::Point2f anchor = annotations.position(connectPoint);
+    cv::Point seed(cvFloor(anchor.x), cvFloor(anchor.y));
+    if (!liveWire.hasSeed() || liveWire.seed() != seed)
+        liveWire.setSeed(seed, WIRE_RADIUS);
+    return true;
+}
+
+void LabelImage::updateLiveWire(const QPointF& pos)
+{
+    if (!createMode || !seedLiveWire()) {
+        hideLiveWire();
+        return;
+    }
+
+    QPointF imagePos = item2image(pos);
+    wireTarget = cv::Point(cvFloor(imagePos.x()), cvFloor(imagePos.y()));
+    continueLiveWire();
+}
+
+void LabelImage::continueLiveWire()
+{
+    std::vector<cv::Point> path;
+    if (!liveWire.inWindow(wireTarget)) {
+        hideLiveWire();
+        return;
+    }
+    if (!liveWire.pathTo(wireTarget, path, WIRE_BUDGET)) {
+        // the settled area is kept, the next pass continues where this one stopped
+        wireTimer->start();
+        return;
+    }
+    wireTimer->stop();
+
+    QPainterPath line;
+    for (size_t i = 0; i < path.size(); i++) {
+        QPointF p = image2item(QPointF(path[i].x + 0.5, path[i].y + 0.5));
+        if (i == 0) line.moveTo(p);
+        else line.lineTo(p);
+    }
+    wirePreview->setPath(line);
+    wirePreview->show();
+}
+
+void LabelImage::hideLiveWire()
+{
+    wireTimer->stop();
+    wirePreview->hide();
+}
+
+std::vector<cv::Point> LabelImage::liveWirePath(const QPointF& pos)
+{
+    std::vector<cv::Point> path;
+    if (!seedLiveWire()) return path;
+
+    QPointF imagePos = item2image(pos);
+    cv::Point target(cvFloor(imagePos.x()), cvFloor(imagePos.y()));
+    // a click finishes the search regardless of the budget
+    if (!liveWire.pathTo(target, path)) return std::vector<cv::Point>();
+
+    hideLiveWire();
+    // the ends are the points themselves
+    if (path.size() <= 2) return std::vector<cv::Point>();
+    return std::vector<cv::Point>(path.begin() + 1, path.end() - 1);
+}
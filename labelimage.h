@@ -3,50 +3,121 @@
 
 #include <QGraphicsObject>
 #include <QImage>
+#include <QPolygonF>
 #include "labelwidget.h"
-#include <set>
+#include "imagebuffer.h"
+#include "annotationmodel.h"
+#include "livewire.h"
+#include "flowpropagator.h"
+#include <map>
+#include <memory>
 #include <opencv2/flann/miniflann.hpp>
 
 class EndPoint;
 class Action;
+class MacroAction;
+class ConnectionLayer;
+class RegionLayer;
+class SessionJournal;
+class EdgeDetectJob;
+class QTimer;
+class QGraphicsPathItem;
+class MemoryReport;
 
 class LabelImage : public QGraphicsObject
 {
     Q_OBJECT
 public:
-    LabelImage(LabelWidget *labelWidget, const cv::Mat& image);
+    LabelImage(LabelWidget *labelWidget, const ImageBuffer& image);
     ~LabelImage();
 
-    void addEdges(const cv::Mat& image);
+    // detects edges on a worker, or takes the ones detected ahead of time if given;
+    // the image is shown meanwhile and the edges are inserted once they are ready
+    void addEdges(const AnnotationModel* detected = NULL);
+    bool loadingEdges() const;
+    // the full image of a preview could not be decoded, only the preview is shown
+    bool loadFailed() const;
+    // edge items are still being added to the scene from the event loop
+    bool insertingEdges() const;
+
+    // the buffer is a reduced decode of imagePath, shown scaled to size until
+    // the full image is decoded in the background along with the edges
+    void setPreview(const QString& imagePath, const QSize& size);
+
+    // restores the session stored next to the image, falls back to addEdges(detected)
+    void openSession(const QString& imagePath, const AnnotationModel* detected = NULL);
+    void snapshotSession();
+    // the edits over the detected edges and the undo history
+    QByteArray sessionState() const;
+    // restores a sessionState() without journaling it, call before the edges are detected
+    void restoreSession(const QByteArray& state);
+    AnnotationModel& model();
+
+    // video: samples the selected edges of this frame, then tracks them into the next
+    // frame's image and selects and trims the edges they land on, as one undoable step
+    void sampleSelection(FlowPropagator& flow) const;
+    void propagate(const FlowPropagator& flow);
+    EdgeItem* edgeView(int id);
 
     void buildKD();
     void searchNN(const QPointF& pos, EdgeItem*& pEdge, int& localIndex);
     void searchNN(const QPointF& pos, EdgeItem*& pEdge);
 
-    void updateNNMask(EdgeItem* pEdge);
-
     QPointF item2image(const QPointF& pos);
     QPointF image2item(const QPointF& pos);
 
     EdgeItem* currEdge();
     void splitEdge();
-    void performSplitEdge(EdgeItem* oldEdge, EdgeItem* newEdge1, EdgeItem* newEdge2);
-    void reverseSplitEdge(EdgeItem* oldEdge, EdgeItem* newEdge1, EdgeItem* newEdge2);
+    bool performSplitEdge(int oldEdge, int splitIndex, int& newEdge1, int& newEdge2);
+    void reverseSplitEdge(int oldEdge, int newEdge1, int newEdge2);
+    // joins the two selected edges at their closest ends, if those are close enough
+    void mergeSelected();
+    bool performMergeEdges(int edge1, AnnotationModel::EdgeEnd end1, int edge2, AnnotationModel::EdgeEnd end2,
+                           int& merged, int& bridge);
+    void reverseMergeEdges(int edge1, AnnotationModel::EdgeEnd end1, int edge2, AnnotationModel::EdgeEnd end2,
+                           int merged);
+    void moveEndPoint(int edgeId, AnnotationModel::EdgeEnd end, int index);
+    void selectEdge(int edgeId, bool select);
+    void blinkEdge(int edgeId);
+
+    void selectEdges(const std::vector<int>& edgeIds, bool select);
+    // alive edges with most of their visible pixels inside the polygon (image coordinates)
+    std::vector<int> edgesInPolygon(const std::vector<cv::Point2f>& polygon);
+
+    // with items the scene index is suspended until the batch ends
+    void beginBatch(bool items = false);
+    void endBatch(bool items = false);
+    bool inBatch() const;
 
     void addAction(Action* act);
+    void commitMacro(MacroAction* macro);
     void reverseAction();
     void redoAction();
+    size_t historyBytes() const;
+    void setHistoryBudget(size_t bytes);
+    // live bytes of the edges, index, image planes, history, scene items and caches of this image
+    void memoryReport(MemoryReport& report) const;
 
     void toggleCreateMode();
     bool inCreateMode();
     void enterCreateMode();
     void exitCreateMode();
-    void addStrayPoint(EndPoint* point);
-    void removeStrayPoint(EndPoint* point);
-    void addConnection(EndPoint* point1, EndPoint* point2);
-    void removeConnection(EndPoint* point1, EndPoint* point2);
-    EndPoint* getConnectPoint();
-    void updateConnectPoint(EndPoint* point);
+    AnnotationModel::PointRef createStrayPoint(const QPointF& pos, int id = -1);
+    void removeStrayPoint(int id);
+    void addConnection(AnnotationModel::PointRef point1, AnnotationModel::PointRef point2,
+                       const std::vector<cv::Point>& path = std::vector<cv::Point>());
+    void removeConnection(AnnotationModel::PointRef point1, AnnotationModel::PointRef point2);
+    void updateConnections(EndPoint* point);
+    AnnotationModel::PointRef getConnectPoint();
+    void updateConnectPoint(AnnotationModel::PointRef point);
+    // regions are rebuilt once per event loop pass, however many edits came in
+    void scheduleRegions();
+
+    // connections from the connect point follow the minimum cost path over the gradient
+    void toggleLiveWire();
+    bool inLiveWireMode() const;
+    // pixels strictly between the connect point and pos (item coordinates), empty for a straight segment
+    std::vector<cv::Point> liveWirePath(const QPointF& pos);
 
 
     QRectF boundingRect() const override;
@@ -56,34 +127,114 @@ public:
     void hoverEnterEvent(QGraphicsSceneHoverEvent *event) override;
     void hoverLeaveEvent(QGraphicsSceneHoverEvent *event) override;
 
+    // Shift+drag selects the edges in a box, Ctrl+drag in a freehand lasso, with Alt they are deselected
     void mousePressEvent(QGraphicsSceneMouseEvent *event) override;
+    void mouseMoveEvent(QGraphicsSceneMouseEvent *event) override;
+    void mouseReleaseEvent(QGraphicsSceneMouseEvent *event) override;
+
+signals:
+    void decodeFailed(const QString& imagePath);
+    // the session snapshot could not be restored, it is left on disk and nothing is saved
+    void sessionFailed();
 
 private:
+    void showEdge(int id);
+    void hideEdge(int id);
+    void rebuildViews();
+    std::vector<int> insertionOrder();
+    void insertChunk();
+    void suspendIndex();
+    void resumeIndex();
+    void edgesDetected(bool ok);
+    void moveConnections(const AnnotationModel::PointRef& from, const AnnotationModel::PointRef& to);
+    void replaySession();
+    void closeSession();
+    void applyFlow(const FlowPropagator& flow);
+    EndPoint* strayView(int id);
+
+    // starts computing the gradient planes if needed, true once they are there
+    bool ensureGradient();
+    bool seedLiveWire();
+    void updateLiveWire(const QPointF& pos);
+    void continueLiveWire();
+    void hideLiveWire();
+
+    bool restoreSessionState(const QByteArray& state);
+    void journalRecord(quint8 kind, const Action* act);
+    void replayRecord(const QByteArray& record);
+
+    ImageBuffer buffer;
     QImage qimage;
+    // full image size, larger than qimage while a preview is shown
+    QSize imageSize;
+    QString previewOf;
+    bool failed;
     LabelWidget* parent;
-    std::set<EdgeItem*> pEdges;
+    AnnotationModel annotations;
+    // views indexed by edge id, NULL while the edge is not shown
+    std::vector<EdgeItem*> views;
     EdgeItem* pCurrEdge;
 
-    // for hovering
+    // for hovering, indexed like the pixel pool of the model
     QPointF mousePos;
     cv::flann::Index* kdtree;
+    // the index reads its dataset from here, 8 bytes per pool pixel on top of the model's 4
     std::vector<cv::Point2f> edgePoints;
-    std::map<int, EdgeItem*> ind2edge;
-    std::map<EdgeItem*, int> edge2ind;
-    std::map<int, int> global2local;
-    std::map<int, bool> pointMask;
     double radiusNN;
 
-    // action queue
-    unsigned int maxActionListSize;
+    // box or lasso being dragged, item coordinates
+    QPolygonF lasso;
+    bool lassoBox;
+    QGraphicsPathItem* lassoPreview;
+
+    // action queue, budgeted by the bytes held by the actions
+    size_t maxHistoryBytes;
+    size_t usedHistoryBytes;
     std::list<Action*> actionList;
     std::list<Action*> redoList;
 
+    // batched edits, blinks are deferred and the scene repaints once
+    int batchDepth;
+    std::vector<int> pendingBlinks;
+    int indexSuspended;
+
+    // edges waiting to be inserted into the scene, a chunk per event loop pass
+    std::vector<int> insertQueue;
+    size_t insertPos;
+    QTimer* insertTimer;
+
+    // edge detection in flight, cancelled when the image goes away
+    std::shared_ptr<EdgeDetectJob> loadJob;
+
+    // session persistence
+    SessionJournal* journal;
+    std::vector<QByteArray> pendingRecords;
+    // snapshot waiting for the detected edges
+    QByteArray pendingState;
+    // selection of the previous frame waiting for the edges of this one
+    FlowPropagator pendingFlow;
+    QTimer* autosaveTimer;
+    bool replaying;
+    int recordsSinceSnapshot;
+
     // create mode
     bool createMode;
-    EndPoint* pConnectPoint;
-    std::set<EndPoint*> pStrayPoints;
-    std::vector<std::pair<EndPoint*,EndPoint*>> connections;
+    AnnotationModel::PointRef connectPoint;
+    std::map<int, EndPoint*> strayViews;
+    ConnectionLayer* pConnections;
+    RegionLayer* pRegions;
+    QTimer* regionTimer;
+
+    // live-wire, the gradient planes are computed in the background on first use
+    bool liveWireMode;
+    LiveWire liveWire;
+    std::shared_ptr<EdgeDetectJob> gradientJob;
+    cv::Mat gradM;
+    cv::Mat gradO;
+    cv::Point wireTarget;
+    QGraphicsPathItem* wirePreview;
+    // continues a search that ran out of its budget, one pass per event loop
+    QTimer* wireTimer;
 };
 
 #endif // LABELIMAGE_H
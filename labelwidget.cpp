@@ -1,8 +1,27 @@
 #include "labelwidget.h"
 #include "labelimage.h"
+#include "profiler.h"
+#include "inputrecorder.h"
+#include <QScrollBar>
 #include <QKeyEvent>
+#include <QPainter>
+#include <QTimer>
+#include <QDateTime>
+#include <QFontDatabase>
+#include <QMessageBox>
+#include <algorithm>
 #include <QtDebug>
 
+namespace
+{
+
+const QRect OVERLAY_RECT(8, 8, 300, 190);
+const int OVERLAY_REFRESH = 250;
+// the frame graph is scaled to this many milliseconds, a 60 Hz frame is a quarter of it
+const float GRAPH_RANGE = 66.7f;
+
+} //end of namespace
+
 LabelWidget::LabelWidget(QWidget *parent)
     : QGraphicsView(parent)
 {
@@ -12,16 +31,25 @@ LabelWidget::LabelWidget(QWidget *parent)
     setTransformationAnchor(AnchorUnderMouse);
     setMinimumSize(400, 400);
     pImage = NULL;
+    recorder = NULL;
     setFocusPolicy(Qt::StrongFocus);
+
+    profilerTimer = new QTimer(this);
+    profilerTimer->setInterval(OVERLAY_REFRESH);
+    connect(profilerTimer, &QTimer::timeout, [this]() { viewport()->update(OVERLAY_RECT); });
 }
 
 LabelWidget::~LabelWidget()
 {
+    stopRecording();
     reset();
 }
 
 void LabelWidget::reset()
 {
+    // a recording covers a single image
+    stopRecording();
+    imagePath.clear();
     if (pImage) {
         scene()->removeItem(pImage);
         delete pImage;
@@ -31,21 +59,142 @@ void LabelWidget::reset()
     resetMatrix();
 }
 
-void LabelWidget::showImage(const cv::Mat& image)
+void LabelWidget::showImage(const cv::Mat& image, const QString& path)
 {
     reset();
+    imagePath = path;
+
+    // a plain view of the decoded pixels, luminance is computed with the edges
+    pImage = new LabelImage(this, ImageBuffer(image, ImageBuffer::NO_LUMINANCE));
+    scene()->addItem(pImage);
+    pImage->setPos(0,0);
+    watchImage();
+    if (path.isEmpty())
+        pImage->addEdges();
+    else
+        pImage->openSession(path);
+
+    repaint();
+    setFocus();
+}
+
+void LabelWidget::showImage(const ImageBuffer& image, const AnnotationModel& edges, const QString& path)
+{
+    reset();
+    imagePath = path;
 
     pImage = new LabelImage(this, image);
     scene()->addItem(pImage);
     pImage->setPos(0,0);
-    pImage->addEdges(image);
+    watchImage();
+    if (path.isEmpty())
+        pImage->addEdges(&edges);
+    else
+        pImage->openSession(path, &edges);
 
     repaint();
     setFocus();
 }
 
+void LabelWidget::showFrame(const ImageBuffer& image, const AnnotationModel& edges, bool propagate)
+{
+    // sampled before the shown frame goes away, tracked once the new one has its edges
+    FlowPropagator flow;
+    if (propagate && pImage)
+        pImage->sampleSelection(flow);
+
+    showImage(image, edges, QString());
+    pImage->propagate(flow);
+}
+
+void LabelWidget::showPreview(const cv::Mat& preview, const QSize& size, const QString& path)
+{
+    reset();
+    imagePath = path;
+
+    pImage = new LabelImage(this, ImageBuffer(preview, ImageBuffer::NO_LUMINANCE));
+    pImage->setPreview(path, size);
+    scene()->addItem(pImage);
+    pImage->setPos(0,0);
+    watchImage();
+    pImage->openSession(path);
+
+    repaint();
+    setFocus();
+}
+
+void LabelWidget::watchImage()
+{
+    connect(pImage, &LabelImage::decodeFailed, this, [this](const QString& path) {
+        QMessageBox::warning(this, tr("Warning"),
+                             tr("Cannot decode %1, only a reduced preview is shown. "
+                                "Its session is left untouched.").arg(path));
+    });
+    connect(pImage, &LabelImage::sessionFailed, this, [this]() {
+        QMessageBox::warning(this, tr("Warning"),
+                             tr("The saved session of %1 is damaged or was recorded over different edges, it was not restored. "
+                                "It is left untouched, edits made now are not saved.").arg(imagePath));
+    });
+}
+
+const AnnotationModel* LabelWidget::annotations() const
+{
+    // a failed decode has no edges, its session on disk stays authoritative
+    if (!pImage || pImage->loadingEdges() || pImage->loadFailed()) return NULL;
+    return &pImage->model();
+}
+
+void LabelWidget::memoryReport(MemoryReport& report) const
+{
+    if (pImage) pImage->memoryReport(report);
+}
+
+bool LabelWidget::ready() const
+{
+    return pImage && !pImage->loadingEdges() && !pImage->insertingEdges();
+}
+
+bool LabelWidget::startRecording(const QString& fileName)
+{
+    stopRecording();
+    if (!ready() || imagePath.isEmpty()) return false;
+
+    InputRecorder::Header header;
+    header.imagePath = imagePath;
+    header.session = pImage->sessionState();
+    header.viewportSize = viewport()->size();
+    header.transform = transform();
+    header.scrollX = horizontalScrollBar()->value();
+    header.scrollY = verticalScrollBar()->value();
+
+    recorder = new InputRecorder(fileName);
+    if (!recorder->start(header)) {
+        delete recorder;
+        recorder = NULL;
+        return false;
+    }
+    return true;
+}
+
+void LabelWidget::restoreSession(const QByteArray& state)
+{
+    if (pImage) pImage->restoreSession(state);
+}
+
+void LabelWidget::stopRecording()
+{
+    delete recorder;
+    recorder = NULL;
+}
+
+bool LabelWidget::isRecording() const
+{
+    return recorder != NULL;
+}
+
 void LabelWidget::mousePressEvent(QMouseEvent *event)
 {
+    if (recorder) recorder->record(event);
     if (event->button() == Qt::MidButton)
     {
         setInteractive(false);
@@ -56,8 +205,16 @@ void LabelWidget::mousePressEvent(QMouseEvent *event)
     else QGraphicsView::mousePressEvent(event);
 }
 
+void LabelWidget::mouseMoveEvent(QMouseEvent *event)
+{
+    // hover moves included, the view tracks the mouse for hover events
+    if (recorder) recorder->record(event);
+    QGraphicsView::mouseMoveEvent(event);
+}
+
 void LabelWidget::mouseReleaseEvent(QMouseEvent *event)
 {
+    if (recorder) recorder->record(event);
     if (event->button() == Qt::MidButton)
     {
         QMouseEvent fake(event->type(), event->pos(), Qt::LeftButton, Qt::LeftButton, event->modifiers());
@@ -71,6 +228,7 @@ void LabelWidget::mouseReleaseEvent(QMouseEvent *event)
 #if QT_CONFIG(wheelevent)
 void LabelWidget::wheelEvent(QWheelEvent *event)
 {
+    if (recorder) recorder->record(event);
     scaleView(pow((double)2, -event->delta() / 240.0));
 }
 #endif
@@ -86,6 +244,12 @@ void LabelWidget::scaleView(qreal scaleFactor)
 
 void LabelWidget::keyPressEvent(QKeyEvent *event)
 {
+    if (event->key() == Qt::Key_F9) {
+        toggleRecording();
+        return;
+    }
+    if (recorder) recorder->record(event);
+
     switch (event->key()) {
     case Qt::Key_Space:
         pImage->splitEdge();
@@ -99,8 +263,109 @@ void LabelWidget::keyPressEvent(QKeyEvent *event)
     case Qt::Key_C:
         pImage->toggleCreateMode();
         break;
+    case Qt::Key_M:
+        pImage->mergeSelected();
+        break;
+    case Qt::Key_W:
+        pImage->toggleLiveWire();
+        break;
+    case Qt::Key_P:
+        if (event->modifiers() & Qt::ShiftModifier)
+            dumpTrace();
+        else
+            toggleProfiler();
+        break;
     default:
         QGraphicsView::keyPressEvent(event);
     }
 }
 
+
+void LabelWidget::paintEvent(QPaintEvent *event)
+{
+    {
+        ProfileScope scope(Profiler::FRAME);
+        QGraphicsView::paintEvent(event);
+    }
+    Profiler::complete(Profiler::HOVER_TO_PAINT);
+}
+
+void LabelWidget::drawForeground(QPainter *painter, const QRectF &rect)
+{
+    QGraphicsView::drawForeground(painter, rect);
+    if (!Profiler::enabled()) return;
+
+    // drawn in viewport coordinates, independent of the zoom
+    painter->save();
+    painter->resetTransform();
+    painter->fillRect(OVERLAY_RECT, QColor(0, 0, 0, 180));
+    painter->setPen(Qt::white);
+    painter->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    QFontMetrics metrics(painter->font());
+    int line = metrics.height();
+    int x = OVERLAY_RECT.left() + 6;
+    int y = OVERLAY_RECT.top() + line;
+    painter->drawText(x, y, QString("%1 %2 %3 %4").arg("path", -22).arg("count", 8).arg("p50 ms", 8).arg("p99 ms", 8));
+    for (int i = 0; i < Profiler::PATH_COUNT; i++) {
+        Profiler::Path path = (Profiler::Path)i;
+        y += line;
+        painter->drawText(x, y, QString("%1 %2 %3 %4")
+                          .arg(Profiler::name(path), -22)
+                          .arg(Profiler::count(path), 8)
+                          .arg(Profiler::percentile(path, 0.5) / 1000.0, 8, 'f', 2)
+                          .arg(Profiler::percentile(path, 0.99) / 1000.0, 8, 'f', 2));
+    }
+
+    // the duration of the last frames, one bar each
+    std::vector<float> frames;
+    Profiler::frameTimes(frames);
+    QRect graph(x, y + line / 2, OVERLAY_RECT.width() - 12, OVERLAY_RECT.bottom() - y - line / 2 - 4);
+    painter->setPen(QColor(255, 255, 255, 90));
+    painter->drawLine(graph.left(), graph.bottom() - graph.height() / 4, graph.right(), graph.bottom() - graph.height() / 4);
+    painter->setPen(Qt::green);
+    float barWidth = (float)graph.width() / std::max((int)frames.size(), 1);
+    for (int i = 0; i < (int)frames.size(); i++) {
+        int height = (int)(std::min(frames[i] / GRAPH_RANGE, 1.0f) * graph.height());
+        int bx = graph.left() + (int)(i * barWidth);
+        painter->drawLine(bx, graph.bottom(), bx, graph.bottom() - height);
+    }
+    painter->restore();
+}
+
+void LabelWidget::toggleProfiler()
+{
+    bool enable = !Profiler::enabled();
+    Profiler::setEnabled(enable);
+    if (enable) {
+        Profiler::reset();
+        profilerTimer->start();
+    } else {
+        profilerTimer->stop();
+    }
+    viewport()->update();
+}
+
+void LabelWidget::dumpTrace()
+{
+    QString fileName = QString("ByLabel-trace-%1.json").arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+    if (Profiler::dumpTrace(fileName)) {
+        emit statusMessage(tr("Trace written to %1").arg(fileName));
+    } else {
+        qWarning() << "cannot write trace" << fileName;
+        emit statusMessage(tr("Cannot write trace %1").arg(fileName));
+    }
+}
+
+void LabelWidget::toggleRecording()
+{
+    if (isRecording()) {
+        stopRecording();
+        emit statusMessage(tr("Recording stopped"));
+        return;
+    }
+    QString fileName = QString("ByLabel-input-%1.blrec").arg(QDateTime::currentDateTime().toString("yyyyMMdd-hhmmss"));
+    if (startRecording(fileName))
+        emit statusMessage(tr("Recording input to %1").arg(fileName));
+    else
+        emit statusMessage(tr("Cannot record, open an image file and wait for its edges"));
+}
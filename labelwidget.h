@@ -6,6 +6,11 @@
 
 class LabelImage;
 class EdgeItem;
+class ImageBuffer;
+class AnnotationModel;
+class MemoryReport;
+class InputRecorder;
+class QTimer;
 
 class LabelWidget : public QGraphicsView
 {
@@ -15,10 +20,35 @@ public:
     ~LabelWidget();
 
     void reset();
-    void showImage(const cv::Mat& image);
+    // with a path, edits are journaled next to the image and restored on the next open
+    void showImage(const cv::Mat& image, const QString& path = QString());
+    // shows an image decoded and detected ahead of time, see ImagePrefetcher
+    void showImage(const ImageBuffer& image, const AnnotationModel& edges, const QString& path);
+    // shows a video frame, with propagate the selection of the shown frame is carried over
+    void showFrame(const ImageBuffer& image, const AnnotationModel& edges, bool propagate);
+    // shows a reduced decode scaled to size right away, the full image follows with the edges
+    void showPreview(const cv::Mat& preview, const QSize& size, const QString& path);
+    // annotations of the shown image, NULL without an image, while its edges are detected
+    // or if its full decode failed
+    const AnnotationModel* annotations() const;
+    void memoryReport(MemoryReport& report) const;
+    // the image has its edges and all of them are in the scene
+    bool ready() const;
+
+    // records the input from now on for ReplayHarness, needs an image opened from a file
+    bool startRecording(const QString& fileName);
+    // restores the session state of a recording, right after showImage()
+    void restoreSession(const QByteArray& state);
+    void stopRecording();
+    bool isRecording() const;
+
+signals:
+    // outcome of a shortcut, for the status bar
+    void statusMessage(const QString& text);
 
 protected:
     void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
     void mouseReleaseEvent(QMouseEvent *event) override;
 #if QT_CONFIG(wheelevent)
     void wheelEvent(QWheelEvent *event) override;
@@ -27,8 +57,23 @@ protected:
 
     void keyPressEvent(QKeyEvent *event) override;
 
+    // one repaint is one frame of the profiler, its overlay is drawn on top
+    void paintEvent(QPaintEvent *event) override;
+    void drawForeground(QPainter *painter, const QRectF &rect) override;
+
 private:
+    // warns when the shown image or its session fails to load
+    void watchImage();
+    void toggleProfiler();
+    void toggleRecording();
+    void dumpTrace();
+
     LabelImage* pImage;
+    // file the shown image was read from, empty for video frames
+    QString imagePath;
+    InputRecorder* recorder;
+    // repaints the profiler overlay while it is shown
+    QTimer* profilerTimer;
 };
 
 #endif // LABELWIDGET_H
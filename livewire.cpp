@@ -0,0 +1,171 @@
+#include "livewire.h"
+#include "ED.h"
+#include <climits>
+#include <algorithm>
+
+namespace
+{
+
+// 8-neighbourhood, the opposite of neighbour i is 7-i
+const int NEIGHBOURS = 8;
+const int DX[NEIGHBOURS] = {-1, 0, 1, -1, 1, -1, 0, 1};
+const int DY[NEIGHBOURS] = {-1, -1, -1, 0, 0, 1, 1, 1};
+const uchar NO_PARENT = 255;
+
+// step weights, about 1 : sqrt(2)
+const int STRAIGHT_WEIGHT = 5;
+const int DIAGONAL_WEIGHT = 7;
+// added when a step crosses the edge direction given by the orientation plane
+const int CROSS_PENALTY = 32;
+const int MAX_STEP = (255 + CROSS_PENALTY) * DIAGONAL_WEIGHT;
+
+} //end of namespace
+
+LiveWire::LiveWire()
+    : currentCost(0), queued(0)
+{
+    buckets.resize(MAX_STEP + 1);
+}
+
+void LiveWire::setGradient(const cv::Mat& M, const cv::Mat& O)
+{
+    magnitude = M;
+    orientation = O;
+    window = cv::Rect();
+}
+
+bool LiveWire::hasGradient() const
+{
+    return !magnitude.empty();
+}
+
+void LiveWire::setSeed(const cv::Point& seed, int radius)
+{
+    seedPoint = seed;
+    cv::Rect bounds(0, 0, magnitude.cols, magnitude.rows);
+    window = cv::Rect(seed.x - radius, seed.y - radius, 2*radius + 1, 2*radius + 1) & bounds;
+    if (!window.contains(seed)) {
+        window = cv::Rect();
+        return;
+    }
+
+    // local cost in [1, 255], strong gradient is cheap; 1 keeps paths short on flat gradient
+    double maxM = 0;
+    cv::Mat roi = magnitude(window);
+    cv::minMaxLoc(roi, NULL, &maxM);
+    cv::Mat cost(window.size(), CV_8UC1);
+    if (maxM > 0)
+        roi.convertTo(cost, CV_8U, -254.0 / maxM, 255);
+    else
+        cost.setTo(255);
+
+    int size = window.area();
+    localCost.resize(size);
+    for (int r = 0; r < window.height; r++)
+        std::copy(cost.ptr<uchar>(r), cost.ptr<uchar>(r) + window.width, localCost.begin() + r*window.width);
+    dist.assign(size, INT_MAX);
+    from.assign(size, NO_PARENT);
+    settled.assign(size, 0);
+    for (auto& bucket : buckets)
+        bucket.clear();
+    queued = 0;
+    currentCost = 0;
+
+    push((seed.y - window.y) * window.width + (seed.x - window.x), 0);
+}
+
+bool LiveWire::hasSeed() const
+{
+    return window.area() > 0;
+}
+
+const cv::Point& LiveWire::seed() const
+{
+    return seedPoint;
+}
+
+bool LiveWire::inWindow(const cv::Point& p) const
+{
+    return window.contains(p);
+}
+
+void LiveWire::push(int node, int cost)
+{
+    dist[node] = cost;
+    buckets[cost % buckets.size()].push_back(node);
+    queued++;
+}
+
+bool LiveWire::pathTo(const cv::Point& target, std::vector<cv::Point>& path, int budget)
+{
+    path.clear();
+    if (!inWindow(target)) return false;
+
+    int width = window.width;
+    int targetNode = (target.y - window.y) * width + (target.x - window.x);
+    int bucketCount = (int)buckets.size();
+
+    while (!settled[targetNode] && queued > 0 && budget != 0) {
+        std::vector<int>& bucket = buckets[currentCost % bucketCount];
+        if (bucket.empty()) {
+            currentCost++;
+            continue;
+        }
+        int node = bucket.back();
+        bucket.pop_back();
+        queued--;
+        // stale entry, the node was reached cheaper later
+        if (settled[node] || dist[node] != currentCost) continue;
+        settled[node] = 1;
+        budget--;
+
+        int x = node % width;
+        int y = node / width;
+        for (int i = 0; i < NEIGHBOURS; i++) {
+            int nx = x + DX[i];
+            int ny = y + DY[i];
+            if (nx < 0 || ny < 0 || nx >= width || ny >= window.height) continue;
+            int next = ny * width + nx;
+            if (settled[next]) continue;
+
+            int stepCost = localCost[next];
+            uchar dir = orientation.at<uchar>(ny + window.y, nx + window.x);
+            // moving across a horizontal edge is a vertical step and vice versa
+            if ((DX[i] == 0 && dir == EDGE_HOR) || (DY[i] == 0 && dir == EDGE_VER))
+                stepCost += CROSS_PENALTY;
+            stepCost *= (DX[i] != 0 && DY[i] != 0) ? DIAGONAL_WEIGHT : STRAIGHT_WEIGHT;
+
+            int cost = currentCost + stepCost;
+            if (cost < dist[next]) {
+                from[next] = (uchar)(NEIGHBOURS - 1 - i);
+                push(next, cost);
+            }
+        }
+    }
+
+    if (!settled[targetNode]) return false;
+    tracePath(targetNode, path);
+    return true;
+}
+
+void LiveWire::tracePath(int node, std::vector<cv::Point>& path) const
+{
+    int width = window.width;
+    while (true) {
+        int x = node % width;
+        int y = node / width;
+        path.push_back(cv::Point(x + window.x, y + window.y));
+        if (from[node] == NO_PARENT) break;
+        node = (y + DY[from[node]]) * width + (x + DX[from[node]]);
+    }
+    std::reverse(path.begin(), path.end());
+}
+
+size_t LiveWire::memoryBytes() const
+{
+    size_t bytes = localCost.capacity() + dist.capacity()*sizeof(int) + from.capacity() + settled.capacity()
+            + buckets.capacity()*sizeof(std::vector<int>);
+    for (const auto& bucket : buckets)
+        bytes += bucket.capacity()*sizeof(int);
+    return bytes;
+}
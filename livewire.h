@@ -0,0 +1,59 @@
+#ifndef LIVEWIRE_H
+#define LIVEWIRE_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+
+/**
+ *@brief minimum cost paths from a seed pixel over the ED gradient, for
+ * connections that follow the image boundary.
+ *
+ * Dijkstra with a bucket queue (Dial's algorithm), since the step costs
+ * are small integers. The search is limited to a square window around the
+ * seed and kept between calls: pixels settled for one target are reused
+ * for the next, so following the cursor only expands the search by the
+ * area newly needed. A budget bounds the work per call.
+ */
+class LiveWire
+{
+public:
+    LiveWire();
+
+    // gradient magnitude (CV_16SC1) and orientation (CV_8UC1) planes from ED
+    void setGradient(const cv::Mat& M, const cv::Mat& O);
+    bool hasGradient() const;
+
+    // restarts the search at seed within a window of radius pixels around it
+    void setSeed(const cv::Point& seed, int radius = 500);
+    bool hasSeed() const;
+    const cv::Point& seed() const;
+    bool inWindow(const cv::Point& p) const;
+
+    // settles at most budget pixels; true with the path, seed first, once target is settled
+    bool pathTo(const cv::Point& target, std::vector<cv::Point>& path, int budget = -1);
+
+    // search buffers, the gradient planes are shared with the LabelImage
+    size_t memoryBytes() const;
+
+private:
+    void push(int node, int cost);
+    void tracePath(int node, std::vector<cv::Point>& path) const;
+
+    cv::Mat magnitude;
+    cv::Mat orientation;
+    cv::Point seedPoint;
+    cv::Rect window;
+
+    // per window pixel, row major
+    std::vector<uchar> localCost;
+    std::vector<int> dist;
+    std::vector<uchar> from;    // neighbour the best path comes from, see NEIGHBOURS
+    std::vector<uchar> settled;
+
+    // circular buckets indexed by cost, wider than the largest step cost
+    std::vector<std::vector<int>> buckets;
+    int currentCost;
+    int queued;
+};
+
+#endif // LIVEWIRE_H
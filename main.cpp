@@ -1,11 +1,54 @@
 #include "mainwindow.h"
+#include "edstatscollector.h"
+#include "memoryreport.h"
+#include "replayharness.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+#include <cstring>
 
 int main(int argc, char *argv[])
 {
+    // a replay needs no display, unless a platform is asked for explicitly
+    for (int i = 1; i < argc; i++) {
+        if (!std::strcmp(argv[i], "--replay") && !qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
     QApplication a(argc, argv);
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption edStats("ed-stats", "Write the edge detection statistics as JSON to <file> on exit.", "file");
+    parser.addOption(edStats);
+    QCommandLineOption memory("memory-report", "Write the live bytes per subsystem as JSON to <file> on exit.", "file");
+    parser.addOption(memory);
+    QCommandLineOption replay("replay", "Replay an input recording (F9 in the label view) headless and report "
+                              "the latency per event.", "recording");
+    parser.addOption(replay);
+    QCommandLineOption replayReport("replay-report", "Also write the replay report as JSON to <file>.", "file");
+    parser.addOption(replayReport);
+    parser.process(a);
+
+    if (parser.isSet(replay))
+        return ReplayHarness::run(parser.value(replay), parser.value(replayReport));
+
     MainWindow w;
     w.show();
 
-    return a.exec();
+    int result = a.exec();
+    // a run asked for a file fails without it, scripts check the exit code
+    if (parser.isSet(edStats) && !EDStatsCollector::instance().writeJson(parser.value(edStats))) {
+        qCritical() << "cannot write" << parser.value(edStats);
+        if (!result) result = 1;
+    }
+    if (parser.isSet(memory)) {
+        // taken before the window and its image are destroyed
+        MemoryReport report;
+        w.memoryReport(report);
+        if (!report.writeJson(parser.value(memory))) {
+            qCritical() << "cannot write" << parser.value(memory);
+            if (!result) result = 1;
+        }
+    }
+    return result;
 }
@@ -1,11 +1,105 @@
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
+#include "imageprefetcher.h"
+#include "videosource.h"
+#include "annotationexporter.h"
+#include "imagelistmodel.h"
+#include "edstatscollector.h"
+#include "memoryreport.h"
+#include "memorypanel.h"
+#include <QShortcut>
+#include <QFileInfo>
+#include <cstdlib>
+
+namespace
+{
+
+// below this size a full decode is fast enough to show directly
+const qint64 PREVIEW_MIN_PIXELS = 4000000;
+
+/**
+ *@brief decodes a JPEG at 1/4 or 1/8 of its size, libjpeg scales in the DCT
+ * so this is several times faster than a full decode. Returns an empty Mat
+ * for small images and formats without reduced decoding.
+ */
+cv::Mat decodePreview(const QString& path, QSize& fullSize)
+{
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2)
+    QImageReader header(path);
+    fullSize = header.size();
+    if (header.format() != "jpeg" || !fullSize.isValid()) return cv::Mat();
+    qint64 pixels = (qint64)fullSize.width() * fullSize.height();
+    if (pixels < PREVIEW_MIN_PIXELS) return cv::Mat();
+
+    int flags = pixels >= 4*PREVIEW_MIN_PIXELS ? cv::IMREAD_REDUCED_COLOR_8 : cv::IMREAD_REDUCED_COLOR_4;
+    cv::Mat preview = cv::imread(path.toStdString(), flags);
+    // imread applies the EXIF orientation, the header size does not
+    if (!preview.empty() && (preview.cols > preview.rows) != (fullSize.width() > fullSize.height()))
+        fullSize.transpose();
+    return preview;
+#else
+    Q_UNUSED(path);
+    Q_UNUSED(fullSize);
+    return cv::Mat();
+#endif
+}
+
+} //end of namespace
 
 MainWindow::MainWindow(QWidget *parent) :
     QMainWindow(parent),
     ui(new Ui::MainWindow)
 {
     ui->setupUi(this);
+
+    currentImage = -1;
+    prefetcher = new ImagePrefetcher(this);
+    imageList = new ImageListModel(this);
+    video = new VideoSource(this);
+    shownFrame = -1;
+    // frames are detected on worker threads, show the current one once it is ready
+    connect(video, &VideoSource::frameReady, this, [this](int frame) {
+        if (video->isOpen() && frame == currentImage) showFrame(frame);
+    });
+    connect(prefetcher, &ImagePrefetcher::ready, this, [this](const QString& path) {
+        if (path != awaitedImage || video->isOpen()) return;
+        awaitedImage.clear();
+        // a failed load is not cached, the fallbacks decode the image again and report the error
+        loadImage(path);
+    }, Qt::QueuedConnection);
+    exporter = new AnnotationExporter(this);
+    memoryPanel = NULL;
+    // emitted on the export workers, queued to the GUI thread
+    connect(exporter, &AnnotationExporter::progress, this, [this](int done, int total) {
+        ui->statusBar->showMessage(tr("Exporting %1 / %2").arg(done).arg(total));
+    });
+    connect(exporter, &AnnotationExporter::finished, this, [this](bool ok) {
+        ui->statusBar->showMessage(ok ? tr("Export finished") : tr("Export failed for some images"), 5000);
+        QStringList skipped = exporter->unrecovered();
+        if (!skipped.isEmpty())
+            QMessageBox::warning(this, tr("Export"),
+                                 tr("These images have edits that were not saved to their session snapshot. "
+                                    "Open each of them once to recover the edits, then export again:\n%1")
+                                 .arg(skipped.join("\n")));
+    });
+    ui->treeView->setModel(imageList);
+    ui->treeView->setUniformRowHeights(true);
+    ui->treeView->setIconSize(QSize(ImageListModel::THUMBNAIL_SIZE, ImageListModel::THUMBNAIL_SIZE));
+    ui->treeView->setHeaderHidden(true);
+    ui->treeView->setRootIsDecorated(false);
+    ui->treeView->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    connect(ui->myGraphicsView, &LabelWidget::statusMessage, this, [this](const QString& text) {
+        ui->statusBar->showMessage(text, 5000);
+    });
+    connect(ui->treeView, &QTreeView::activated, [this](const QModelIndex& index) {
+        showImageAt(index.row());
+    });
+    connect(ui->treeView, &QTreeView::clicked, [this](const QModelIndex& index) {
+        showImageAt(index.row());
+    });
+    // letter keys are taken by the canvas
+    new QShortcut(QKeySequence(Qt::Key_PageDown), this, SLOT(nextImage()));
+    new QShortcut(QKeySequence(Qt::Key_PageUp), this, SLOT(previousImage()));
 }
 
 MainWindow::~MainWindow()
@@ -22,10 +116,182 @@ void MainWindow::on_actionOpen_Single_Image_triggered()
                     "Image files (*.bmp *.jpg *.tif *.tiff *.pbm *.pgm *.png *.ppm *.xbm *.xpm);;All files (*.*)");
         if(fileName != "")
         {
-            std::string fn = fileName.toStdString();
-            cv::Mat cvImg = cv::imread(fn);
-
-            ui->myGraphicsView->showImage(cvImg);
+            // a sequence of one, so it can be exported like the others
+            openImages(QStringList(fileName));
         }
 
 }
+
+void MainWindow::on_actionOpen_Images_triggered()
+{
+    QStringList fileNames = QFileDialog::getOpenFileNames(
+                    this, "open image files",
+                    "/home",
+                    "Image files (*.bmp *.jpg *.tif *.tiff *.pbm *.pgm *.png *.ppm *.xbm *.xpm);;All files (*.*)");
+    if (fileNames.isEmpty()) return;
+    openImages(fileNames);
+}
+
+void MainWindow::openImages(const QStringList& fileNames)
+{
+    video->close();
+    imagePaths = fileNames;
+    currentImage = -1;
+    prefetcher->setImages(imagePaths);
+
+    imageList->setImages(imagePaths);
+    showImageAt(0);
+}
+
+void MainWindow::on_actionOpen_Video_triggered()
+{
+    QString fileName = QFileDialog::getOpenFileName(
+                    this, "open video file",
+                    "/home",
+                    "Video files (*.avi *.mp4 *.mkv *.mov *.mpg *.mpeg *.wmv);;All files (*.*)");
+    if (fileName.isEmpty()) return;
+
+    imagePaths.clear();
+    prefetcher->setImages(imagePaths);
+    if (!video->open(fileName)) {
+        QMessageBox::warning(this, tr("Warning"), tr("Cannot read video %1").arg(fileName));
+        return;
+    }
+
+    videoName = QFileInfo(fileName).fileName();
+    imageList->setImages(QStringList(fileName));
+    currentImage = -1;
+    shownFrame = -1;
+    showFrame(0);
+}
+
+void MainWindow::showFrame(int frame)
+{
+    int count = video->frameCount();
+    if (frame < 0 || (count > 0 && frame >= count)) return;
+
+    if (frame != currentImage) {
+        currentImage = frame;
+        video->seek(frame);
+        imageList->setTitle(0, tr("%1 [%2]").arg(videoName).arg(frame));
+    }
+    if (frame == shownFrame) return;
+
+    // not ready yet, frameReady() calls back once the frame is detected
+    ImageBuffer buffer;
+    AnnotationModel edges;
+    if (!video->take(frame, buffer, edges)) return;
+    // stepping to a neighbouring frame carries the selected edges over
+    bool propagate = shownFrame >= 0 && std::abs(frame - shownFrame) == 1;
+    shownFrame = frame;
+    ui->myGraphicsView->showFrame(buffer, edges, propagate);
+}
+
+void MainWindow::on_actionOutput_Setting_triggered()
+{
+    if (exporter->running()) {
+        QMessageBox::information(this, tr("Export"), tr("An export is already running."));
+        return;
+    }
+    if (imagePaths.isEmpty()) {
+        QMessageBox::warning(this, tr("Warning"), tr("Open the images to export first."));
+        return;
+    }
+    QString dir = QFileDialog::getExistingDirectory(this, "export annotations to", "/home");
+    if (dir.isEmpty()) return;
+
+    // the shown image may have edits newer than its last snapshot
+    std::map<QString, AnnotationModel> unsaved;
+    const AnnotationModel* current = ui->myGraphicsView->annotations();
+    if (current && currentImage >= 0 && currentImage < imagePaths.size())
+        unsaved[imagePaths[currentImage]] = *current;
+
+    if (!exporter->start(imagePaths, dir, unsaved))
+        QMessageBox::warning(this, tr("Warning"), tr("Cannot write to %1").arg(dir));
+}
+
+void MainWindow::on_actionExport_Detection_Statistics_triggered()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, "export detection statistics to", "/home",
+                                                    "JSON files (*.json)");
+    if (fileName.isEmpty()) return;
+    if (!EDStatsCollector::instance().writeJson(fileName))
+        QMessageBox::warning(this, tr("Warning"), tr("Cannot write to %1").arg(fileName));
+}
+
+void MainWindow::on_actionMemory_Usage_triggered()
+{
+    if (!memoryPanel)
+        memoryPanel = new MemoryPanel([this](MemoryReport& report) { memoryReport(report); }, this);
+    memoryPanel->show();
+    memoryPanel->raise();
+}
+
+void MainWindow::memoryReport(MemoryReport& report)
+{
+    ui->myGraphicsView->memoryReport(report);
+    report.add(MemoryReport::CACHES, "prefetched images", prefetcher->memoryBytes(), prefetcher->cachedCount());
+    report.add(MemoryReport::CACHES, "video decode window", video->memoryBytes());
+    report.add(MemoryReport::CACHES, "thumbnails", imageList->memoryBytes());
+}
+
+void MainWindow::showImageAt(int index)
+{
+    if (video->isOpen()) return;
+    if (index < 0 || index >= imagePaths.size() || index == currentImage) return;
+    // the image left behind may have been annotated
+    if (currentImage >= 0) imageList->refreshStatus(currentImage);
+    currentImage = index;
+    ui->treeView->setCurrentIndex(imageList->indexOf(index));
+
+    awaitedImage.clear();
+    prefetcher->prefetch(index + 1);
+    loadImage(imagePaths[index]);
+}
+
+void MainWindow::loadImage(const QString& path)
+{
+    ImageBuffer buffer;
+    AnnotationModel edges;
+    // decoded and detected by the prefetcher unless the user jumped ahead of it
+    if (prefetcher->take(path, buffer, edges)) {
+        ui->myGraphicsView->showImage(buffer, edges, path);
+        return;
+    }
+    if (prefetcher->loading(path)) {
+        // the previous image goes away now, edits would not belong to the current one
+        ui->myGraphicsView->reset();
+        awaitedImage = path;
+        return;
+    }
+
+    QSize size;
+    cv::Mat preview = decodePreview(path, size);
+    if (!preview.empty()) {
+        ui->myGraphicsView->showPreview(preview, size, path);
+        return;
+    }
+
+    cv::Mat cvImg = cv::imread(path.toStdString());
+    if (cvImg.empty()) {
+        QMessageBox::warning(this, tr("Warning"), tr("Cannot read image %1").arg(path));
+        return;
+    }
+    ui->myGraphicsView->showImage(cvImg, path);
+}
+
+void MainWindow::nextImage()
+{
+    if (video->isOpen())
+        showFrame(currentImage + 1);
+    else
+        showImageAt(currentImage + 1);
+}
+
+void MainWindow::previousImage()
+{
+    if (video->isOpen())
+        showFrame(currentImage - 1);
+    else
+        showImageAt(currentImage - 1);
+}
@@ -16,6 +16,13 @@
 #include <opencv2/imgproc/imgproc.hpp>
 #include "labelwidget.h"
 
+class ImagePrefetcher;
+class VideoSource;
+class AnnotationExporter;
+class ImageListModel;
+class MemoryReport;
+class MemoryPanel;
+
 namespace Ui {
 class MainWindow;
 }
@@ -28,12 +35,43 @@ public:
     explicit MainWindow(QWidget *parent = 0);
     ~MainWindow();
 
+    // the shown image plus the caches of the image sequence or video
+    void memoryReport(MemoryReport& report);
+
 private slots:
     void on_actionOpen_Single_Image_triggered();
+    void on_actionOpen_Images_triggered();
+    void on_actionOpen_Video_triggered();
+    void on_actionOutput_Setting_triggered();
+    void on_actionExport_Detection_Statistics_triggered();
+    void on_actionMemory_Usage_triggered();
+    void showImageAt(int index);
+    void showFrame(int frame);
+    void nextImage();
+    void previousImage();
 
 private:
+    void openImages(const QStringList& fileNames);
+    void loadImage(const QString& path);
+
     Ui::MainWindow *ui;
     QImage *image;
+
+    // image sequence shown in the tree view
+    QStringList imagePaths;
+    int currentImage;
+    ImageListModel* imageList;
+    ImagePrefetcher* prefetcher;
+    // the current image, shown once the prefetcher has it instead of decoding it a second time
+    QString awaitedImage;
+
+    // video opened instead of an image sequence, currentImage is the frame
+    VideoSource* video;
+    QString videoName;
+    int shownFrame;
+
+    AnnotationExporter* exporter;
+    MemoryPanel* memoryPanel;
 };
 
 #endif // MAINWINDOW_H
@@ -0,0 +1,81 @@
+#include "memorypanel.h"
+#include "memoryreport.h"
+#include <QTreeWidget>
+#include <QHeaderView>
+#include <QVBoxLayout>
+#include <QTimer>
+
+namespace
+{
+
+const int REFRESH_INTERVAL = 1000;
+
+QString formatBytes(size_t bytes)
+{
+    if (bytes < 1024) return QString("%1 B").arg(bytes);
+    if (bytes < 1024*1024) return QString("%1 KiB").arg(bytes / 1024.0, 0, 'f', 1);
+    if (bytes < 1024*1024*1024) return QString("%1 MiB").arg(bytes / (1024.0*1024), 0, 'f', 1);
+    return QString("%1 GiB").arg(bytes / (1024.0*1024*1024), 0, 'f', 2);
+}
+
+} //end of namespace
+
+MemoryPanel::MemoryPanel(const Source& source, QWidget *parent)
+    : QDialog(parent), source(source)
+{
+    setWindowTitle(tr("Memory Usage"));
+    tree = new QTreeWidget(this);
+    tree->setColumnCount(3);
+    tree->setHeaderLabels(QStringList() << tr("Subsystem") << tr("Bytes") << tr("Count"));
+    tree->header()->setSectionResizeMode(0, QHeaderView::Stretch);
+    QVBoxLayout* layout = new QVBoxLayout(this);
+    layout->addWidget(tree);
+    resize(420, 480);
+
+    timer = new QTimer(this);
+    timer->setInterval(REFRESH_INTERVAL);
+    connect(timer, &QTimer::timeout, [this]() { refresh(); });
+}
+
+void MemoryPanel::showEvent(QShowEvent *event)
+{
+    refresh();
+    timer->start();
+    QDialog::showEvent(event);
+}
+
+void MemoryPanel::hideEvent(QHideEvent *event)
+{
+    timer->stop();
+    QDialog::hideEvent(event);
+}
+
+void MemoryPanel::refresh()
+{
+    MemoryReport report;
+    source(report);
+
+    // rebuilt every time, the expanded state of the categories is kept
+    std::vector<bool> expanded(MemoryReport::CATEGORY_COUNT, true);
+    for (int c = 0; c < tree->topLevelItemCount() && c < MemoryReport::CATEGORY_COUNT; c++)
+        expanded[c] = tree->topLevelItem(c)->isExpanded();
+    tree->clear();
+
+    for (int c = 0; c < MemoryReport::CATEGORY_COUNT; c++) {
+        MemoryReport::Category category = (MemoryReport::Category)c;
+        QTreeWidgetItem* top = new QTreeWidgetItem(tree);
+        top->setText(0, MemoryReport::categoryName(category));
+        top->setText(1, formatBytes(report.total(category)));
+        for (const auto& entry : report.entries()) {
+            if (entry.category != category) continue;
+            QTreeWidgetItem* item = new QTreeWidgetItem(top);
+            item->setText(0, entry.name);
+            item->setText(1, formatBytes(entry.bytes));
+            if (entry.count) item->setText(2, QString::number(entry.count));
+        }
+        top->setExpanded(expanded[c]);
+    }
+    QTreeWidgetItem* total = new QTreeWidgetItem(tree);
+    total->setText(0, tr("total"));
+    total->setText(1, formatBytes(report.total()));
+}
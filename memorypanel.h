@@ -0,0 +1,35 @@
+#ifndef MEMORYPANEL_H
+#define MEMORYPANEL_H
+
+#include <QDialog>
+#include <functional>
+
+class QTreeWidget;
+class QTimer;
+class MemoryReport;
+
+/**
+ *@brief debug window listing the live bytes per subsystem, refreshed every
+ * second while it is shown.
+ */
+class MemoryPanel : public QDialog
+{
+    Q_OBJECT
+public:
+    typedef std::function<void(MemoryReport&)> Source;
+
+    MemoryPanel(const Source& source, QWidget *parent = 0);
+
+protected:
+    void showEvent(QShowEvent *event) override;
+    void hideEvent(QHideEvent *event) override;
+
+private:
+    void refresh();
+
+    Source source;
+    QTreeWidget* tree;
+    QTimer* timer;
+};
+
+#endif // MEMORYPANEL_H
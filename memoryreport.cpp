@@ -0,0 +1,89 @@
+#include "memoryreport.h"
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QFile>
+
+namespace
+{
+
+const char* const CATEGORY_NAMES[MemoryReport::CATEGORY_COUNT] = {
+    "edges",
+    "spatial index",
+    "image buffers",
+    "undo history",
+    "scene items",
+    "caches"
+};
+
+} //end of namespace
+
+void MemoryReport::add(Category category, const QString& name, size_t bytes, size_t count)
+{
+    Entry entry;
+    entry.category = category;
+    entry.name = name;
+    entry.bytes = bytes;
+    entry.count = count;
+    items.push_back(entry);
+}
+
+const std::vector<MemoryReport::Entry>& MemoryReport::entries() const
+{
+    return items;
+}
+
+size_t MemoryReport::total(Category category) const
+{
+    size_t bytes = 0;
+    for (const auto& entry : items) {
+        if (entry.category == category) bytes += entry.bytes;
+    }
+    return bytes;
+}
+
+size_t MemoryReport::total() const
+{
+    size_t bytes = 0;
+    for (const auto& entry : items)
+        bytes += entry.bytes;
+    return bytes;
+}
+
+const char* MemoryReport::categoryName(Category category)
+{
+    return CATEGORY_NAMES[category];
+}
+
+QByteArray MemoryReport::toJson() const
+{
+    QJsonObject categories;
+    for (int c = 0; c < CATEGORY_COUNT; c++) {
+        QJsonArray list;
+        for (const auto& entry : items) {
+            if (entry.category != c) continue;
+            QJsonObject object;
+            object["name"] = entry.name;
+            object["bytes"] = (double)entry.bytes;
+            if (entry.count) object["count"] = (double)entry.count;
+            list.append(object);
+        }
+        QJsonObject category;
+        category["bytes"] = (double)total((Category)c);
+        category["entries"] = list;
+        categories[CATEGORY_NAMES[c]] = category;
+    }
+
+    QJsonObject root;
+    root["total_bytes"] = (double)total();
+    root["categories"] = categories;
+    return QJsonDocument(root).toJson();
+}
+
+bool MemoryReport::writeJson(const QString& fileName) const
+{
+    QByteArray json = toJson();
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+    return file.write(json) == json.size();
+}
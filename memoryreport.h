@@ -0,0 +1,52 @@
+#ifndef MEMORYREPORT_H
+#define MEMORYREPORT_H
+
+#include <QByteArray>
+#include <QString>
+#include <vector>
+
+/**
+ *@brief live bytes per subsystem, filled by the memoryBytes() of the parts
+ * that hold memory and shown in the memory panel or written with
+ * --memory-report.
+ *
+ * Containers are counted by capacity, Mats and images by their pixel data.
+ * Scene items and the kd-tree hide their allocations inside Qt and FLANN,
+ * their entries are estimates from the item and point counts.
+ */
+class MemoryReport
+{
+public:
+    enum Category {
+        EDGES,
+        SPATIAL_INDEX,
+        IMAGE_BUFFERS,
+        UNDO_HISTORY,
+        SCENE_ITEMS,
+        CACHES,
+        CATEGORY_COUNT
+    };
+
+    struct Entry {
+        Category category;
+        QString name;
+        size_t bytes;
+        // items counted, 0 when the entry is not a count of items
+        size_t count;
+    };
+
+    void add(Category category, const QString& name, size_t bytes, size_t count = 0);
+
+    const std::vector<Entry>& entries() const;
+    size_t total(Category category) const;
+    size_t total() const;
+
+    static const char* categoryName(Category category);
+    QByteArray toJson() const;
+    bool writeJson(const QString& fileName) const;
+
+private:
+    std::vector<Entry> items;
+};
+
+#endif // MEMORYREPORT_H
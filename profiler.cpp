@@ -0,0 +1,203 @@
+#include "profiler.h"
+#include <QFile>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <thread>
+
+namespace
+{
+
+// 4 buckets per power of two from 1 us, the last one holds everything above ~16 s
+const int BUCKETS_PER_OCTAVE = 4;
+const int BUCKETS = 24 * BUCKETS_PER_OCTAVE;
+
+const int FRAME_HISTORY = 120;
+
+// about 6 MB, allocated when the profiler is first enabled, later events are dropped
+const int TRACE_CAPACITY = 1 << 18;
+
+const char* const PATH_NAMES[Profiler::PATH_COUNT] = {
+    "hoverMoveEvent",
+    "searchNN",
+    "hoverEnter",
+    "hover to paint",
+    "EndPoint::itemChange",
+    "Action::perform",
+    "LabelImage::paint",
+    "frame"
+};
+
+struct Histogram {
+    std::atomic<quint32> buckets[BUCKETS];
+    std::atomic<quint64> total;
+};
+
+struct TraceEvent {
+    // PATH_COUNT until the event is written completely
+    std::atomic<int> path;
+    qint64 start;
+    qint64 duration;
+    quint32 thread;
+};
+
+Histogram histograms[Profiler::PATH_COUNT];
+std::atomic<qint64> marks[Profiler::PATH_COUNT];
+
+std::atomic<quint32> frames[FRAME_HISTORY];
+std::atomic<quint32> frameNext(0);
+
+std::unique_ptr<TraceEvent[]> trace;
+std::atomic<int> traceNext(0);
+
+const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+
+int bucketOf(qint64 micros)
+{
+    if (micros < 1) return 0;
+    int index = (int)(std::log2((double)micros) * BUCKETS_PER_OCTAVE);
+    return std::min(index, BUCKETS - 1);
+}
+
+quint32 threadNumber()
+{
+    static thread_local quint32 number = (quint32)std::hash<std::thread::id>()(std::this_thread::get_id());
+    return number;
+}
+
+} //end of namespace
+
+std::atomic<bool> Profiler::on(false);
+
+void Profiler::setEnabled(bool enable)
+{
+    if (enable && !trace) {
+        trace.reset(new TraceEvent[TRACE_CAPACITY]);
+        reset();
+    }
+    on.store(enable, std::memory_order_relaxed);
+}
+
+void Profiler::reset()
+{
+    for (auto& h : histograms) {
+        for (auto& b : h.buckets)
+            b.store(0, std::memory_order_relaxed);
+        h.total.store(0, std::memory_order_relaxed);
+    }
+    for (auto& m : marks)
+        m.store(-1, std::memory_order_relaxed);
+    for (auto& f : frames)
+        f.store(0, std::memory_order_relaxed);
+    frameNext.store(0, std::memory_order_relaxed);
+
+    if (trace) {
+        for (int i = 0; i < TRACE_CAPACITY; i++)
+            trace[i].path.store(PATH_COUNT, std::memory_order_relaxed);
+    }
+    traceNext.store(0, std::memory_order_relaxed);
+}
+
+qint64 Profiler::now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - epoch).count();
+}
+
+void Profiler::record(Path path, qint64 start, qint64 end)
+{
+    qint64 duration = end - start;
+    Histogram& h = histograms[path];
+    h.buckets[bucketOf(duration)].fetch_add(1, std::memory_order_relaxed);
+    h.total.fetch_add(1, std::memory_order_relaxed);
+
+    if (path == FRAME) {
+        quint32 slot = frameNext.fetch_add(1, std::memory_order_relaxed) % FRAME_HISTORY;
+        frames[slot].store((quint32)duration, std::memory_order_relaxed);
+    }
+
+    if (!trace) return;
+    int slot = traceNext.fetch_add(1, std::memory_order_relaxed);
+    if (slot >= TRACE_CAPACITY) return;
+    TraceEvent& event = trace[slot];
+    event.start = start;
+    event.duration = duration;
+    event.thread = threadNumber();
+    event.path.store(path, std::memory_order_release);
+}
+
+void Profiler::mark(Path path)
+{
+    if (!enabled()) return;
+    // a pending mark is kept, the span runs from the first hover the paint answers
+    qint64 expected = -1;
+    marks[path].compare_exchange_strong(expected, now(), std::memory_order_relaxed);
+}
+
+void Profiler::complete(Path path)
+{
+    qint64 start = marks[path].exchange(-1, std::memory_order_relaxed);
+    if (start >= 0 && enabled()) record(path, start, now());
+}
+
+const char* Profiler::name(Path path)
+{
+    return PATH_NAMES[path];
+}
+
+quint64 Profiler::count(Path path)
+{
+    return histograms[path].total.load(std::memory_order_relaxed);
+}
+
+double Profiler::percentile(Path path, double p)
+{
+    const Histogram& h = histograms[path];
+    quint32 counts[BUCKETS];
+    quint64 total = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        counts[i] = h.buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (!total) return 0;
+
+    quint64 rank = (quint64)std::ceil(p * total);
+    quint64 seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        seen += counts[i];
+        if (seen >= rank && seen > 0)
+            return std::pow(2.0, (double)(i + 1) / BUCKETS_PER_OCTAVE);
+    }
+    return std::pow(2.0, (double)BUCKETS / BUCKETS_PER_OCTAVE);
+}
+
+void Profiler::frameTimes(std::vector<float>& ms)
+{
+    ms.clear();
+    quint32 next = frameNext.load(std::memory_order_relaxed);
+    quint32 count = std::min(next, (quint32)FRAME_HISTORY);
+    for (quint32 i = next - count; i != next; i++)
+        ms.push_back(frames[i % FRAME_HISTORY].load(std::memory_order_relaxed) / 1000.0f);
+}
+
+bool Profiler::dumpTrace(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) return false;
+
+    QByteArray json("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    int count = trace ? std::min(traceNext.load(std::memory_order_relaxed), TRACE_CAPACITY) : 0;
+    bool first = true;
+    for (int i = 0; i < count; i++) {
+        int path = trace[i].path.load(std::memory_order_acquire);
+        if (path == PATH_COUNT) continue;
+        if (!first) json += ",\n";
+        first = false;
+        json += QString("{\"name\":\"%1\",\"ph\":\"X\",\"ts\":%2,\"dur\":%3,\"pid\":1,\"tid\":%4}")
+                .arg(PATH_NAMES[path]).arg(trace[i].start).arg(trace[i].duration).arg(trace[i].thread)
+                .toUtf8();
+    }
+    json += "\n]}\n";
+    return file.write(json) == json.size();
+}
@@ -0,0 +1,73 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QString>
+#include <atomic>
+#include <vector>
+
+/**
+ *@brief latency of the interactive hot paths, shown as an overlay of the
+ * label view and dumped as a Chrome trace (chrome://tracing, Perfetto).
+ *
+ * Every path has a histogram of log-spaced buckets of atomic counters, so
+ * recording takes no lock and percentiles are read from the buckets while
+ * the paths keep recording. While the profiler is off a ProfileScope only
+ * loads one relaxed atomic flag.
+ */
+class Profiler
+{
+public:
+    enum Path {
+        HOVER_MOVE,
+        SEARCH_NN,
+        HOVER_ENTER,
+        HOVER_TO_PAINT,     // from a hover move until the next repaint of the view completes
+        ENDPOINT_CHANGE,
+        ACTION_PERFORM,
+        IMAGE_PAINT,
+        FRAME,              // one repaint of the view
+        PATH_COUNT
+    };
+
+    static bool enabled() { return on.load(std::memory_order_relaxed); }
+    static void setEnabled(bool enable);
+    // clears the histograms, the frame times and the trace
+    static void reset();
+
+    // microseconds on a monotonic clock
+    static qint64 now();
+    static void record(Path path, qint64 start, qint64 end);
+    // a span that ends on another call path, complete() records it if a mark is pending
+    static void mark(Path path);
+    static void complete(Path path);
+
+    static const char* name(Path path);
+    static quint64 count(Path path);
+    // upper bound of the bucket holding the p-th fraction of the samples, in microseconds
+    static double percentile(Path path, double p);
+    // the last frames in milliseconds, oldest first
+    static void frameTimes(std::vector<float>& ms);
+
+    // trace events recorded since the profiler was enabled, in the Chrome trace event format
+    static bool dumpTrace(const QString& fileName);
+
+private:
+    static std::atomic<bool> on;
+};
+
+/**
+ *@brief records the time from its construction to its destruction on one path.
+ */
+class ProfileScope
+{
+public:
+    explicit ProfileScope(Profiler::Path path)
+        : path(path), start(Profiler::enabled() ? Profiler::now() : -1) {}
+    ~ProfileScope() { if (start >= 0) Profiler::record(path, start, Profiler::now()); }
+
+private:
+    Profiler::Path path;
+    qint64 start;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,332 @@
+#include "regionbuilder.h"
+#include <opencv2/imgproc/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+struct ScanEdge {
+    float yMin;
+    float yMax;
+    float xAtMin;
+    float slope;    // dx/dy
+    bool operator<(const ScanEdge& other) const { return yMin < other.yMin; }
+};
+
+template <typename T>
+void fillSpans(cv::Mat& mask, int row, int originX, std::vector<float>& crossings, int value)
+{
+    std::sort(crossings.begin(), crossings.end());
+    T* out = mask.ptr<T>(row);
+    for (size_t i = 0; i + 1 < crossings.size(); i += 2) {
+        // pixel centers x+0.5 in [left, right)
+        int first = std::max(0, (int)std::ceil(crossings[i] - 0.5f) - originX);
+        int last = std::min(mask.cols, (int)std::ceil(crossings[i+1] - 0.5f) - originX);
+        for (int x = first; x < last; x++)
+            out[x] = (T)value;
+    }
+}
+
+cv::Point2f center(const cv::Point& p)
+{
+    return cv::Point2f(p.x + 0.5f, p.y + 0.5f);
+}
+
+} //end of namespace
+
+void RegionBuilder::build(const AnnotationModel& model)
+{
+    std::vector<Region> old;
+    old.swap(regions);
+    points.clear();
+    nodeIndex.clear();
+    parent.clear();
+    nodeLinks.clear();
+    otherEnd.clear();
+
+    auto isMember = [&model](int id) {
+        return id >= 0 && id < model.edgeCount() && model.edgeAlive(id) && model.edge(id).selected;
+    };
+
+    // a selected edge links its two ends
+    for (int id = 0; id < model.edgeCount(); id++) {
+        if (!isMember(id)) continue;
+        int head = node(AnnotationModel::endRef(id, AnnotationModel::HEAD));
+        int tail = node(AnnotationModel::endRef(id, AnnotationModel::TAIL));
+        otherEnd[head] = tail;
+        otherEnd[tail] = head;
+        parent[find(head)] = find(tail);
+    }
+
+    // connections between member points, connections to anything else are ignored
+    const auto& connections = model.connectionList();
+    linkNodes.assign(connections.size(), std::make_pair(-1, -1));
+    linkUsed.assign(connections.size(), 0);
+    for (int i = 0; i < (int)connections.size(); i++) {
+        const auto& c = connections[i];
+        bool firstMember = c.first.edge < 0 ? model.strayAlive(c.first.id) : isMember(c.first.edge);
+        bool secondMember = c.second.edge < 0 ? model.strayAlive(c.second.id) : isMember(c.second.edge);
+        if (!firstMember || !secondMember) continue;
+        int a = node(c.first);
+        int b = node(c.second);
+        linkNodes[i] = std::make_pair(a, b);
+        nodeLinks[a].push_back(i);
+        nodeLinks[b].push_back(i);
+        parent[find(a)] = find(b);
+    }
+
+    // one region per set
+    std::vector<int> regionOfRoot(points.size(), -1);
+    nodeRegion.assign(points.size(), -1);
+    for (int n = 0; n < (int)points.size(); n++) {
+        int root = find(n);
+        if (regionOfRoot[root] < 0) {
+            regionOfRoot[root] = (int)regions.size();
+            Region region;
+            region.start = -1;
+            region.closed = true;
+            regions.push_back(region);
+        }
+        Region& region = regions[regionOfRoot[root]];
+        nodeRegion[n] = regionOfRoot[root];
+        region.nodes.push_back(n);
+
+        // an edge end has one link through its edge, a stray point none
+        int degree = (int)nodeLinks[n].size() + (otherEnd[n] >= 0 ? 1 : 0);
+        if (degree != 2) region.closed = false;
+        if (degree == 1 && region.start < 0) region.start = n;
+    }
+    for (int i = 0; i < (int)linkNodes.size(); i++) {
+        if (linkNodes[i].first >= 0) regions[nodeRegion[linkNodes[i].first]].links.push_back(i);
+    }
+
+    // masks of old regions are reused when the polygon did not change
+    std::map<std::pair<float, float>, std::vector<int>> oldByStart;
+    for (int i = 0; i < (int)old.size(); i++) {
+        if (!old[i].mask.empty() && !old[i].polygon.empty())
+            oldByStart[std::make_pair(old[i].polygon[0].x, old[i].polygon[0].y)].push_back(i);
+    }
+
+    visited.assign(points.size(), 0);
+    for (auto& region : regions) {
+        if (region.start < 0) region.start = region.nodes.front();
+        walk(model, region);
+        if (region.polygon.empty()) continue;
+        auto candidates = oldByStart.find(std::make_pair(region.polygon[0].x, region.polygon[0].y));
+        if (candidates == oldByStart.end()) continue;
+        for (int i : candidates->second) {
+            if (old[i].polygon == region.polygon && !old[i].mask.empty()) {
+                region.mask = old[i].mask;
+                old[i].mask.release();
+                break;
+            }
+        }
+    }
+}
+
+int RegionBuilder::pointMoved(const AnnotationModel& model, const AnnotationModel::PointRef& point)
+{
+    int index = regionOf(point);
+    if (index < 0) return -1;
+
+    Region& region = regions[index];
+    for (int n : region.nodes)
+        visited[n] = 0;
+    for (int link : region.links)
+        linkUsed[link] = 0;
+    walk(model, region);
+    region.mask.release();
+    return index;
+}
+
+int RegionBuilder::regionOf(const AnnotationModel::PointRef& point) const
+{
+    auto it = nodeIndex.find(PointKey(point.edge, point.id));
+    return it == nodeIndex.end() ? -1 : nodeRegion[it->second];
+}
+
+int RegionBuilder::regionCount() const
+{
+    return (int)regions.size();
+}
+
+const RegionBuilder::Region& RegionBuilder::region(int index) const
+{
+    return regions[index];
+}
+
+const cv::Mat& RegionBuilder::mask(int index)
+{
+    Region& region = regions[index];
+    if (region.mask.empty() && region.bounds.area() > 0) {
+        region.mask = cv::Mat::zeros(region.bounds.size(), CV_8UC1);
+        fillPolygon(region.polygon, region.mask, 255, region.bounds.tl());
+    }
+    return region.mask;
+}
+
+int RegionBuilder::node(const AnnotationModel::PointRef& point)
+{
+    auto inserted = nodeIndex.emplace(PointKey(point.edge, point.id), (int)points.size());
+    if (inserted.second) {
+        points.push_back(point);
+        parent.push_back((int)parent.size());
+        nodeLinks.push_back(std::vector<int>());
+        otherEnd.push_back(-1);
+    }
+    return inserted.first->second;
+}
+
+int RegionBuilder::find(int node)
+{
+    // path halving
+    while (parent[node] != node) {
+        parent[node] = parent[parent[node]];
+        node = parent[node];
+    }
+    return node;
+}
+
+void RegionBuilder::walk(const AnnotationModel& model, Region& region)
+{
+    const auto& connections = model.connectionList();
+    region.polygon.clear();
+
+    int entry = region.start;
+    while (true) {
+        // the visible pixels from the entry end to the other end, or the stray point itself
+        const AnnotationModel::PointRef& ref = points[entry];
+        visited[entry] = 1;
+        int exit = entry;
+        if (ref.edge >= 0) {
+            const AnnotationModel::Edge& e = model.edge(ref.edge);
+            if (ref.id == AnnotationModel::HEAD) {
+                for (int i = e.head; i <= e.tail; i++) region.polygon.push_back(center(model.point(ref.edge, i)));
+            } else {
+                for (int i = e.tail; i >= e.head; i--) region.polygon.push_back(center(model.point(ref.edge, i)));
+            }
+            exit = otherEnd[entry];
+            visited[exit] = 1;
+        } else {
+            region.polygon.push_back(model.position(ref));
+        }
+
+        // follow an unused connection from the exit point
+        int next = -1;
+        for (int link : nodeLinks[exit]) {
+            if (linkUsed[link]) continue;
+            linkUsed[link] = 1;
+            const auto& c = connections[link];
+            // a traced connection contributes its pixels, stored from first to second
+            if (linkNodes[link].first == exit) {
+                next = linkNodes[link].second;
+                for (auto p = c.path.begin(); p != c.path.end(); p++) region.polygon.push_back(center(*p));
+            } else {
+                next = linkNodes[link].first;
+                for (auto p = c.path.rbegin(); p != c.path.rend(); p++) region.polygon.push_back(center(*p));
+            }
+            break;
+        }
+
+        // back at the start, at an open end, or at a branch already walked
+        if (next < 0 || visited[next]) break;
+        entry = next;
+    }
+
+    region.bounds = region.polygon.empty() ? cv::Rect() : cv::boundingRect(region.polygon);
+}
+
+void RegionBuilder::fillPolygon(const Polygon& polygon, cv::Mat& mask, int value, const cv::Point& origin)
+{
+    // edge table sorted by the top of each edge, horizontal edges never cross a scanline
+    std::vector<ScanEdge> edgeTable;
+    edgeTable.reserve(polygon.size());
+    for (size_t i = 0; i < polygon.size(); i++) {
+        cv::Point2f p = polygon[i];
+        cv::Point2f q = polygon[(i + 1) % polygon.size()];
+        if (p.y == q.y) continue;
+        if (p.y > q.y) std::swap(p, q);
+        ScanEdge e;
+        e.yMin = p.y;
+        e.yMax = q.y;
+        e.xAtMin = p.x;
+        e.slope = (q.x - p.x) / (q.y - p.y);
+        edgeTable.push_back(e);
+    }
+    if (edgeTable.empty()) return;
+    std::sort(edgeTable.begin(), edgeTable.end());
+
+    float top = edgeTable.front().yMin;
+    float bottom = top;
+    for (const auto& e : edgeTable) bottom = std::max(bottom, e.yMax);
+    int firstRow = std::max(origin.y, (int)std::floor(top));
+    int lastRow = std::min(origin.y + mask.rows - 1, (int)std::ceil(bottom));
+
+    std::vector<ScanEdge> active;
+    std::vector<float> crossings;
+    size_t pending = 0;
+    for (int row = firstRow; row <= lastRow; row++) {
+        // sample at the pixel center, edges are half open [yMin, yMax)
+        float y = row + 0.5f;
+        while (pending < edgeTable.size() && edgeTable[pending].yMin <= y)
+            active.push_back(edgeTable[pending++]);
+        active.erase(std::remove_if(active.begin(), active.end(),
+                                    [y](const ScanEdge& e) { return e.yMax <= y; }), active.end());
+
+        crossings.clear();
+        for (const auto& e : active)
+            crossings.push_back(e.xAtMin + (y - e.yMin) * e.slope);
+        if (mask.depth() == CV_16U)
+            fillSpans<ushort>(mask, row - origin.y, origin.x, crossings, value);
+        else
+            fillSpans<uchar>(mask, row - origin.y, origin.x, crossings, value);
+    }
+}
+
+size_t RegionBuilder::memoryBytes() const
+{
+    size_t bytes = points.capacity()*sizeof(AnnotationModel::PointRef)
+            + nodeIndex.size()*(sizeof(std::pair<const PointKey, int>) + 4*sizeof(void*))
+            + parent.capacity()*sizeof(int) + nodeLinks.capacity()*sizeof(std::vector<int>)
+            + otherEnd.capacity()*sizeof(int) + nodeRegion.capacity()*sizeof(int)
+            + linkNodes.capacity()*sizeof(std::pair<int, int>) + linkUsed.capacity() + visited.capacity()
+            + regions.capacity()*sizeof(Region);
+    for (const auto& links : nodeLinks)
+        bytes += links.capacity()*sizeof(int);
+    for (const auto& r : regions) {
+        bytes += r.polygon.capacity()*sizeof(cv::Point2f) + r.nodes.capacity()*sizeof(int)
+                + r.links.capacity()*sizeof(int) + r.mask.total()*r.mask.elemSize();
+    }
+    return bytes;
+}
+
+std::vector<int> RegionBuilder::edgesInPolygon(const AnnotationModel& model, const Polygon& polygon,
+                                               const cv::Rect& clip, double coverage)
+{
+    std::vector<int> found;
+    if (polygon.size() < 3) return found;
+    cv::Rect box = cv::boundingRect(polygon) & clip;
+    if (box.area() <= 0) return found;
+
+    // containment is a single lookup per pixel once the polygon is filled over its box
+    cv::Mat inside = cv::Mat::zeros(box.size(), CV_8UC1);
+    fillPolygon(polygon, inside, 255, box.tl());
+
+    for (int id = 0; id < model.edgeCount(); id++) {
+        if (!model.edgeAlive(id) || !model.mayIntersect(id, box)) continue;
+        const AnnotationModel::Edge& e = model.edge(id);
+        int visible = e.tail - e.head + 1;
+        if (visible <= 0) continue;
+        // the walk stops once more pixels are outside than the coverage leaves room for
+        int allowed = visible - (int)std::ceil(coverage * visible);
+        int outside = 0;
+        for (int i = e.head; i <= e.tail && outside <= allowed; i++) {
+            cv::Point p = model.point(id, i) - box.tl();
+            if (p.x < 0 || p.y < 0 || p.x >= box.width || p.y >= box.height || !inside.at<uchar>(p.y, p.x))
+                outside++;
+        }
+        if (outside <= allowed) found.push_back(id);
+    }
+    return found;
+}
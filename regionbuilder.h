@@ -0,0 +1,79 @@
+#ifndef REGIONBUILDER_H
+#define REGIONBUILDER_H
+
+#include <opencv2/core/core.hpp>
+#include <vector>
+#include <map>
+#include "annotationmodel.h"
+
+/**
+ *@brief object regions formed by selected edges and the connections
+ * between their ends, independent of Qt.
+ *
+ * Endpoints are the nodes of a graph, a selected edge joins its two ends
+ * and a connection joins the points it connects. Union-find groups the
+ * nodes into regions, a region is closed when every node has exactly two
+ * links, i.e. it is a single cycle. Each region is walked once into a
+ * polygon of pixel centers, its mask is rasterized on demand with an edge
+ * table scanline fill over the polygon bounds only.
+ *
+ * Moving an endpoint changes the geometry but not the graph, so only the
+ * region of that point is walked again and its mask dropped.
+ */
+class RegionBuilder
+{
+public:
+    typedef std::vector<cv::Point2f> Polygon;
+
+    struct Region {
+        int start;          // node the walk starts from, an open end if there is one
+        bool closed;
+        Polygon polygon;
+        cv::Rect bounds;    // pixels covered by the polygon
+        cv::Mat mask;       // CV_8UC1 over bounds, 255 inside; empty until mask() is asked
+        std::vector<int> nodes;
+        std::vector<int> links;
+    };
+
+    // rebuilds the graph and all polygons; masks of unchanged polygons are kept
+    void build(const AnnotationModel& model);
+    // walks the region of point again after the point moved, -1 if it is in none
+    int pointMoved(const AnnotationModel& model, const AnnotationModel::PointRef& point);
+
+    int regionOf(const AnnotationModel::PointRef& point) const;
+    int regionCount() const;
+    size_t memoryBytes() const;
+    const Region& region(int index) const;
+    const cv::Mat& mask(int index);
+
+    // even-odd scanline fill of pixels whose centers are inside the polygon;
+    // mask pixel (0, 0) is image pixel origin
+    static void fillPolygon(const Polygon& polygon, cv::Mat& mask, int value, const cv::Point& origin = cv::Point());
+    // alive edges with at least coverage of their visible pixels inside the polygon, for box and
+    // lasso selection; only edges whose chains meet the polygon's box, clipped to clip, are walked
+    static std::vector<int> edgesInPolygon(const AnnotationModel& model, const Polygon& polygon,
+                                           const cv::Rect& clip, double coverage);
+
+private:
+    typedef std::pair<int, int> PointKey;
+    int node(const AnnotationModel::PointRef& point);
+    int find(int node);
+    void walk(const AnnotationModel& model, Region& region);
+
+    // nodes, indexed by their order of appearance
+    std::vector<AnnotationModel::PointRef> points;
+    std::map<PointKey, int> nodeIndex;
+    std::vector<int> parent;
+    std::vector<std::vector<int>> nodeLinks;
+    std::vector<int> otherEnd;      // node of the other end of the edge, -1 for a stray point
+    std::vector<int> nodeRegion;
+
+    // per connection, the nodes it joins, -1 if it is not part of any region
+    std::vector<std::pair<int, int>> linkNodes;
+    std::vector<char> linkUsed;
+    std::vector<char> visited;
+
+    std::vector<Region> regions;
+};
+
+#endif // REGIONBUILDER_H
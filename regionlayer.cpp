@@ -0,0 +1,91 @@
+#include "regionlayer.h"
+#include "labelimage.h"
+#include <QPainter>
+#include <QImage>
+#include <QStyleOptionGraphicsItem>
+
+namespace
+{
+
+const QRgb FILL_COLOR = qRgba(255, 0, 0, 80);
+
+} //end of namespace
+
+RegionLayer::RegionLayer(LabelImage *labelImage)
+    : QGraphicsItem(labelImage), image(labelImage)
+{
+    colors.fill(qRgba(0, 0, 0, 0), 256);
+    colors[255] = FILL_COLOR;
+    // exposedRect is used to skip regions outside of the repainted area
+    setFlag(ItemUsesExtendedStyleOption);
+}
+
+void RegionLayer::rebuild()
+{
+    builder.build(image->model());
+
+    QRectF rect;
+    for (int i = 0; i < builder.regionCount(); i++) {
+        if (builder.region(i).closed) rect = rect.united(regionRect(i));
+    }
+    prepareGeometryChange();
+    bounds = rect;
+    update();
+}
+
+void RegionLayer::pointMoved(AnnotationModel::PointRef point)
+{
+    int index = builder.regionOf(point);
+    if (index < 0) return;
+
+    // only the region of the point is walked again, its mask is refilled on the next paint
+    QRectF before = regionRect(index);
+    builder.pointMoved(image->model(), point);
+    if (!builder.region(index).closed) return;
+
+    QRectF after = regionRect(index);
+    if (!bounds.contains(after)) {
+        prepareGeometryChange();
+        bounds = bounds.united(after);
+    }
+    update(before);
+    update(after);
+}
+
+int RegionLayer::regionCount() const
+{
+    return builder.regionCount();
+}
+
+QRectF RegionLayer::regionRect(int index) const
+{
+    const cv::Rect& r = builder.region(index).bounds;
+    QPointF topLeft = mapFromParent(image->image2item(QPointF(r.x, r.y)));
+    return QRectF(topLeft, QSizeF(r.width, r.height));
+}
+
+QRectF RegionLayer::boundingRect() const
+{
+    return bounds;
+}
+
+void RegionLayer::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *)
+{
+    for (int i = 0; i < builder.regionCount(); i++) {
+        if (!builder.region(i).closed) continue;
+        QRectF rect = regionRect(i);
+        if (!rect.intersects(option->exposedRect)) continue;
+
+        // wraps the mask without copying, the color table maps 255 to the fill
+        const cv::Mat& mask = builder.mask(i);
+        if (mask.empty()) continue;
+        QImage overlay(mask.data, mask.cols, mask.rows, (int)mask.step, QImage::Format_Indexed8);
+        overlay.setColorTable(colors);
+        painter->drawImage(rect.topLeft(), overlay);
+    }
+}
+
+size_t RegionLayer::memoryBytes() const
+{
+    return builder.memoryBytes();
+}
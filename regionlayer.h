@@ -0,0 +1,39 @@
+#ifndef REGIONLAYER_H
+#define REGIONLAYER_H
+
+#include <QGraphicsItem>
+#include <QVector>
+#include <QRgb>
+#include "regionbuilder.h"
+
+class LabelImage;
+
+/**
+ *@brief fills the closed regions of the AnnotationModel, child of the LabelImage
+ */
+class RegionLayer : public QGraphicsItem
+{
+public:
+    RegionLayer(LabelImage *labelImage);
+
+    // after selections, splits or connections changed the graph
+    void rebuild();
+    void pointMoved(AnnotationModel::PointRef point);
+    int regionCount() const;
+    // polygons and cached masks
+    size_t memoryBytes() const;
+
+    QRectF boundingRect() const override;
+    void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+private:
+    QRectF regionRect(int index) const;
+
+    RegionBuilder builder;
+    LabelImage* image;
+    QRectF bounds;
+    // masks are 0 or 255, drawn as indexed images over these colors
+    QVector<QRgb> colors;
+};
+
+#endif // REGIONLAYER_H
@@ -0,0 +1,211 @@
+#include "replayharness.h"
+#include "inputrecorder.h"
+#include "labelwidget.h"
+#include "sessionstate.h"
+#include "imagebuffer.h"
+#include "annotationmodel.h"
+#include "profiler.h"
+#include "ED.h"
+#include <QApplication>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QKeyEvent>
+#include <QKeySequence>
+#include <QScrollBar>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QFile>
+#include <QTextStream>
+#include <opencv2/highgui/highgui.hpp>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+#include <map>
+
+namespace
+{
+
+// edge detection and item insertion of a large image stay well below this
+const qint64 LOAD_TIMEOUT_MS = 120000;
+
+QString eventName(const InputRecorder::Event& e)
+{
+    switch (e.type) {
+    case InputRecorder::Event::MOUSE_MOVE:
+        return e.buttons ? "drag" : "hover";
+    case InputRecorder::Event::MOUSE_PRESS:
+        return "press";
+    case InputRecorder::Event::MOUSE_RELEASE:
+        return "release";
+    case InputRecorder::Event::WHEEL:
+        return "wheel";
+    default:
+        return "key " + QKeySequence(e.value).toString();
+    }
+}
+
+void send(LabelWidget* view, const InputRecorder::Event& e)
+{
+    QWidget* viewport = view->viewport();
+    QPointF window = viewport->mapTo(viewport->window(), e.pos.toPoint());
+    QPointF global = viewport->mapToGlobal(e.pos.toPoint());
+    Qt::MouseButton button = (Qt::MouseButton)e.button;
+    Qt::MouseButtons buttons = (Qt::MouseButtons)e.buttons;
+    Qt::KeyboardModifiers modifiers = (Qt::KeyboardModifiers)e.modifiers;
+
+    switch (e.type) {
+    case InputRecorder::Event::MOUSE_MOVE: {
+        QMouseEvent event(QEvent::MouseMove, e.pos, window, global, Qt::NoButton, buttons, modifiers);
+        QApplication::sendEvent(viewport, &event);
+        break;
+    }
+    case InputRecorder::Event::MOUSE_PRESS:
+    case InputRecorder::Event::MOUSE_RELEASE: {
+        QEvent::Type type = e.type == InputRecorder::Event::MOUSE_PRESS ? QEvent::MouseButtonPress
+                                                                         : QEvent::MouseButtonRelease;
+        QMouseEvent event(type, e.pos, window, global, button, buttons, modifiers);
+        QApplication::sendEvent(viewport, &event);
+        break;
+    }
+    case InputRecorder::Event::WHEEL: {
+        QWheelEvent event(e.pos, global, e.value, buttons, modifiers, Qt::Vertical);
+        QApplication::sendEvent(viewport, &event);
+        break;
+    }
+    default: {
+        QKeyEvent event(QEvent::KeyPress, e.value, modifiers);
+        QApplication::sendEvent(view, &event);
+    }
+    }
+}
+
+double percentile(std::vector<double>& sorted, double p)
+{
+    if (sorted.empty()) return 0;
+    size_t rank = (size_t)std::ceil(p * sorted.size());
+    return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+} //end of namespace
+
+int ReplayHarness::run(const QString& recording, const QString& reportFile)
+{
+    QTextStream out(stdout);
+    InputRecorder::Header header;
+    std::vector<InputRecorder::Event> events;
+    if (!InputRecorder::load(recording, header, events)) {
+        out << "cannot read recording " << recording << endl;
+        return 1;
+    }
+
+    cv::Mat image = cv::imread(header.imagePath.toStdString());
+    if (image.empty()) {
+        out << "cannot read image " << header.imagePath << endl;
+        return 1;
+    }
+    ImageBuffer buffer(image);
+    AnnotationModel edges;
+    std::vector<std::list<cv::Point>> detected;
+    ED::detectEdgesSmoothed(buffer.luminance(), detected, header.proposalThresh, header.anchorInterval,
+                            header.anchorThresh);
+    edges.addEdges(detected);
+    edges.markBase();
+
+    // checked here, a session the widget cannot restore would only start unedited
+    AnnotationModel restored = edges;
+    if (!header.session.isEmpty() && !SessionState::modelFromState(header.session, header.imagePath, restored)) {
+        out << "cannot restore the recorded session over the edges of " << header.imagePath << endl;
+        return 1;
+    }
+
+    // no session path, the replay must not journal into the session of the image
+    LabelWidget view;
+    view.resize(header.viewportSize + (view.size() - view.viewport()->size()));
+    view.show();
+    view.showImage(buffer, edges, QString());
+    view.restoreSession(header.session);
+    QElapsedTimer loading;
+    loading.start();
+    while (!view.ready()) {
+        if (loading.elapsed() > LOAD_TIMEOUT_MS) {
+            out << "timed out loading " << header.imagePath << endl;
+            return 1;
+        }
+        QApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    view.setTransform(header.transform);
+    view.horizontalScrollBar()->setValue(header.scrollX);
+    view.verticalScrollBar()->setValue(header.scrollY);
+    QApplication::processEvents();
+    view.viewport()->repaint();
+
+    Profiler::setEnabled(true);
+    Profiler::reset();
+    std::map<QString, std::vector<double>> latency;
+    QElapsedTimer wall;
+    wall.start();
+    std::clock_t cpuStart = std::clock();
+    for (const auto& e : events) {
+        QElapsedTimer timer;
+        timer.start();
+        send(&view, e);
+        QApplication::processEvents();
+        view.viewport()->repaint();
+        latency[eventName(e)].push_back(timer.nsecsElapsed() / 1e6);
+    }
+    double cpuMs = 1000.0 * (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+    double wallMs = wall.nsecsElapsed() / 1e6;
+    Profiler::setEnabled(false);
+
+    QJsonObject byEvent;
+    out << QString("%1 %2 %3 %4 %5").arg("event", -16).arg("count", 8).arg("p50 ms", 10).arg("p99 ms", 10)
+           .arg("max ms", 10) << endl;
+    for (auto& entry : latency) {
+        std::vector<double>& samples = entry.second;
+        std::sort(samples.begin(), samples.end());
+        double p50 = percentile(samples, 0.5), p99 = percentile(samples, 0.99);
+        out << QString("%1 %2 %3 %4 %5").arg(entry.first, -16).arg(samples.size(), 8)
+               .arg(p50, 10, 'f', 3).arg(p99, 10, 'f', 3).arg(samples.back(), 10, 'f', 3) << endl;
+        QJsonObject stats;
+        stats["count"] = (double)samples.size();
+        stats["p50_ms"] = p50;
+        stats["p99_ms"] = p99;
+        stats["max_ms"] = samples.back();
+        byEvent[entry.first] = stats;
+    }
+
+    QJsonObject byPath;
+    out << endl;
+    for (int i = 0; i < Profiler::PATH_COUNT; i++) {
+        Profiler::Path path = (Profiler::Path)i;
+        if (!Profiler::count(path)) continue;
+        double p50 = Profiler::percentile(path, 0.5) / 1000.0, p99 = Profiler::percentile(path, 0.99) / 1000.0;
+        out << QString("%1 %2 %3 %4").arg(Profiler::name(path), -22).arg(Profiler::count(path), 8)
+               .arg(p50, 10, 'f', 3).arg(p99, 10, 'f', 3) << endl;
+        QJsonObject stats;
+        stats["count"] = (double)Profiler::count(path);
+        stats["p50_ms"] = p50;
+        stats["p99_ms"] = p99;
+        byPath[Profiler::name(path)] = stats;
+    }
+    out << endl << "events " << events.size() << ", wall " << wallMs << " ms, cpu " << cpuMs << " ms" << endl;
+
+    if (!reportFile.isEmpty()) {
+        QJsonObject root;
+        root["recording"] = recording;
+        root["image"] = header.imagePath;
+        root["events"] = (double)events.size();
+        root["wall_ms"] = wallMs;
+        root["cpu_ms"] = cpuMs;
+        root["latency"] = byEvent;
+        root["profiler"] = byPath;
+        QFile file(reportFile);
+        QByteArray json = QJsonDocument(root).toJson();
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+            out << "cannot write " << reportFile << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
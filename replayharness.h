@@ -0,0 +1,25 @@
+#ifndef REPLAYHARNESS_H
+#define REPLAYHARNESS_H
+
+#include <QString>
+
+/**
+ *@brief replays an InputRecorder file against a LabelWidget and reports the
+ * latency of every event, for hover, split and undo benchmarks.
+ *
+ * Meant to run under QT_QPA_PLATFORM=offscreen, which main() selects for
+ * --replay. The widget gets the recorded viewport size, transform and
+ * starting session with its undo history, then the events are sent back
+ * to back. One event is timed
+ * from its delivery until the events it posted are processed and the
+ * viewport has repainted. The profiler runs during the replay, so the hot
+ * paths are broken down as well.
+ */
+class ReplayHarness
+{
+public:
+    // prints the report to stdout and writes it as JSON if reportFile is set, returns the exit code
+    static int run(const QString& recording, const QString& reportFile = QString());
+};
+
+#endif // REPLAYHARNESS_H
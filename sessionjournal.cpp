@@ -0,0 +1,320 @@
+#include "sessionjournal.h"
+#include <QDataStream>
+#include <QDir>
+#include <QSaveFile>
+#include <chrono>
+#include <algorithm>
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+
+const quint32 SNAPSHOT_MAGIC = 0x42594c53; // "BYLS"
+const char* SNAPSHOT_FILE = "snapshot.bin";
+const char* JOURNAL_FILE = "journal.bin";
+// journal is forced to disk at most this often
+const int SYNC_INTERVAL_MS = 1000;
+// the framing only holds integers and byte arrays, fixed so any Qt 5 reads the same bytes
+const QDataStream::Version STREAM_VERSION = QDataStream::Qt_5_0;
+
+quint16 checksum(const QByteArray& data)
+{
+    return qChecksum(data.constData(), data.size());
+}
+
+void syncFile(QFile& file)
+{
+    file.flush();
+#ifdef Q_OS_WIN
+    _commit(file.handle());
+#else
+    fsync(file.handle());
+#endif
+}
+
+// deletes closed journals one by one, the destructor drains the queue at exit
+class Closer
+{
+public:
+    Closer() : stopping(false)
+    {
+        thread = std::thread(&Closer::run, this);
+    }
+
+    ~Closer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        thread.join();
+    }
+
+    void add(SessionJournal* journal, const QString& dir)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(journal);
+            closing.push_back(dir);
+        }
+        wake.notify_one();
+    }
+
+    // blocks while a journal of dir is still closing
+    void waitFor(const QString& dir)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this, &dir]{
+            return std::find(closing.begin(), closing.end(), dir) == closing.end();
+        });
+    }
+
+private:
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this]{ return stopping || !queue.empty(); });
+            if (queue.empty()) break;
+            SessionJournal* journal = queue.front();
+            queue.pop_front();
+            lock.unlock();
+
+            // joins the writer thread after its last writes
+            delete journal;
+
+            lock.lock();
+            closing.erase(closing.begin());
+            done.notify_all();
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::deque<SessionJournal*> queue;
+    // session directories of the queued journals and the one being deleted, in order
+    std::deque<QString> closing;
+    bool stopping;
+    std::thread thread;
+};
+
+Closer& closer()
+{
+    static Closer instance;
+    return instance;
+}
+
+} //end of namespace
+
+SessionJournal::SessionJournal(const QString& sessionDir)
+    : dir(sessionDir), nextSeq(1), stopping(false), dirty(false)
+{
+    // the last snapshot of a previous journal has to land before load() reads it
+    closer().waitFor(dir);
+    writer = std::thread(&SessionJournal::run, this);
+}
+
+SessionJournal::~SessionJournal()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    writer.join();
+}
+
+void SessionJournal::close(SessionJournal* journal)
+{
+    if (journal) closer().add(journal, journal->dir);
+}
+
+QString SessionJournal::sessionDirFor(const QString& imagePath)
+{
+    return imagePath + ".bylabel";
+}
+
+bool SessionJournal::readSnapshot(const QString& sessionDir, QByteArray& snapshot, quint64& seq)
+{
+    snapshot.clear();
+    seq = 0;
+
+    QFile snapshotFile(QDir(sessionDir).filePath(SNAPSHOT_FILE));
+    if (!snapshotFile.open(QIODevice::ReadOnly)) return false;
+
+    QDataStream in(&snapshotFile);
+    in.setVersion(STREAM_VERSION);
+    quint32 magic;
+    quint64 snapshotSeq;
+    QByteArray state;
+    quint16 crc;
+    in >> magic >> snapshotSeq >> state >> crc;
+    if (in.status() != QDataStream::Ok || magic != SNAPSHOT_MAGIC || crc != checksum(state))
+        return false;
+    snapshot = state;
+    seq = snapshotSeq;
+    return true;
+}
+
+bool SessionJournal::load(QByteArray& snapshot, std::vector<QByteArray>& records)
+{
+    quint64 snapshotSeq = 0;
+    readSnapshot(dir, snapshot, snapshotSeq);
+
+    quint64 lastSeq = snapshotSeq;
+    QFile journalFile(QDir(dir).filePath(JOURNAL_FILE));
+    if (journalFile.open(QIODevice::ReadWrite)) {
+        qint64 validSize = readRecords(journalFile, snapshotSeq, records, lastSeq);
+        // drop the torn tail so new records are not appended after garbage
+        if (validSize < journalFile.size())
+            journalFile.resize(validSize);
+    } else {
+        records.clear();
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    nextSeq = lastSeq + 1;
+    return !snapshot.isEmpty() || !records.empty();
+}
+
+bool SessionJournal::readSession(const QString& sessionDir, QByteArray& snapshot, std::vector<QByteArray>& records)
+{
+    quint64 snapshotSeq = 0;
+    readSnapshot(sessionDir, snapshot, snapshotSeq);
+
+    records.clear();
+    quint64 lastSeq = snapshotSeq;
+    QFile journalFile(QDir(sessionDir).filePath(JOURNAL_FILE));
+    if (journalFile.open(QIODevice::ReadOnly))
+        readRecords(journalFile, snapshotSeq, records, lastSeq);
+    return !snapshot.isEmpty() || !records.empty();
+}
+
+qint64 SessionJournal::readRecords(QFile& journalFile, quint64 snapshotSeq,
+                                   std::vector<QByteArray>& records, quint64& lastSeq)
+{
+    records.clear();
+    QDataStream in(&journalFile);
+    in.setVersion(STREAM_VERSION);
+    qint64 validSize = 0;
+    while (!in.atEnd()) {
+        quint64 seq;
+        QByteArray data;
+        quint16 crc;
+        in >> seq >> data >> crc;
+        // a torn write at the end of the journal, stop here
+        if (in.status() != QDataStream::Ok || crc != checksum(data)) break;
+        validSize = journalFile.pos();
+        // already part of the snapshot
+        if (seq <= snapshotSeq) continue;
+        records.push_back(data);
+        lastSeq = seq;
+    }
+    return validSize;
+}
+
+void SessionJournal::append(const QByteArray& record)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Task task;
+        task.isSnapshot = false;
+        task.seq = nextSeq++;
+        task.data = record;
+        queue.push_back(task);
+    }
+    wake.notify_one();
+}
+
+void SessionJournal::snapshot(const QByteArray& state)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Task task;
+        task.isSnapshot = true;
+        // covers every record queued before it
+        task.seq = nextSeq - 1;
+        task.data = state;
+        queue.push_back(task);
+    }
+    wake.notify_one();
+}
+
+void SessionJournal::run()
+{
+    auto lastSync = std::chrono::steady_clock::now();
+    std::unique_lock<std::mutex> lock(mutex);
+
+    while (true) {
+        wake.wait_for(lock, std::chrono::milliseconds(SYNC_INTERVAL_MS),
+                      [this]{ return stopping || !queue.empty(); });
+        bool stop = stopping;
+        std::deque<Task> tasks;
+        tasks.swap(queue);
+        lock.unlock();
+
+        for (const auto& task : tasks) {
+            if (task.isSnapshot)
+                writeSnapshot(task);
+            else
+                writeRecord(task);
+        }
+        if (journal.isOpen())
+            journal.flush();
+
+        auto now = std::chrono::steady_clock::now();
+        if (dirty && (stop || now - lastSync >= std::chrono::milliseconds(SYNC_INTERVAL_MS))) {
+            syncFile(journal);
+            dirty = false;
+            lastSync = now;
+        }
+
+        lock.lock();
+        if (stop && queue.empty()) break;
+    }
+    lock.unlock();
+    journal.close();
+}
+
+void SessionJournal::openJournal(bool truncate)
+{
+    // the session directory only appears once something is written
+    QDir().mkpath(dir);
+    journal.close();
+    journal.setFileName(QDir(dir).filePath(JOURNAL_FILE));
+    journal.open(QIODevice::WriteOnly | (truncate ? QIODevice::Truncate : QIODevice::Append));
+}
+
+void SessionJournal::writeRecord(const Task& task)
+{
+    if (!journal.isOpen())
+        openJournal(false);
+
+    QDataStream out(&journal);
+    out.setVersion(STREAM_VERSION);
+    out << task.seq << task.data << checksum(task.data);
+    dirty = true;
+}
+
+void SessionJournal::writeSnapshot(const Task& task)
+{
+    // written to a temporary file, synced and renamed over the old snapshot on commit,
+    // a crash leaves either the old or the new snapshot
+    QDir().mkpath(dir);
+    QSaveFile file(QDir(dir).filePath(SNAPSHOT_FILE));
+    if (!file.open(QIODevice::WriteOnly)) return;
+    QDataStream out(&file);
+    out.setVersion(STREAM_VERSION);
+    out << SNAPSHOT_MAGIC << task.seq << task.data << checksum(task.data);
+    if (!file.commit()) return;
+
+    // records up to task.seq are in the snapshot now
+    openJournal(true);
+    dirty = true;
+}
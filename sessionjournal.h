@@ -0,0 +1,78 @@
+#ifndef SESSIONJOURNAL_H
+#define SESSIONJOURNAL_H
+
+#include <QByteArray>
+#include <QString>
+#include <QFile>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+/**
+ *@brief append-only binary journal of committed edits plus compacted
+ * snapshots, stored in a session directory next to the image.
+ *
+ * All disk I/O happens on a writer thread: append() and snapshot() only
+ * queue the bytes. Journal writes are buffered and fsynced at most once per
+ * syncInterval. A snapshot is written to a temporary file, synced and
+ * renamed, then the journal is truncated. Every record carries a sequence
+ * number, so records already covered by the snapshot are skipped on load
+ * if a crash happens between the rename and the truncation. A torn record
+ * at the end of the journal fails its checksum and ends the replay.
+ *
+ * close() hands a journal to a closer thread that outlives its owner, the
+ * owner does not wait for the last writes. Opening the same session again
+ * waits until they are done.
+ */
+class SessionJournal
+{
+public:
+    explicit SessionJournal(const QString& sessionDir);
+    ~SessionJournal();
+
+    // reads the last snapshot and the records written after it, call before append()
+    bool load(QByteArray& snapshot, std::vector<QByteArray>& records);
+
+    void append(const QByteArray& record);
+    void snapshot(const QByteArray& state);
+
+    // finishes the queued writes and deletes the journal on the closer thread, returns at once
+    static void close(SessionJournal* journal);
+
+    static QString sessionDirFor(const QString& imagePath);
+    // read-only access to the last snapshot, for tools that do not edit the session
+    static bool readSnapshot(const QString& sessionDir, QByteArray& snapshot, quint64& seq);
+    // like load(), but leaves the files untouched and the journal may be in use
+    static bool readSession(const QString& sessionDir, QByteArray& snapshot, std::vector<QByteArray>& records);
+
+private:
+    struct Task {
+        bool isSnapshot;
+        quint64 seq;
+        QByteArray data;
+    };
+
+    // records after snapshotSeq, returns the size of the intact part of the journal
+    static qint64 readRecords(QFile& journalFile, quint64 snapshotSeq,
+                              std::vector<QByteArray>& records, quint64& lastSeq);
+
+    void run();
+    void openJournal(bool truncate);
+    void writeRecord(const Task& task);
+    void writeSnapshot(const Task& task);
+
+    QString dir;
+    QFile journal;
+    quint64 nextSeq;
+
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<Task> queue;
+    bool stopping;
+    bool dirty;
+};
+
+#endif // SESSIONJOURNAL_H
@@ -0,0 +1,37 @@
+#include "sessionstate.h"
+#include "edgedetectjob.h"
+#include "imagebuffer.h"
+#include <opencv2/highgui/highgui.hpp>
+#include <vector>
+
+void SessionState::writeModel(QDataStream& out, const AnnotationModel& model)
+{
+    std::vector<char> bytes;
+    model.serialize(bytes, true);
+    out << QByteArray::fromRawData(bytes.data(), (int)bytes.size());
+}
+
+bool SessionState::readModel(QDataStream& in, AnnotationModel& model)
+{
+    QByteArray bytes;
+    in >> bytes;
+    return in.status() == QDataStream::Ok && model.deserialize(bytes.constData(), bytes.size());
+}
+
+bool SessionState::modelFromState(const QByteArray& state, const QString& imagePath, AnnotationModel& model)
+{
+    QDataStream in(state);
+    in.setVersion(STREAM_VERSION);
+    QByteArray bytes;
+    in >> bytes;
+    if (in.status() != QDataStream::Ok) return false;
+
+    if (AnnotationModel::omitsBase(bytes.constData(), bytes.size()) && !model.hasBase()) {
+        // the same detection the session was recorded over
+        cv::Mat image = cv::imread(imagePath.toStdString());
+        if (image.empty()) return false;
+        model.clear();
+        EdgeDetectJob::detect(ImageBuffer(image), model, imagePath);
+    }
+    return model.deserialize(bytes.constData(), bytes.size());
+}
@@ -0,0 +1,34 @@
+#ifndef SESSIONSTATE_H
+#define SESSIONSTATE_H
+
+#include <QByteArray>
+#include <QDataStream>
+#include <QString>
+#include "annotationmodel.h"
+
+/**
+ *@brief layout of a session state: the edits over the detected edges,
+ * then the undo and redo history, written by LabelImage into snapshots
+ * and recordings.
+ *
+ * The model part is read and written here without a scene, for the
+ * exporter and the replay harness; the history needs the image the
+ * actions apply to and stays with LabelImage.
+ */
+class SessionState
+{
+public:
+    // states and journal records only hold integers, byte arrays and points, fixed so any Qt 5 reads them
+    static const QDataStream::Version STREAM_VERSION = QDataStream::Qt_5_0;
+
+    // edits and bridges only, the detected pool is the bulk of the model
+    static void writeModel(QDataStream& out, const AnnotationModel& model);
+    // a state without the detected edges is restored onto the ones already in model
+    static bool readModel(QDataStream& in, AnnotationModel& model);
+
+    // the model part of a state, without the history; the detected edges are
+    // detected on imagePath if the state leaves them out and model has none
+    static bool modelFromState(const QByteArray& state, const QString& imagePath, AnnotationModel& model);
+};
+
+#endif // SESSIONSTATE_H
@@ -0,0 +1,24 @@
+#-------------------------------------------------
+#
+# Qt-free checks of the annotation model, run the built binary
+#
+#-------------------------------------------------
+
+TARGET = tst_annotationmodel
+TEMPLATE = app
+CONFIG += console c++11
+CONFIG -= qt app_bundle
+
+INCLUDEPATH += ..
+
+SOURCES += \
+    tst_annotationmodel.cpp \
+    ../annotationmodel.cpp \
+    ../regionbuilder.cpp
+
+HEADERS += \
+    ../annotationmodel.h \
+    ../regionbuilder.h
+
+CONFIG += link_pkgconfig
+PKGCONFIG += opencv
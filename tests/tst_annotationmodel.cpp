@@ -0,0 +1,415 @@
+#include "annotationmodel.h"
+#include "regionbuilder.h"
+#include <cstdio>
+#include <cstdlib>
+#include <list>
+#include <vector>
+
+namespace
+{
+
+int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            failures++; \
+        } \
+    } while (0)
+
+std::list<cv::Point> line(cv::Point from, cv::Point step, int count)
+{
+    std::list<cv::Point> points;
+    for (int i = 0; i < count; i++)
+        points.push_back(cv::Point(from.x + i*step.x, from.y + i*step.y));
+    return points;
+}
+
+// every pool pixel resolves to an alive edge at the same point, and alive edges hold all their pixels
+void checkPixels(const AnnotationModel& model)
+{
+    int located = 0;
+    for (int i = 0; i < model.pixelCount(); i++) {
+        int id, index;
+        if (!model.locatePixel(i, id, index)) continue;
+        located++;
+        CHECK(model.edgeAlive(id));
+        CHECK(index >= 0 && index < model.edge(id).count);
+        CHECK(model.point(id, index) == model.pixel(i));
+    }
+    int held = 0;
+    for (int id = 0; id < model.edgeCount(); id++) {
+        if (model.edgeAlive(id)) held += model.edge(id).count;
+    }
+    CHECK(located == held);
+}
+
+// consecutive pixels of an edge are 8-connected
+bool connected(const AnnotationModel& model, int id)
+{
+    for (int i = 1; i < model.edge(id).count; i++) {
+        cv::Point d = model.point(id, i) - model.point(id, i - 1);
+        if (std::abs(d.x) > 1 || std::abs(d.y) > 1) return false;
+    }
+    return true;
+}
+
+// visible pixels and selection of the alive edges, by id
+std::vector<std::vector<int>> visibleState(const AnnotationModel& model)
+{
+    std::vector<std::vector<int>> state(model.edgeCount());
+    for (int id = 0; id < model.edgeCount(); id++) {
+        if (!model.edgeAlive(id)) continue;
+        const AnnotationModel::Edge& e = model.edge(id);
+        state[id].push_back(e.selected);
+        for (int i = e.head; i <= e.tail; i++) {
+            cv::Point p = model.point(id, i);
+            state[id].push_back(p.x);
+            state[id].push_back(p.y);
+        }
+    }
+    // trailing retired slots do not change what is shown
+    while (!state.empty() && state.back().empty())
+        state.pop_back();
+    return state;
+}
+
+std::vector<char> bytes(const AnnotationModel& model)
+{
+    std::vector<char> out;
+    model.serialize(out);
+    return out;
+}
+
+AnnotationModel threeEdges()
+{
+    AnnotationModel model;
+    std::vector<std::list<cv::Point>> edges;
+    edges.push_back(line(cv::Point(0, 5), cv::Point(1, 0), 20));
+    edges.push_back(line(cv::Point(30, 10), cv::Point(0, 1), 15));
+    edges.push_back(line(cv::Point(40, 40), cv::Point(1, 1), 10));
+    model.addEdges(edges);
+    return model;
+}
+
+void testSplitMergeSplit()
+{
+    AnnotationModel model = threeEdges();
+    checkPixels(model);
+
+    int a = -1, b = -1;
+    CHECK(model.splitEdge(0, 9, a, b));
+    CHECK(!model.edgeAlive(0));
+    CHECK(model.point(b, 0) == cv::Point(10, 5));
+    checkPixels(model);
+    // a retired edge cannot be split again
+    int x = -1, y = -1;
+    CHECK(!model.splitEdge(0, 3, x, y));
+
+    int merged = -1, bridge = -1;
+    CHECK(model.mergeEdges(b, AnnotationModel::TAIL, 1, AnnotationModel::HEAD, merged, bridge));
+    CHECK(bridge >= 0);
+    const AnnotationModel::Edge& m = model.edge(merged);
+    CHECK(model.point(merged, 0) == cv::Point(10, 5));
+    CHECK(model.point(merged, m.count - 1) == cv::Point(30, 24));
+    CHECK(m.count == 10 + model.edge(bridge).count + 15);
+    CHECK(connected(model, merged));
+    checkPixels(model);
+
+    int c = -1, d = -1;
+    CHECK(model.splitEdge(merged, 12, c, d));
+    CHECK(model.point(c, 12) == model.point(merged, 12));
+    CHECK(model.point(d, 0) == model.point(merged, 13));
+    CHECK(connected(model, c) && connected(model, d));
+    checkPixels(model);
+}
+
+void testMergeReversed()
+{
+    AnnotationModel model = threeEdges();
+    // head to head: the first edge runs backwards into the second
+    int merged = -1, bridge = -1;
+    CHECK(model.mergeEdges(1, AnnotationModel::HEAD, 0, AnnotationModel::HEAD, merged, bridge));
+    CHECK(model.point(merged, 0) == cv::Point(30, 24));
+    CHECK(model.point(merged, model.edge(merged).count - 1) == cv::Point(19, 5));
+    CHECK(connected(model, merged));
+    checkPixels(model);
+
+    int c = -1, d = -1;
+    CHECK(model.splitEdge(merged, 4, c, d));
+    checkPixels(model);
+}
+
+void testUndoRedo()
+{
+    AnnotationModel model = threeEdges();
+    std::vector<std::vector<int>> initial = visibleState(model);
+
+    int a = -1, b = -1;
+    CHECK(model.splitEdge(0, 9, a, b));
+    int merged = -1, bridge = -1;
+    CHECK(model.mergeEdges(b, AnnotationModel::TAIL, 1, AnnotationModel::HEAD, merged, bridge));
+    int c = -1, d = -1;
+    CHECK(model.splitEdge(merged, 12, c, d));
+    std::vector<std::vector<int>> edited = visibleState(model);
+
+    size_t size = 0;
+    for (int cycle = 0; cycle < 10; cycle++) {
+        model.unsplitEdge(merged, c, d);
+        checkPixels(model);
+        model.unmergeEdges(b, 1, merged);
+        checkPixels(model);
+        model.unsplitEdge(0, a, b);
+        checkPixels(model);
+        CHECK(visibleState(model) == initial);
+
+        // redo with the recorded ids, as the history and the journal do
+        CHECK(model.splitEdge(0, 9, a, b));
+        CHECK(model.mergeEdges(b, AnnotationModel::TAIL, 1, AnnotationModel::HEAD, merged, bridge));
+        CHECK(model.splitEdge(merged, 12, c, d));
+        checkPixels(model);
+        CHECK(visibleState(model) == edited);
+
+        // neither the pool nor the pieces grow with repeated redos
+        if (cycle == 0)
+            size = bytes(model).size();
+        CHECK(bytes(model).size() == size);
+    }
+}
+
+void testSerialize()
+{
+    AnnotationModel model = threeEdges();
+    int a = -1, b = -1;
+    CHECK(model.splitEdge(0, 9, a, b));
+    int merged = -1, bridge = -1;
+    CHECK(model.mergeEdges(b, AnnotationModel::TAIL, 1, AnnotationModel::HEAD, merged, bridge));
+    model.setSelected(merged, true);
+    model.setEndIndex(2, AnnotationModel::HEAD, 2);
+    int stray = model.addStrayPoint(cv::Point2f(3.5f, 7.5f));
+    std::vector<cv::Point> path;
+    path.push_back(cv::Point(1, 1));
+    model.addConnection(AnnotationModel::endRef(merged, AnnotationModel::TAIL), AnnotationModel::strayRef(stray), path);
+
+    std::vector<char> saved = bytes(model);
+    AnnotationModel loaded;
+    CHECK(loaded.deserialize(saved.data(), saved.size()));
+    CHECK(bytes(loaded) == saved);
+    CHECK(visibleState(loaded) == visibleState(model));
+    CHECK(loaded.connectionList().size() == 1);
+    CHECK(loaded.connectionList()[0].path == path);
+    checkPixels(loaded);
+
+    // the history still applies to the loaded model
+    loaded.unmergeEdges(b, 1, merged);
+    loaded.unsplitEdge(0, a, b);
+    checkPixels(loaded);
+    CHECK(loaded.edgeAlive(0) && loaded.edgeAlive(1) && !loaded.edgeAlive(merged));
+
+    // truncated input is refused and leaves an empty model
+    CHECK(!loaded.deserialize(saved.data(), saved.size() - 1));
+    CHECK(loaded.pixelCount() == 0 && loaded.edgeCount() == 0);
+}
+
+void testSnapshotWithoutPool()
+{
+    AnnotationModel model = threeEdges();
+    model.markBase();
+    int a = -1, b = -1;
+    CHECK(model.splitEdge(0, 9, a, b));
+    int merged = -1, bridge = -1;
+    CHECK(model.mergeEdges(b, AnnotationModel::TAIL, 1, AnnotationModel::HEAD, merged, bridge));
+    model.addConnection(AnnotationModel::endRef(merged, AnnotationModel::HEAD),
+                        AnnotationModel::endRef(2, AnnotationModel::TAIL));
+
+    std::vector<char> edits;
+    model.serialize(edits, true);
+    CHECK(edits.size() < bytes(model).size());
+
+    // restored onto the same edges detected again
+    AnnotationModel detected = threeEdges();
+    detected.markBase();
+    CHECK(detected.deserialize(edits.data(), edits.size()));
+    CHECK(bytes(detected) == bytes(model));
+    checkPixels(detected);
+    detected.unmergeEdges(b, 1, merged);
+    detected.unsplitEdge(0, a, b);
+    checkPixels(detected);
+
+    // other edges are refused
+    AnnotationModel other;
+    other.addEdge(line(cv::Point(0, 0), cv::Point(1, 1), 50));
+    other.markBase();
+    CHECK(!other.deserialize(edits.data(), edits.size()));
+    AnnotationModel unmarked = threeEdges();
+    CHECK(!unmarked.deserialize(edits.data(), edits.size()));
+
+    // a full snapshot keeps its base, so later snapshots can leave it out again
+    std::vector<char> full = bytes(model);
+    AnnotationModel loaded;
+    CHECK(loaded.deserialize(full.data(), full.size()));
+    CHECK(loaded.hasBase());
+    std::vector<char> again;
+    loaded.serialize(again, true);
+    CHECK(again == edits);
+}
+
+void testMoveConnections()
+{
+    AnnotationModel model = threeEdges();
+    AnnotationModel::PointRef from = AnnotationModel::endRef(0, AnnotationModel::HEAD);
+    AnnotationModel::PointRef to = AnnotationModel::endRef(2, AnnotationModel::TAIL);
+    AnnotationModel::PointRef other = AnnotationModel::endRef(1, AnnotationModel::TAIL);
+    model.addConnection(from, other);
+    model.addConnection(other, from);
+    model.moveConnections(from, to);
+    CHECK(model.connectionList()[0].first == to && model.connectionList()[0].second == other);
+    CHECK(model.connectionList()[1].first == other && model.connectionList()[1].second == to);
+}
+
+void testLongChain()
+{
+    // wider than the 16-bit offsets, stored as several chains
+    AnnotationModel model;
+    int first = model.addEdge(line(cv::Point(0, 100), cv::Point(1, 0), 70000));
+    CHECK(first == 0);
+    CHECK(model.edgeCount() == 2);
+    CHECK(model.pixel(69999) == cv::Point(69999, 100));
+    checkPixels(model);
+
+    int a = -1, b = -1;
+    CHECK(model.splitEdge(1, 10, a, b));
+    checkPixels(model);
+}
+
+template <typename T>
+void put(std::vector<char>& out, const T& value)
+{
+    const char* p = reinterpret_cast<const char*>(&value);
+    out.insert(out.end(), p, p + sizeof(T));
+}
+
+struct LegacyEdge {
+    int offset;
+    int count;
+    bool alive;
+};
+
+// a version 2 snapshot of one 10 pixel chain: the owners are the alive edges and retired
+// edges keep no record of their children
+std::vector<char> legacySnapshot(const std::vector<LegacyEdge>& edges, const std::vector<int>& owner)
+{
+    std::vector<char> out;
+    put(out, 2);
+    // no detected base
+    put(out, (char)0);
+    put(out, 0);
+    put(out, 0);
+    put(out, 0u);
+    put(out, 10);
+    for (int i = 0; i < 10; i++) {
+        put(out, (unsigned short)i);
+        put(out, (unsigned short)0);
+    }
+    put(out, 1);
+    put(out, cv::Point(0, 3));
+    put(out, (int)owner.size());
+    for (int id : owner)
+        put(out, id);
+    put(out, (int)edges.size());
+    for (const auto& e : edges) {
+        put(out, 0);
+        put(out, e.offset);
+        put(out, e.count);
+        put(out, 0);
+        put(out, e.count - 1);
+        put(out, (char)0);
+        put(out, (char)e.alive);
+    }
+    put(out, 0);    // strays
+    put(out, 0);    // stray flags
+    put(out, 0);    // connections
+    return out;
+}
+
+void testLegacySnapshot()
+{
+    // 0 split into 1 and 2, 2 split into 3 and 4; 5 is a slot padded by a replayed id
+    std::vector<LegacyEdge> edges = {{0, 10, false}, {0, 5, true}, {5, 5, false},
+                                     {5, 2, true}, {7, 3, true}, {0, 10, false}};
+    std::vector<int> owner = {1, 1, 1, 1, 1, 3, 3, 4, 4, 4};
+    std::vector<char> data = legacySnapshot(edges, owner);
+
+    AnnotationModel model;
+    CHECK(model.deserialize(data.data(), data.size()));
+    checkPixels(model);
+    int id, index;
+    CHECK(model.locatePixel(8, id, index) && id == 4 && index == 1);
+
+    // undoing the recorded splits needs the derived records
+    model.unsplitEdge(2, 3, 4);
+    checkPixels(model);
+    CHECK(model.locatePixel(8, id, index) && id == 2 && index == 3);
+    model.unsplitEdge(0, 1, 2);
+    checkPixels(model);
+    CHECK(model.locatePixel(8, id, index) && id == 0 && index == 8);
+
+    int a = 1, b = 2;
+    CHECK(model.splitEdge(0, 4, a, b));
+    checkPixels(model);
+
+    // an owner without any edge covering its chain is refused
+    std::vector<LegacyEdge> broken = {{0, 4, true}, {4, 6, true}};
+    data = legacySnapshot(broken, std::vector<int>({0, 0, 0, 0, 1, 1, 1, 1, 1, 1}));
+    CHECK(!model.deserialize(data.data(), data.size()));
+}
+
+void testLassoLongEdge()
+{
+    AnnotationModel model;
+    model.addEdge(line(cv::Point(10, 10), cv::Point(1, 0), 500));
+    model.addEdge(line(cv::Point(10, 40), cv::Point(1, 0), 500));
+    cv::Rect image(0, 0, 1000, 1000);
+
+    // a box around the first edge only
+    RegionBuilder::Polygon box = {cv::Point2f(5, 5), cv::Point2f(520, 5), cv::Point2f(520, 20), cv::Point2f(5, 20)};
+    std::vector<int> found = RegionBuilder::edgesInPolygon(model, box, image, 0.9);
+    CHECK(found == std::vector<int>({0}));
+
+    // a lasso over half of both edges takes neither
+    RegionBuilder::Polygon half = {cv::Point2f(5, 5), cv::Point2f(260, 5), cv::Point2f(260, 50), cv::Point2f(5, 50)};
+    CHECK(RegionBuilder::edgesInPolygon(model, half, image, 0.9).empty());
+
+    // hidden pixels do not count, and split halves are taken on their own
+    model.setEndIndex(0, AnnotationModel::TAIL, 240);
+    CHECK(RegionBuilder::edgesInPolygon(model, half, image, 0.9) == std::vector<int>({0}));
+    int a = -1, b = -1;
+    CHECK(model.splitEdge(1, 249, a, b));
+    CHECK(RegionBuilder::edgesInPolygon(model, half, image, 0.9) == std::vector<int>({0, a}));
+
+    // outside the image nothing is looked at
+    CHECK(RegionBuilder::edgesInPolygon(model, box, cv::Rect(600, 600, 100, 100), 0.9).empty());
+}
+
+} //end of namespace
+
+int main()
+{
+    testSplitMergeSplit();
+    testMergeReversed();
+    testUndoRedo();
+    testSerialize();
+    testSnapshotWithoutPool();
+    testMoveConnections();
+    testLongChain();
+    testLegacySnapshot();
+    testLassoLongEdge();
+
+    if (failures) {
+        std::fprintf(stderr, "%d checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    std::printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
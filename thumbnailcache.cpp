@@ -0,0 +1,54 @@
+#include "thumbnailcache.h"
+#include <QCryptographicHash>
+#include <QStandardPaths>
+#include <QFileInfo>
+#include <QDateTime>
+#include <QImageReader>
+#include <QSaveFile>
+#include <QDir>
+
+QString ThumbnailCache::cacheDir()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("thumbnails");
+}
+
+QString ThumbnailCache::cacheFile(const QString& imagePath, int size)
+{
+    QFileInfo info(imagePath);
+    if (!info.exists()) return QString();
+
+    // a changed image gets a new key, stale entries are never read again
+    QByteArray key = info.absoluteFilePath().toUtf8() + '\n'
+            + QByteArray::number(info.lastModified().toMSecsSinceEpoch()) + '\n'
+            + QByteArray::number(info.size()) + '\n'
+            + QByteArray::number(size);
+    QString name = QCryptographicHash::hash(key, QCryptographicHash::Sha1).toHex();
+    return QDir(cacheDir()).filePath(name + ".jpg");
+}
+
+QImage ThumbnailCache::thumbnail(const QString& imagePath, int size)
+{
+    QString file = cacheFile(imagePath, size);
+    if (file.isEmpty()) return QImage();
+
+    QImage cached(file);
+    if (!cached.isNull()) return cached;
+
+    // the reader scales while decoding where the format allows it, e.g. JPEG
+    QImageReader reader(imagePath);
+    reader.setAutoTransform(true);
+    QSize full = reader.size();
+    if (full.isValid())
+        reader.setScaledSize(full.scaled(size, size, Qt::KeepAspectRatio));
+    QImage image = reader.read();
+    if (image.isNull()) return image;
+    if (image.width() > size || image.height() > size)
+        image = image.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+
+    // written atomically, concurrent workers may produce the same entry
+    QDir().mkpath(cacheDir());
+    QSaveFile out(file);
+    if (out.open(QIODevice::WriteOnly) && image.save(&out, "JPG", 85))
+        out.commit();
+    return image;
+}
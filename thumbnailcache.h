@@ -0,0 +1,24 @@
+#ifndef THUMBNAILCACHE_H
+#define THUMBNAILCACHE_H
+
+#include <QImage>
+#include <QString>
+
+/**
+ *@brief thumbnails persisted on disk, keyed by the image path, modification
+ * time and size, so an image is decoded once no matter how often it is
+ * browsed. Safe to call from worker threads.
+ */
+class ThumbnailCache
+{
+public:
+    // from the disk cache, or decoded at reduced size and stored
+    static QImage thumbnail(const QString& imagePath, int size);
+
+    static QString cacheDir();
+
+private:
+    static QString cacheFile(const QString& imagePath, int size);
+};
+
+#endif // THUMBNAILCACHE_H
@@ -0,0 +1,237 @@
+#include "videosource.h"
+#include "ED.h"
+#include "edstatscollector.h"
+#include <algorithm>
+
+namespace
+{
+
+// decoded frames kept behind the current one, for stepping back
+const int KEEP_BEHIND = 2;
+// forward gaps up to this many frames are grabbed, cheaper than a keyframe seek
+const int MAX_GRAB = 32;
+
+} //end of namespace
+
+VideoSource::VideoSource(QObject *parent)
+    : QObject(parent)
+{
+    capturePos = 0;
+    frames = 0;
+    stopping = false;
+    windowStart = 0;
+    nextDecode = 0;
+    generation = 0;
+}
+
+VideoSource::~VideoSource()
+{
+    close();
+}
+
+bool VideoSource::open(const QString& path)
+{
+    close();
+    if (!capture.open(path.toStdString())) return false;
+
+    // the container's count may be an estimate, the decoder corrects it at the end
+    frames = (int)capture.get(CV_CAP_PROP_FRAME_COUNT);
+    capturePos = 0;
+    stopping = false;
+    windowStart = 0;
+    nextDecode = 0;
+    generation = 0;
+
+    // decoding is I/O and codec bound, the rest of the cores detect
+    int detectors = std::max(1, (int)std::thread::hardware_concurrency() - 2);
+    threads.push_back(std::thread(&VideoSource::decodeLoop, this));
+    for (int i = 0; i < detectors; i++)
+        threads.push_back(std::thread(&VideoSource::detectLoop, this));
+    return true;
+}
+
+void VideoSource::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    decodeWake.notify_all();
+    detectWake.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+    threads.clear();
+
+    capture.release();
+    ring.clear();
+    frames = 0;
+}
+
+bool VideoSource::isOpen() const
+{
+    return !threads.empty();
+}
+
+int VideoSource::frameCount() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return frames;
+}
+
+void VideoSource::seek(int frame)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        windowStart = frame;
+
+        while (!ring.empty() && ring.front().frame < frame - KEEP_BEHIND)
+            ring.pop_front();
+        bool trimmed = false;
+        while (!ring.empty() && ring.back().frame >= frame + RING_SIZE) {
+            ring.pop_back();
+            trimmed = true;
+        }
+
+        int first = ring.empty() ? nextDecode : ring.front().frame;
+        if (frame < first || frame > nextDecode) {
+            // outside of what is decoded, start over at the target
+            ring.clear();
+            nextDecode = frame;
+            generation++;
+        } else if (trimmed) {
+            nextDecode = ring.empty() ? frame : ring.back().frame + 1;
+            generation++;
+        }
+    }
+    decodeWake.notify_one();
+}
+
+bool VideoSource::take(int frame, ImageBuffer& buffer, AnnotationModel& edges)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    Slot* slot = findSlot(frame);
+    if (!slot || !slot->detected) return false;
+    buffer = slot->buffer;
+    edges = slot->edges;
+    return true;
+}
+
+VideoSource::Slot* VideoSource::findSlot(int frame)
+{
+    for (auto& slot : ring) {
+        if (slot.frame == frame) return &slot;
+    }
+    return NULL;
+}
+
+void VideoSource::decodeLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        decodeWake.wait(lock, [this]() {
+            return stopping || (nextDecode < windowStart + RING_SIZE && (frames <= 0 || nextDecode < frames));
+        });
+        if (stopping) return;
+
+        int frame = nextDecode;
+        int decodeGeneration = generation;
+        lock.unlock();
+
+        // the capture is only touched by this thread
+        cv::Mat mat;
+        bool ok = reposition(frame) && capture.read(mat);
+        ImageBuffer buffer;
+        if (ok) {
+            capturePos++;
+            buffer = ImageBuffer(mat);
+        }
+
+        lock.lock();
+        if (decodeGeneration != generation) continue;
+        if (!ok) {
+            // past the real end of the stream
+            frames = frame;
+            continue;
+        }
+
+        Slot slot;
+        slot.frame = frame;
+        slot.buffer = buffer;
+        slot.detecting = false;
+        slot.detected = false;
+        ring.push_back(slot);
+        nextDecode++;
+        detectWake.notify_one();
+    }
+}
+
+bool VideoSource::reposition(int frame)
+{
+    if (frame == capturePos) return true;
+
+    if (frame < capturePos || frame - capturePos > MAX_GRAB) {
+        // the backend decodes from the keyframe before frame, where it lands is read back
+        if (!capture.set(CV_CAP_PROP_POS_FRAMES, frame)) return false;
+        capturePos = (int)capture.get(CV_CAP_PROP_POS_FRAMES);
+        if (capturePos > frame || capturePos < 0) return false;
+    }
+
+    // grab() skips the conversion of the frames in between
+    while (capturePos < frame) {
+        if (!capture.grab()) return false;
+        capturePos++;
+    }
+    return true;
+}
+
+void VideoSource::detectLoop()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+        Slot* slot = NULL;
+        detectWake.wait(lock, [this, &slot]() {
+            if (stopping) return true;
+            for (auto& candidate : ring) {
+                if (!candidate.detecting && !candidate.detected) {
+                    slot = &candidate;
+                    return true;
+                }
+            }
+            return false;
+        });
+        if (stopping) return;
+
+        slot->detecting = true;
+        int frame = slot->frame;
+        ImageBuffer buffer = slot->buffer;
+        lock.unlock();
+
+        std::vector<std::list<cv::Point>> detected;
+        EDStats stats;
+        ED::detectEdgesSmoothed(buffer.luminance(), detected, ED::DEFAULT_PROPOSAL_THRESH,
+                                ED::DEFAULT_ANCHOR_INTERVAL, ED::DEFAULT_ANCHOR_THRESH, &stats);
+        EDStatsCollector::instance().add(stats, QString("frame %1").arg(frame));
+        AnnotationModel edges;
+        edges.addEdges(detected);
+
+        lock.lock();
+        // the slot may have left the window while detecting
+        slot = findSlot(frame);
+        if (!slot || slot->detected) continue;
+        slot->edges = edges;
+        slot->detected = true;
+
+        lock.unlock();
+        emit frameReady(frame);
+        lock.lock();
+    }
+}
+
+size_t VideoSource::memoryBytes() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    size_t bytes = 0;
+    for (const auto& slot : ring)
+        bytes += sizeof(Slot) + slot.buffer.memoryBytes() + slot.edges.memoryBytes();
+    return bytes;
+}
@@ -0,0 +1,84 @@
+#ifndef VIDEOSOURCE_H
+#define VIDEOSOURCE_H
+
+#include <QObject>
+#include <QString>
+#include <opencv2/highgui/highgui.hpp>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include "imagebuffer.h"
+#include "annotationmodel.h"
+
+/**
+ *@brief frames of a video decoded ahead of the current one.
+ *
+ * A decoder thread reads frames into a ring of RING_SIZE slots starting at
+ * the current frame, detector threads run ED on the decoded slots behind
+ * it. Stepping forward only drops the oldest slot, so the next frames are
+ * usually decoded and detected before they are asked for.
+ *
+ * OpenCV does not expose keyframes. A short step forward grabs the frames
+ * in between, any other seek is left to the backend, which seeks to the
+ * keyframe before the target itself; the position it reports afterwards is
+ * taken as is, so frame numbers stay exact.
+ */
+class VideoSource : public QObject
+{
+    Q_OBJECT
+public:
+    static const int RING_SIZE = 8;
+
+    explicit VideoSource(QObject *parent = 0);
+    ~VideoSource();
+
+    bool open(const QString& path);
+    void close();
+    bool isOpen() const;
+    int frameCount() const;
+
+    // moves the decode window so it starts at frame
+    void seek(int frame);
+    // fills buffer and edges if the frame has been decoded and detected
+    bool take(int frame, ImageBuffer& buffer, AnnotationModel& edges);
+    // frames and edges held by the decode window
+    size_t memoryBytes() const;
+
+signals:
+    void frameReady(int frame);
+
+private:
+    struct Slot {
+        int frame;
+        ImageBuffer buffer;
+        AnnotationModel edges;
+        bool detecting;
+        bool detected;
+    };
+
+    void decodeLoop();
+    void detectLoop();
+    bool reposition(int frame);
+    Slot* findSlot(int frame);
+
+    cv::VideoCapture capture;
+    int capturePos;
+    int frames;
+
+    std::vector<std::thread> threads;
+    mutable std::mutex mutex;
+    std::condition_variable decodeWake;
+    std::condition_variable detectWake;
+    bool stopping;
+
+    // decode window, slots ordered by frame
+    std::deque<Slot> ring;
+    int windowStart;
+    int nextDecode;
+    // bumped by seek(), decoded frames of an older window are dropped
+    int generation;
+};
+
+#endif // VIDEOSOURCE_H